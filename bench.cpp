@@ -0,0 +1,611 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "main.h"
+#include "renderer.h"
+#include "scene.h"
+#include "vertex_pack.h"
+#include "mesh_lod.h"
+#include "profiler.h"
+#include "descriptors.h"
+
+/*
+ * Renders a fixed set of scenes headless for a fixed number of frames
+ * and reports frame time percentiles, startup time, upload throughput,
+ * peak device memory, the triangles drawn per frame, descriptor set
+ * allocation throughput and the vertex encoder throughput with and
+ * without SIMD. Results can be
+ * compared against a baseline CSV from an earlier run to catch regressions.
+ */
+
+#define DEFAULT_BENCH_FRAMES 500
+#define DEFAULT_THRESHOLD 10.0f
+/* per frame descriptor sets allocated and written in each round */
+#define DESCRIPTOR_BENCH_SETS 10000
+#define DESCRIPTOR_BENCH_ROUNDS 20
+/* small scenes are encoded repeatedly until this many vertices went through */
+#define PACK_BENCH_VERTICES (4 * 1024 * 1024)
+
+typedef enum
+{
+    SCENE_QUAD,
+    SCENE_MESH,
+    SCENE_QUADS,
+    SCENE_INSTANCES,
+} scene_kind_t;
+
+typedef struct bench_scene_s
+{
+    const char *name;
+    scene_kind_t kind;
+    uint32_t count;
+} bench_scene_t;
+
+static const bench_scene_t bench_scenes[] =
+{
+    {"quad",       SCENE_QUAD,  0},
+    {"mesh-10k",   SCENE_MESH,  10000},
+    {"mesh-100k",  SCENE_MESH,  100000},
+    {"mesh-1m",    SCENE_MESH,  1000000},
+    {"draws-1",    SCENE_QUADS, 1},
+    {"draws-1k",   SCENE_QUADS, 1000},
+    {"draws-100k", SCENE_QUADS, 100000},
+    {"instances-100k", SCENE_INSTANCES, 100000},
+};
+
+#define BENCH_SCENE_COUNT (sizeof(bench_scenes) / sizeof(bench_scenes[0]))
+
+/*
+ * metrics in CSV column order, lower_is_better tells which direction
+ * is a regression when comparing against a baseline
+ */
+typedef struct metric_s
+{
+    const char *name;
+    bool lower_is_better;
+} metric_t;
+
+static const metric_t metrics[] =
+{
+    {"fps",          false},
+    {"frame_p50_ms", true},
+    {"frame_p95_ms", true},
+    {"frame_p99_ms", true},
+    {"gpu_p50_ms",   true},
+    {"startup_ms",   true},
+    {"upload_mb_s",  false},
+    {"peak_mem_mb",  true},
+    {"tris_per_frame", true},
+    {"desc_sets_per_s", false},
+    {"pack_mverts_s", false},
+    {"pack_scalar_mverts_s", false},
+};
+
+#define METRIC_COUNT (sizeof(metrics) / sizeof(metrics[0]))
+
+typedef struct bench_result_s
+{
+    std::string scene;
+    std::string device;
+    uint32_t triangles;
+    uint32_t draws;
+    uint32_t frames;
+    float values[METRIC_COUNT];
+} bench_result_t;
+
+typedef struct bench_opts_s
+{
+    uint32_t frames;
+    uint32_t framesInFlight;
+    VkExtent2D size;
+    std::vector<const bench_scene_t *> scenes;
+    const char *jsonPath;
+    const char *csvPath;
+    const char *comparePath;
+    float threshold;
+    /* cull and draw on the GPU, compare against a baseline taken the same way */
+    bool gpuDriven;
+    vertex_format_t vertexFormat;
+    /* build and select levels of detail if above 0 */
+    float lodPixelError;
+    /* depth only pass before shading */
+    bool depthPrepass;
+} bench_opts_t;
+
+static scene_t
+make_scene(const bench_opts_t *opts, const bench_scene_t *bs)
+{
+    scene_t scene;
+
+    switch (bs->kind)
+    {
+        case SCENE_QUAD:
+            scene = scene_quad();
+            break;
+        case SCENE_MESH:
+            scene = scene_mesh(bs->count);
+            break;
+        case SCENE_QUADS:
+            scene = scene_quads(bs->count);
+            break;
+        case SCENE_INSTANCES:
+            scene = scene_instanced(bs->count);
+            break;
+    }
+    scene.name = bs->name;
+
+    /* at import time, not part of the startup */
+    if (opts->lodPixelError > 0.0f)
+    {
+        scene_build_lods(&scene);
+    }
+
+    return scene;
+}
+
+/*
+ * allocate per frame sets of the renderer's layout, write them and release
+ * them with their frame slot, as a renderer with a set per draw would,
+ * returns sets per second
+ */
+static float
+descriptor_throughput(handles_t *handles)
+{
+    std::vector<VkDescriptorSet> sets(DESCRIPTOR_BENCH_SETS);
+
+    descriptor_buffer_t ubo = {};
+    ubo.binding = 0;
+    ubo.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    ubo.buffer = handles->uniformBuffer;
+    ubo.range = sizeof(UniformBufferObject);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t r = 0; r < DESCRIPTOR_BENCH_ROUNDS; r++)
+    {
+        uint32_t frame = r % handles->framesInFlight;
+
+        descriptors_frame(handles, frame);
+        descriptor_sets_frame(handles, frame, handles->descriptorSetLayout,
+                              DESCRIPTOR_BENCH_SETS, sets.data());
+        for (uint32_t i = 0; i < DESCRIPTOR_BENCH_SETS; i++)
+        {
+            descriptor_write(handles, sets[i], &ubo, 1);
+        }
+        descriptors_flush(handles);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    float elapsed = std::chrono::duration<float>(end - start).count();
+    return elapsed > 0.0f ? DESCRIPTOR_BENCH_SETS * DESCRIPTOR_BENCH_ROUNDS / elapsed : 0.0f;
+}
+
+/* millions of vertices per second through vertex_pack() or vertex_pack_scalar() */
+static float
+pack_throughput(const scene_t *scene, bool scalar)
+{
+    size_t count;
+    const Vertex *vertices = scene_vertices(scene, &count);
+    if (count == 0)
+    {
+        return 0.0f;
+    }
+
+    std::vector<VertexPacked> packed(count);
+    glm::vec4 scale, offset;
+    size_t rounds = std::max((size_t)1, PACK_BENCH_VERTICES / count);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        if (scalar)
+        {
+            vertex_pack_scalar(vertices, count, packed.data(), &scale, &offset);
+        }
+        else
+        {
+            vertex_pack(vertices, count, packed.data(), &scale, &offset);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    float elapsed = std::chrono::duration<float>(end - start).count();
+    return elapsed > 0.0f ? rounds * count / elapsed / 1e6f : 0.0f;
+}
+
+static bench_result_t
+run_scene(const bench_opts_t *opts, const bench_scene_t *bs)
+{
+    bench_result_t res;
+    printf("=== %s ===\n", bs->name);
+
+    scene_t scene = make_scene(opts, bs);
+
+    /* fresh handles for every scene, so nothing carries over */
+    handles_t *handles = new handles_t();
+    renderer_defaults(handles);
+    handles->headless = true;
+    handles->profileEnabled = true;
+    handles->framesInFlight = opts->framesInFlight;
+    handles->swapchainExtend = opts->size;
+    handles->gpuDriven = opts->gpuDriven;
+    handles->vertexFormat = opts->vertexFormat;
+    handles->lodPixelError = opts->lodPixelError;
+    handles->depthPrepass = opts->depthPrepass;
+
+    init_vulkan(handles, &scene);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < opts->frames; i++)
+    {
+        draw_frame_headless(handles);
+    }
+    vkDeviceWaitIdle(handles->device);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    float elapsed = std::chrono::duration<float>(end - start).count();
+
+    /* nothing is in flight anymore, every frame slot can be released */
+    float descriptorRate = descriptor_throughput(handles);
+
+    VkDeviceSize used, peak;
+    gpu_alloc_usage(handles, &used, &peak);
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(handles->phyDevice, &props);
+
+    res.scene = bs->name;
+    res.device = props.deviceName;
+    /* keep the CSV parseable */
+    for (size_t i = 0; i < res.device.size(); i++)
+    {
+        if (res.device[i] == ',' || res.device[i] == '"')
+        {
+            res.device[i] = ' ';
+        }
+    }
+    res.triangles = scene_triangles(&scene);
+    res.draws = (uint32_t)scene.draws.size();
+    res.frames = opts->frames;
+    res.values[0] = opts->frames / elapsed;
+    res.values[1] = profiler_percentile(handles, PROF_FRAME, 50);
+    res.values[2] = profiler_percentile(handles, PROF_FRAME, 95);
+    res.values[3] = profiler_percentile(handles, PROF_FRAME, 99);
+    res.values[4] = profiler_percentile(handles, PROF_GPU_RENDER, 50);
+    res.values[5] = handles->startupSeconds * 1000.0f;
+    res.values[6] = handles->uploadSeconds > 0.0f ?
+        handles->uploadBytes / (1024.0f * 1024.0f) / handles->uploadSeconds : 0.0f;
+    res.values[7] = peak / (1024.0f * 1024.0f);
+    res.values[8] = (float)handles->trianglesDrawn / opts->frames;
+    res.values[9] = descriptorRate;
+    res.values[10] = pack_throughput(&scene, false);
+    res.values[11] = pack_throughput(&scene, true);
+
+    if (!scene.lods.empty())
+    {
+        printf("levels of detail: %.0f of %u triangles per frame, %.1f%% fewer\n",
+               res.values[8], res.triangles,
+               res.triangles > 0 ? 100.0f * (1.0f - res.values[8] / res.triangles) : 0.0f);
+    }
+
+    printf("descriptor sets: %.0f per second allocated and written\n", res.values[9]);
+    printf("vertex encoder: %.1f M vertices/s, %.1f M without SIMD, %.2fx\n",
+           res.values[10], res.values[11],
+           res.values[11] > 0.0f ? res.values[10] / res.values[11] : 0.0f);
+
+    cleanup_vulkan(handles);
+    delete handles;
+
+    return res;
+}
+
+static void
+write_csv(FILE *f, const std::vector<bench_result_t>& results)
+{
+    fprintf(f, "scene,device,triangles,draws,frames");
+    for (size_t m = 0; m < METRIC_COUNT; m++)
+    {
+        fprintf(f, ",%s", metrics[m].name);
+    }
+    fprintf(f, "\n");
+
+    for (auto r = results.begin(); r != results.end(); ++r)
+    {
+        fprintf(f, "%s,%s,%u,%u,%u", r->scene.c_str(), r->device.c_str(),
+                r->triangles, r->draws, r->frames);
+        for (size_t m = 0; m < METRIC_COUNT; m++)
+        {
+            fprintf(f, ",%.4f", r->values[m]);
+        }
+        fprintf(f, "\n");
+    }
+}
+
+static void
+write_json(FILE *f, const std::vector<bench_result_t>& results)
+{
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const bench_result_t *r = &results[i];
+
+        fprintf(f, "  {\"scene\": \"%s\", \"device\": \"%s\", "
+                   "\"triangles\": %u, \"draws\": %u, \"frames\": %u",
+                r->scene.c_str(), r->device.c_str(),
+                r->triangles, r->draws, r->frames);
+        for (size_t m = 0; m < METRIC_COUNT; m++)
+        {
+            fprintf(f, ", \"%s\": %.4f", metrics[m].name, r->values[m]);
+        }
+        fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+static void
+write_file(const char *path, const std::vector<bench_result_t>& results,
+           void (*writer)(FILE *, const std::vector<bench_result_t>&))
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("can't write %s\n", path);
+        return;
+    }
+    writer(f, results);
+    fclose(f);
+}
+
+static std::vector<std::string>
+split_csv(const std::string& line)
+{
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+
+    while (std::getline(ss, field, ','))
+    {
+        fields.push_back(field);
+    }
+
+    return fields;
+}
+
+/*
+ * compare against a baseline CSV written by --csv, returns the number
+ * of metrics that got worse by more than threshold percent
+ */
+static int
+compare(const char *path, float threshold, const std::vector<bench_result_t>& results)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        printf("can't read baseline %s\n", path);
+        return 1;
+    }
+
+    std::string line;
+    std::getline(file, line);
+    std::vector<std::string> header = split_csv(line);
+
+    /* scene -> metric name -> value */
+    std::map<std::string, std::map<std::string, float> > baseline;
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields = split_csv(line);
+        for (size_t i = 1; i < fields.size() && i < header.size(); i++)
+        {
+            baseline[fields[0]][header[i]] = (float)atof(fields[i].c_str());
+        }
+    }
+
+    int regressions = 0;
+
+    printf("%-12s %-14s %12s %12s %8s\n", "scene", "metric", "baseline", "current", "change");
+    for (auto r = results.begin(); r != results.end(); ++r)
+    {
+        auto base = baseline.find(r->scene);
+        if (base == baseline.end())
+        {
+            printf("%-12s not in baseline\n", r->scene.c_str());
+            continue;
+        }
+
+        for (size_t m = 0; m < METRIC_COUNT; m++)
+        {
+            auto value = base->second.find(metrics[m].name);
+            if (value == base->second.end() || value->second == 0.0f)
+            {
+                continue;
+            }
+
+            float old = value->second;
+            float change = (r->values[m] - old) / old * 100.0f;
+            bool worse = metrics[m].lower_is_better ? change > threshold : change < -threshold;
+
+            printf("%-12s %-14s %12.3f %12.3f %+7.1f%%%s\n",
+                   r->scene.c_str(), metrics[m].name, old, r->values[m], change,
+                   worse ? "  REGRESSION" : "");
+
+            regressions += worse ? 1 : 0;
+        }
+    }
+
+    printf("%d regression(s) over %.1f%%\n", regressions, threshold);
+
+    return regressions;
+}
+
+static void
+usage(const char *prog)
+{
+    printf("usage: %s [--frames N] [-f frames-in-flight] [--size WxH] [--scene name]...\n"
+           "       [--json file] [--csv file] [--compare baseline.csv] [--threshold percent]\n"
+           "       [--gpu-driven] [--vertex-format auto|float|packed] [--lod-error pixels]\n"
+           "       [--depth-prepass]\n"
+           "scenes:", prog);
+    for (size_t i = 0; i < BENCH_SCENE_COUNT; i++)
+    {
+        printf(" %s", bench_scenes[i].name);
+    }
+    printf("\n");
+    exit(EXIT_FAILURE);
+}
+
+static void
+parse_args(bench_opts_t *opts, int argc, char *argv[])
+{
+    opts->frames = DEFAULT_BENCH_FRAMES;
+    opts->framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    opts->size.width = 800;
+    opts->size.height = 600;
+    opts->jsonPath = NULL;
+    opts->csvPath = NULL;
+    opts->comparePath = NULL;
+    opts->threshold = DEFAULT_THRESHOLD;
+    opts->gpuDriven = false;
+    opts->vertexFormat = VERTEX_FORMAT_AUTO;
+    opts->lodPixelError = 0.0f;
+    opts->depthPrepass = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            int n = atoi(argv[++i]);
+            if (n < 1)
+            {
+                usage(argv[0]);
+            }
+            opts->frames = n;
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+            int n = atoi(argv[++i]);
+            if (n < 1 || n > MAX_FRAMES_IN_FLIGHT)
+            {
+                usage(argv[0]);
+            }
+            opts->framesInFlight = n;
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            unsigned w, h;
+            if (sscanf(argv[++i], "%ux%u", &w, &h) != 2 || w == 0 || h == 0)
+            {
+                usage(argv[0]);
+            }
+            opts->size.width = w;
+            opts->size.height = h;
+        }
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+            size_t s;
+            for (s = 0; s < BENCH_SCENE_COUNT; s++)
+            {
+                if (strcmp(bench_scenes[s].name, name) == 0)
+                {
+                    opts->scenes.push_back(&bench_scenes[s]);
+                    break;
+                }
+            }
+            if (s == BENCH_SCENE_COUNT)
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            opts->jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+        {
+            opts->csvPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+        {
+            opts->comparePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+        {
+            opts->threshold = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--gpu-driven") == 0)
+        {
+            opts->gpuDriven = true;
+        }
+        else if (strcmp(argv[i], "--vertex-format") == 0 && i + 1 < argc)
+        {
+            if (!vertex_format_parse(argv[++i], &(opts->vertexFormat)))
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+        {
+            opts->lodPixelError = (float)atof(argv[++i]);
+            if (opts->lodPixelError < 0.0f)
+            {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--depth-prepass") == 0)
+        {
+            opts->depthPrepass = true;
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    /* all scenes by default */
+    if (opts->scenes.empty())
+    {
+        for (size_t s = 0; s < BENCH_SCENE_COUNT; s++)
+        {
+            opts->scenes.push_back(&bench_scenes[s]);
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    bench_opts_t opts;
+    std::vector<bench_result_t> results;
+
+    parse_args(&opts, argc, argv);
+
+    for (auto s = opts.scenes.begin(); s != opts.scenes.end(); ++s)
+    {
+        results.push_back(run_scene(&opts, *s));
+    }
+
+    write_json(stdout, results);
+    if (opts.jsonPath != NULL)
+    {
+        write_file(opts.jsonPath, results, write_json);
+    }
+    if (opts.csvPath != NULL)
+    {
+        write_file(opts.csvPath, results, write_csv);
+    }
+
+    if (opts.comparePath != NULL &&
+        compare(opts.comparePath, opts.threshold, results) > 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,91 +1,305 @@
+#include <algorithm>
+
 #include "cmd_buf.h"
+#include "cull.h"
+#include "descriptors.h"
+#include "profiler.h"
+#include "thread_pool.h"
 #include "utils.h"
 
-void
-create_command_pool(handles_t *handles)
+/* below this many draws per slice, handing work to a thread costs more than it saves */
+#define MIN_DRAWS_PER_SLICE 512
+
+static VkCommandPool
+create_pool(handles_t *handles)
 {
+    VkCommandPool pool;
     VkCommandPoolCreateInfo poolInfo = {};
 
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    /* buffers are only reset together with the pool */
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
     poolInfo.queueFamilyIndex = handles->gfxFamilyIndex;
 
     check_res(
-        vkCreateCommandPool(handles->device, &poolInfo, NULL, &(handles->commandPool)),
+        vkCreateCommandPool(handles->device, &poolInfo, NULL, &pool),
         "vkCreateCommandPool");
+
+    return pool;
 }
 
-void
-create_command_buffers(handles_t *handles, uint32_t index_count)
+static VkCommandBuffer
+allocate_buffer(handles_t *handles, VkCommandPool pool, VkCommandBufferLevel level)
 {
-    handles->commandBuffers.resize(handles->swapChainFramebuffers.size());
-
+    VkCommandBuffer cmdBuf;
     VkCommandBufferAllocateInfo allocInfo = {};
+
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = handles->commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (uint32_t) handles->commandBuffers.size();
+    allocInfo.commandPool = pool;
+    allocInfo.level = level;
+    allocInfo.commandBufferCount = 1;
 
     check_res(
-        vkAllocateCommandBuffers(handles->device, &allocInfo, handles->commandBuffers.data()),
+        vkAllocateCommandBuffers(handles->device, &allocInfo, &cmdBuf),
         "vkAllocateCommandBuffers");
 
+    return cmdBuf;
+}
+
+/*
+ * record draws [first, last) into a secondary buffer continuing the
+ * render pass on framebuffer of image, with the depth only pipeline if
+ * depthOnly
+ */
+static void
+record_slice(handles_t *handles, VkCommandBuffer cmdBuf,
+             uint32_t frame, uint32_t image, size_t first, size_t last,
+             bool depthOnly)
+{
+    VkCommandBufferInheritanceInfo inheritance = {};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass = handles->renderPass;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = handles->swapChainFramebuffers[image];
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                      VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritance;
+
+    vkBeginCommandBuffer(cmdBuf, &beginInfo);
+
+    bool instanced = handles->instanceCount > 0;
+
+    /* secondary buffers inherit no state, bind everything */
+    VkPipeline pipeline = instanced ? handles->instancedPipeline : handles->gfxPipeline;
+    vkCmdBindPipeline(cmdBuf,
+                      VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      depthOnly ? handles->depthPipeline : pipeline);
+
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float) handles->swapchainExtend.width;
+    viewport.height = (float) handles->swapchainExtend.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(cmdBuf, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.offset = {0, 0};
+    scissor.extent = handles->swapchainExtend;
+    vkCmdSetScissor(cmdBuf, 0, 1, &scissor);
+
+    VkBuffer vertexBuffers[] = {handles->vertexBuffer};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(cmdBuf, 0, 1, vertexBuffers, offsets);
+
+    if (instanced)
+    {
+        /* this frame's slot in the instance ring */
+        VkDeviceSize instanceOffset = frame * handles->instanceBufferStride;
+        vkCmdBindVertexBuffers(cmdBuf, 1, 1, &(handles->instanceBuffer), &instanceOffset);
+    }
+
+    vkCmdBindIndexBuffer(cmdBuf,
+                         handles->indexBuffer,
+                         0, handles->indexType);
+
+    /* select this frame's slot in the uniform buffer ring */
+    uint32_t uboOffset = (uint32_t)(frame * handles->uniformBufferStride);
+    vkCmdBindDescriptorSets(
+        cmdBuf,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        handles->pipelineLayout, 0, 1, &(handles->descriptorSet),
+        1, &uboOffset);
+
+    if (handles->gpuDriven)
+    {
+        /* draw calls built by the culling pass, all in model space */
+        vkCmdPushConstants(cmdBuf, handles->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                           0, sizeof(DrawPushConstants), &(handles->objectPush[0]));
+        cull_draw(handles, cmdBuf, frame);
+    }
+    else
+    {
+        /* draw calls, a new transform is pushed only when the object changes */
+        uint32_t pushed = UINT32_MAX;
+        for (size_t i = first; i < last; i++)
+        {
+            const draw_t *draw = &(handles->draws[i]);
+            if (draw->object != pushed)
+            {
+                vkCmdPushConstants(cmdBuf, handles->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                                   0, sizeof(DrawPushConstants), &(handles->objectPush[draw->object]));
+                pushed = draw->object;
+            }
+            vkCmdDrawIndexed(cmdBuf,
+                             draw->indexCount, draw->instanceCount,
+                             draw->firstIndex, draw->vertexOffset, draw->firstInstance);
+        }
+    }
+
+    check_res(
+        vkEndCommandBuffer(cmdBuf),
+        "vkEndCommandBuffer secondary");
+}
+
+void
+create_command_buffers(handles_t *handles)
+{
+    /* one slice per worker at most */
+    uint32_t slices = thread_pool_size(handles);
+
+    handles->frameCmds.resize(handles->framesInFlight);
+
+    for (uint32_t frame = 0; frame < handles->framesInFlight; frame++)
+    {
+        frame_cmds_t *fc = &(handles->frameCmds[frame]);
+
+        fc->primaryPool = create_pool(handles);
+        fc->primary = allocate_buffer(handles, fc->primaryPool,
+                                      VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+        fc->slicePools.resize(slices);
+        fc->secondaries.resize(slices);
+        fc->depthSecondaries.resize(handles->depthPrepass ? slices : 0);
+        for (uint32_t i = 0; i < slices; i++)
+        {
+            fc->slicePools[i] = create_pool(handles);
+            fc->secondaries[i] = allocate_buffer(handles, fc->slicePools[i],
+                                                 VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+            if (handles->depthPrepass)
+            {
+                fc->depthSecondaries[i] = allocate_buffer(handles, fc->slicePools[i],
+                                                          VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+            }
+        }
+    }
+}
+
+void
+cleanup_command_buffers(handles_t *handles)
+{
+    /* destroying a pool frees its buffers */
+    for (auto fc = handles->frameCmds.begin(); fc != handles->frameCmds.end(); ++fc)
+    {
+        vkDestroyCommandPool(handles->device, fc->primaryPool, NULL);
+        for (auto pool = fc->slicePools.begin(); pool != fc->slicePools.end(); ++pool)
+        {
+            vkDestroyCommandPool(handles->device, *pool, NULL);
+        }
+    }
+    handles->frameCmds.clear();
+}
+
+VkCommandBuffer
+record_frame(handles_t *handles, uint32_t frame, uint32_t image)
+{
+    frame_cmds_t *fc = &(handles->frameCmds[frame]);
+    size_t drawCount = handles->draws.size();
+
+    size_t slices = (drawCount + MIN_DRAWS_PER_SLICE - 1) / MIN_DRAWS_PER_SLICE;
+    slices = std::max<size_t>(1, std::min(slices, fc->secondaries.size()));
+    /* the whole draw list is a single indirect draw in GPU driven mode */
+    if (handles->gpuDriven)
+    {
+        slices = 1;
+    }
+    size_t perSlice = (drawCount + slices - 1) / slices;
+
+    /* sets written since the last frame, before any slice binds them */
+    descriptors_flush(handles);
+
+    /* everything recorded from these pools last time has finished executing */
+    vkResetCommandPool(handles->device, fc->primaryPool, 0);
+    for (size_t i = 0; i < slices; i++)
+    {
+        vkResetCommandPool(handles->device, fc->slicePools[i], 0);
+    }
+
+    /* hand slices to the workers, record the first one here */
+    std::vector<std::future<void> > jobs;
+    for (size_t i = 1; i < slices; i++)
+    {
+        size_t first = std::min(drawCount, i * perSlice);
+        size_t last = std::min(drawCount, first + perSlice);
+        VkCommandBuffer cmdBuf = fc->secondaries[i];
 
+        VkCommandBuffer depthCmdBuf = handles->depthPrepass ? fc->depthSecondaries[i] : VK_NULL_HANDLE;
 
-    for (size_t i = 0; i < handles->commandBuffers.size(); i++)
+        jobs.push_back(thread_pool_run(handles, [=] {
+            if (depthCmdBuf != VK_NULL_HANDLE)
+            {
+                record_slice(handles, depthCmdBuf, frame, image, first, last, true);
+            }
+            record_slice(handles, cmdBuf, frame, image, first, last, false);
+        }));
+    }
+    if (handles->depthPrepass)
     {
-        float clr = ((float)i) * 0.5f;
-        VkClearValue clearColor = {clr, 1-clr, 0.2f, 1.0f};
-
-        /* begin command buffer recoding */
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-        vkBeginCommandBuffer(handles->commandBuffers[i], &beginInfo);
-
-        /* begin render pass */
-        VkRenderPassBeginInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = handles->renderPass;
-        renderPassInfo.framebuffer = handles->swapChainFramebuffers[i];
-        renderPassInfo.renderArea.offset = {0, 0};
-        renderPassInfo.renderArea.extent = handles->swapchainExtend;
-        renderPassInfo.clearValueCount = 1;
-        renderPassInfo.pClearValues = &clearColor;
-
-        vkCmdBeginRenderPass(handles->commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-            /* bind gfx pipeline */
-            vkCmdBindPipeline(handles->commandBuffers[i],
-                              VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              handles->gfxPipeline);
-
-            VkBuffer vertexBuffers[] = {handles->vertexBuffer};
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(handles->commandBuffers[i], 0, 1, vertexBuffers, offsets);
-
-            vkCmdBindIndexBuffer(handles->commandBuffers[i],
-                                 handles->indexBuffer,
-                                 0, VK_INDEX_TYPE_UINT16);
-
-            vkCmdBindDescriptorSets(
-                handles->commandBuffers[i],
-                VK_PIPELINE_BIND_POINT_GRAPHICS,
-                handles->pipelineLayout, 0, 1, &(handles->descriptorSet),
-                0, NULL);
-
-            /* draw call */
-            vkCmdDrawIndexed(handles->commandBuffers[i],
-                             index_count,
-                             1, 0, 0, 0);
-
-        /* end draw call */
-        vkCmdEndRenderPass(handles->commandBuffers[i]);
-
-        /* end command buffer recording */
-        check_res(
-            vkEndCommandBuffer(handles->commandBuffers[i]),
-            "vkEndCommandBuffer");
+        record_slice(handles, fc->depthSecondaries[0], frame, image,
+                     0, std::min(drawCount, perSlice), true);
     }
+    record_slice(handles, fc->secondaries[0], frame, image,
+                 0, std::min(drawCount, perSlice), false);
 
-}
\ No newline at end of file
+    /*
+     * the whole depth pre-pass runs before any slice shades, else a later
+     * slice's occluder would not be in the depth buffer yet
+     */
+    std::vector<VkCommandBuffer> executed;
+    if (handles->depthPrepass)
+    {
+        executed.assign(fc->depthSecondaries.begin(), fc->depthSecondaries.begin() + slices);
+    }
+    executed.insert(executed.end(), fc->secondaries.begin(), fc->secondaries.begin() + slices);
+
+    /* primary buffer, recorded meanwhile */
+    float clr = ((float)image) * 0.5f;
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color = {{clr, 1-clr, 0.2f, 1.0f}};
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(fc->primary, &beginInfo);
+
+    profiler_cmd_begin(handles, fc->primary, frame);
+
+    if (handles->gpuDriven)
+    {
+        cull_record(handles, fc->primary, frame);
+    }
+
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = handles->renderPass;
+    renderPassInfo.framebuffer = handles->swapChainFramebuffers[image];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = handles->swapchainExtend;
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+
+    vkCmdBeginRenderPass(fc->primary, &renderPassInfo,
+                         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    for (auto job = jobs.begin(); job != jobs.end(); ++job)
+    {
+        job->get();
+    }
+    vkCmdExecuteCommands(fc->primary, (uint32_t)executed.size(), executed.data());
+
+    vkCmdEndRenderPass(fc->primary);
+
+    profiler_cmd_end(handles, fc->primary, frame);
+
+    check_res(
+        vkEndCommandBuffer(fc->primary),
+        "vkEndCommandBuffer");
+
+    return fc->primary;
+}
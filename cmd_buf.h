@@ -2,8 +2,26 @@
 
 #include "main.h"
 
+/*
+ * Command buffers are recorded every frame. Each frame in flight has a
+ * primary pool and one pool per recording slice, slices of the draw list
+ * are recorded into secondary buffers in parallel on the thread pool and
+ * executed from the primary buffer. A frame's pools are reset wholesale
+ * before it is recorded again.
+ *
+ * In GPU driven mode the primary buffer also records the culling pass
+ * and a single slice draws everything indirectly, see cull.h.
+ */
+
 void
-create_command_pool(handles_t *handles);
+create_command_buffers(handles_t *handles);
 
 void
-create_command_buffers(handles_t *handles, uint32_t index_count);
\ No newline at end of file
+cleanup_command_buffers(handles_t *handles);
+
+/*
+ * record the frame's commands for rendering into image, the frame's
+ * fence must have signaled, returns the primary buffer to submit
+ */
+VkCommandBuffer
+record_frame(handles_t *handles, uint32_t frame, uint32_t image);
@@ -0,0 +1,348 @@
+#include <stdio.h>
+
+#include "cull.h"
+#include "descriptors.h"
+#include "gpu_buf.h"
+#include "shaders.h"
+#include "upload.h"
+#include "utils.h"
+
+/* local size of cull.comp, given to it as specialization constant 0 */
+#define CULL_GROUP_SIZE 64
+
+/* one culling candidate, std430 layout of Object in cull.comp */
+typedef struct cull_object_s
+{
+    /* xyz center and w radius of the bounding sphere, never culled if negative */
+    glm::vec4 sphere;
+    VkDrawIndexedIndirectCommand cmd;
+    uint32_t pad[3];
+} cull_object_t;
+
+typedef struct cull_params_s
+{
+    uint32_t objectCount;
+} cull_params_t;
+
+struct cull_s
+{
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    VkDescriptorSet descriptorSet;
+
+    uint32_t objectCount;
+    VkBuffer objectBuffer;
+    gpu_allocation_t objectAlloc;
+
+    /* one slot of draw commands and one draw count per frame in flight */
+    VkBuffer commandBuffer;
+    gpu_allocation_t commandAlloc;
+    VkDeviceSize commandStride;
+    VkBuffer countBuffer;
+    gpu_allocation_t countAlloc;
+    VkDeviceSize countStride;
+
+    /* NULL if the device lacks VK_AMD_draw_indirect_count, the one in the 1.0 headers */
+    PFN_vkCmdDrawIndexedIndirectCountAMD drawIndexedIndirectCount;
+};
+
+static VkDeviceSize
+align_up(VkDeviceSize size, VkDeviceSize align)
+{
+    return align > 0 ? (size + align - 1) & ~(align - 1) : size;
+}
+
+void
+cull_init(handles_t *handles)
+{
+    cull_s *cull = new cull_s();
+
+    if (handles->drawIndirectCount)
+    {
+        cull->drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountAMD)
+            vkGetDeviceProcAddr(handles->device, "vkCmdDrawIndexedIndirectCountAMD");
+    }
+    printf("GPU driven draws, %s\n",
+           cull->drawIndexedIndirectCount != NULL ? "compacted" : "not compacted");
+
+    /* uniform buffer, objects, draw commands and draw count */
+    VkDescriptorSetLayoutBinding bindings[4] = {};
+    VkDescriptorType types[4] = {
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+    };
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = types[i];
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 4;
+    layoutInfo.pBindings = bindings;
+
+    check_res(
+        vkCreateDescriptorSetLayout(handles->device, &layoutInfo, NULL, &(cull->setLayout)),
+        "vkCreateDescriptorSetLayout cull");
+
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(cull_params_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &(cull->setLayout);
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+    check_res(
+        vkCreatePipelineLayout(handles->device, &pipelineLayoutInfo,
+                               NULL, &(cull->pipelineLayout)),
+        "vkCreatePipelineLayout cull");
+
+    handles->cull = cull;
+}
+
+void
+cull_cleanup(handles_t *handles)
+{
+    cull_s *cull = handles->cull;
+
+    if (cull == NULL)
+    {
+        return;
+    }
+
+    vkDestroyBuffer(handles->device, cull->countBuffer, NULL);
+    gpu_free(handles, &(cull->countAlloc));
+    vkDestroyBuffer(handles->device, cull->commandBuffer, NULL);
+    gpu_free(handles, &(cull->commandAlloc));
+    vkDestroyBuffer(handles->device, cull->objectBuffer, NULL);
+    gpu_free(handles, &(cull->objectAlloc));
+
+    vkDestroyPipeline(handles->device, cull->pipeline, NULL);
+    vkDestroyPipelineLayout(handles->device, cull->pipelineLayout, NULL);
+    vkDestroyDescriptorSetLayout(handles->device, cull->setLayout, NULL);
+
+    delete cull;
+    handles->cull = NULL;
+}
+
+void
+cull_create_pipeline(handles_t *handles, const std::vector<char>& shaderCode)
+{
+    cull_s *cull = handles->cull;
+    VkShaderModule module = create_shader_module(handles, shaderCode);
+
+    /* group size and compaction are fixed per device, branch on neither at run time */
+    uint32_t specData[2] = {CULL_GROUP_SIZE, cull->drawIndexedIndirectCount != NULL ? 1u : 0u};
+    VkSpecializationMapEntry specEntries[2];
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        specEntries[i].constantID = i;
+        specEntries[i].offset = i * sizeof(uint32_t);
+        specEntries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specInfo = {};
+    specInfo.mapEntryCount = 2;
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = sizeof(specData);
+    specInfo.pData = specData;
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = module;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.pSpecializationInfo = &specInfo;
+    pipelineInfo.layout = cull->pipelineLayout;
+
+    check_res(
+        vkCreateComputePipelines(handles->device, handles->pipelineCache, 1,
+                                 &pipelineInfo, NULL, &(cull->pipeline)),
+        "vkCreateComputePipelines cull");
+
+    vkDestroyShaderModule(handles->device, module, NULL);
+}
+
+void
+cull_create_buffers(handles_t *handles, const scene_t *scene)
+{
+    cull_s *cull = handles->cull;
+
+    std::vector<cull_object_t> objects(scene->draws.size());
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        const draw_t *draw = &(scene->draws[i]);
+        cull_object_t *obj = &(objects[i]);
+
+        /* instances are placed by the vertex shader, don't cull them */
+        obj->sphere = scene->instances.empty() ? scene_draw_sphere(scene, i) :
+                      glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+        obj->cmd.indexCount = draw->indexCount;
+        obj->cmd.instanceCount = draw->instanceCount;
+        obj->cmd.firstIndex = draw->firstIndex;
+        obj->cmd.vertexOffset = draw->vertexOffset;
+        obj->cmd.firstInstance = draw->firstInstance;
+    }
+    cull->objectCount = (uint32_t)objects.size();
+
+    VkDeviceSize objectsSize = sizeof(cull_object_t) * objects.size();
+    createBuffer(handles, objectsSize,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 cull->objectBuffer, cull->objectAlloc);
+    upload_buffer(handles, cull->objectBuffer, 0, objects.data(), objectsSize);
+
+    /* slots are bound with dynamic offsets */
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(handles->phyDevice, &props);
+    VkDeviceSize align = props.limits.minStorageBufferOffsetAlignment;
+
+    cull->commandStride = align_up(sizeof(VkDrawIndexedIndirectCommand) * objects.size(), align);
+    createBuffer(handles, cull->commandStride * handles->framesInFlight,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 cull->commandBuffer, cull->commandAlloc);
+
+    /* cleared with vkCmdFillBuffer every frame */
+    cull->countStride = align_up(sizeof(uint32_t), align);
+    createBuffer(handles, cull->countStride * handles->framesInFlight,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 cull->countBuffer, cull->countAlloc);
+}
+
+void
+cull_create_descriptor_set(handles_t *handles)
+{
+    cull_s *cull = handles->cull;
+
+    /* the frame's slots are selected with dynamic offsets */
+    descriptor_buffer_t buffers[4] = {};
+    buffers[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    buffers[0].buffer = handles->uniformBuffer;
+    buffers[0].range = sizeof(UniformBufferObject);
+    buffers[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    buffers[1].buffer = cull->objectBuffer;
+    buffers[1].range = VK_WHOLE_SIZE;
+    buffers[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    buffers[2].buffer = cull->commandBuffer;
+    buffers[2].range = sizeof(VkDrawIndexedIndirectCommand) * cull->objectCount;
+    buffers[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    buffers[3].buffer = cull->countBuffer;
+    buffers[3].range = sizeof(uint32_t);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        buffers[i].binding = i;
+    }
+
+    cull->descriptorSet = descriptor_set_cached(handles, cull->setLayout, buffers, 4);
+}
+
+void
+cull_record(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame)
+{
+    cull_s *cull = handles->cull;
+    VkDeviceSize commandOffset = frame * cull->commandStride;
+    VkDeviceSize countOffset = frame * cull->countStride;
+
+    /* the frame's previous indirect draw finished before its fence signaled */
+    vkCmdFillBuffer(cmdBuf, cull->countBuffer, countOffset, sizeof(uint32_t), 0);
+
+    VkBufferMemoryBarrier clearBarrier = {};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    clearBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    clearBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    clearBarrier.buffer = cull->countBuffer;
+    clearBarrier.offset = countOffset;
+    clearBarrier.size = sizeof(uint32_t);
+
+    vkCmdPipelineBarrier(cmdBuf,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, NULL, 1, &clearBarrier, 0, NULL);
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, cull->pipeline);
+
+    uint32_t dynamicOffsets[3] = {
+        (uint32_t)(frame * handles->uniformBufferStride),
+        (uint32_t)commandOffset,
+        (uint32_t)countOffset,
+    };
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            cull->pipelineLayout, 0, 1, &(cull->descriptorSet),
+                            3, dynamicOffsets);
+
+    cull_params_t params;
+    params.objectCount = cull->objectCount;
+    vkCmdPushConstants(cmdBuf, cull->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(params), &params);
+
+    vkCmdDispatch(cmdBuf, (cull->objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    /* commands and count are read by the indirect draw */
+    VkBufferMemoryBarrier drawBarriers[2] = {};
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        drawBarriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        drawBarriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        drawBarriers[i].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        drawBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        drawBarriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+    drawBarriers[0].buffer = cull->commandBuffer;
+    drawBarriers[0].offset = commandOffset;
+    drawBarriers[0].size = sizeof(VkDrawIndexedIndirectCommand) * cull->objectCount;
+    drawBarriers[1].buffer = cull->countBuffer;
+    drawBarriers[1].offset = countOffset;
+    drawBarriers[1].size = sizeof(uint32_t);
+
+    vkCmdPipelineBarrier(cmdBuf,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         0, 0, NULL, 2, drawBarriers, 0, NULL);
+}
+
+void
+cull_draw(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame)
+{
+    cull_s *cull = handles->cull;
+    VkDeviceSize commandOffset = frame * cull->commandStride;
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+    if (cull->drawIndexedIndirectCount != NULL)
+    {
+        cull->drawIndexedIndirectCount(cmdBuf, cull->commandBuffer, commandOffset,
+                                       cull->countBuffer, frame * cull->countStride,
+                                       cull->objectCount, stride);
+    }
+    else if (handles->multiDrawIndirect)
+    {
+        /* culled draws have zero instances */
+        vkCmdDrawIndexedIndirect(cmdBuf, cull->commandBuffer, commandOffset,
+                                 cull->objectCount, stride);
+    }
+    else
+    {
+        /* one draw per record, the CPU cost grows with the draws again */
+        for (uint32_t i = 0; i < cull->objectCount; i++)
+        {
+            vkCmdDrawIndexedIndirect(cmdBuf, cull->commandBuffer,
+                                     commandOffset + i * stride, 1, stride);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "main.h"
+#include "scene.h"
+
+struct cull_s;
+
+/*
+ * GPU driven draw submission.
+ *
+ * A compute pass frustum culls the bounding sphere of every draw against
+ * the frame's model, view and projection and writes the surviving draws
+ * as compacted VkDrawIndexedIndirectCommand records plus a draw count,
+ * consumed by a single indirect draw in the render pass. The CPU records
+ * the same handful of commands per frame whatever the number of draws.
+ *
+ * Without VK_AMD_draw_indirect_count the records are not compacted,
+ * culled draws get zero instances and all of them are drawn.
+ *
+ * Set up is split so that it fits the parallel init_vulkan():
+ *
+ *   cull_init()                   after the device, before the jobs start
+ *   cull_create_pipeline()        pipeline job
+ *   cull_create_buffers()         upload job, before upload_flush()
+ *   cull_create_descriptor_set()  when the uniform buffer and jobs are done
+ */
+
+void
+cull_init(handles_t *handles);
+
+void
+cull_cleanup(handles_t *handles);
+
+void
+cull_create_pipeline(handles_t *handles, const std::vector<char>& shaderCode);
+
+/* bounds of the scene's draws, uploaded through the staging ring */
+void
+cull_create_buffers(handles_t *handles, const scene_t *scene);
+
+void
+cull_create_descriptor_set(handles_t *handles);
+
+/* record the culling dispatch, outside of the render pass */
+void
+cull_record(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame);
+
+/*
+ * draw the frame's surviving draws, with the graphics pipeline and the
+ * vertex and index buffers bound
+ */
+void
+cull_draw(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame);
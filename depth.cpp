@@ -0,0 +1,135 @@
+#include <stdio.h>
+
+#include <stdexcept>
+
+#include "depth.h"
+#include "utils.h"
+
+/* in order of preference, D16_UNORM support is required by the spec */
+static const VkFormat depth_formats[] =
+{
+    VK_FORMAT_D32_SFLOAT,
+    VK_FORMAT_D24_UNORM_S8_UINT,
+    VK_FORMAT_D16_UNORM,
+};
+
+const char *
+depth_format_name(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_D32_SFLOAT:
+            return "D32_SFLOAT";
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+            return "D24_UNORM_S8_UINT";
+        case VK_FORMAT_D16_UNORM:
+            return "D16_UNORM";
+        default:
+            return "unknown";
+    }
+}
+
+void
+select_depth_format(handles_t *handles)
+{
+    for (size_t i = 0; i < sizeof(depth_formats) / sizeof(depth_formats[0]); i++)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(handles->phyDevice, depth_formats[i], &props);
+
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+        {
+            handles->depthFormat = depth_formats[i];
+            return;
+        }
+    }
+
+    throw std::runtime_error("no supported depth format!");
+}
+
+static depth_buffer_t
+create_depth_buffer(handles_t *handles)
+{
+    depth_buffer_t depth;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = handles->depthFormat;
+    imageInfo.extent.width = handles->swapchainExtend.width;
+    imageInfo.extent.height = handles->swapchainExtend.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    /* never loaded or stored, the contents only exist during the render pass */
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    check_res(
+        vkCreateImage(handles->device, &imageInfo, NULL, &(depth.image)),
+        "vkCreateImage depth");
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(handles->device, depth.image, &memRequirements);
+
+    depth.alloc = gpu_alloc(handles, memRequirements,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, false);
+
+    check_res(
+        vkBindImageMemory(handles->device, depth.image,
+                          depth.alloc.memory, depth.alloc.offset),
+        "vkBindImageMemory depth");
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = depth.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = handles->depthFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    check_res(
+        vkCreateImageView(handles->device, &viewInfo, NULL, &(depth.view)),
+        "vkCreateImageView depth");
+
+    return depth;
+}
+
+void
+create_depth_buffers(handles_t *handles)
+{
+    size_t count = handles->swapChainImageViews.size();
+
+    handles->depthBuffers.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        handles->depthBuffers.push_back(create_depth_buffer(handles));
+    }
+
+    bool lazy = count > 0 &&
+        (gpu_alloc_memory_flags(handles, &(handles->depthBuffers[0].alloc)) &
+         VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+    printf("  %zu %s depth buffers in %s memory\n", count,
+           depth_format_name(handles->depthFormat),
+           lazy ? "lazily allocated" : "device local");
+}
+
+void
+destroy_depth_buffers(handles_t *handles, std::vector<depth_buffer_t> *buffers)
+{
+    for (auto depth = buffers->begin(); depth != buffers->end(); ++depth)
+    {
+        vkDestroyImageView(handles->device, depth->view, NULL);
+        vkDestroyImage(handles->device, depth->image, NULL);
+        gpu_free(handles, &(depth->alloc));
+    }
+    buffers->clear();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Depth attachments, one per framebuffer, so frames in flight never
+ * share one.
+ *
+ * The depth values are cleared when the render pass begins and dropped
+ * when it ends, so the images are transient attachments in lazily
+ * allocated memory where the device has it. On tiled GPUs they then
+ * only ever live in tile memory, elsewhere they fall back to plain
+ * device local memory.
+ */
+
+/* D32_SFLOAT, else D24_UNORM_S8_UINT, else D16_UNORM, into handles->depthFormat */
+void
+select_depth_format(handles_t *handles);
+
+/* one per image in swapChainImageViews, at swapchainExtend */
+void
+create_depth_buffers(handles_t *handles);
+
+/* also for depth buffers taken over by a retired swapchain */
+void
+destroy_depth_buffers(handles_t *handles, std::vector<depth_buffer_t> *buffers);
+
+const char *
+depth_format_name(VkFormat format);
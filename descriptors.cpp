@@ -0,0 +1,272 @@
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "descriptors.h"
+#include "utils.h"
+
+/* descriptors of each type a pool holds per set */
+static const VkDescriptorPoolSize pool_sizes[] =
+{
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1 * DESCRIPTOR_POOL_SETS},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 * DESCRIPTOR_POOL_SETS},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         1 * DESCRIPTOR_POOL_SETS},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2 * DESCRIPTOR_POOL_SETS},
+};
+
+/* pools allocated from in order, the ones before current are full */
+typedef struct pool_list_s
+{
+    std::vector<VkDescriptorPool> pools;
+    size_t current;
+    /* sets not yet allocated from pools[current] */
+    uint32_t setsLeft;
+} pool_list_t;
+
+typedef struct pending_write_s
+{
+    VkDescriptorSet set;
+    descriptor_buffer_t buffer;
+} pending_write_t;
+
+struct descriptors_s
+{
+    pool_list_t cached;
+    /* layout and buffers -> set */
+    std::unordered_map<std::string, VkDescriptorSet> cache;
+
+    /* one list per frame in flight */
+    std::vector<pool_list_t> frames;
+
+    std::vector<pending_write_t> pending;
+
+    /* scratch, kept to not reallocate on every call */
+    std::vector<VkDescriptorSetLayout> layouts;
+    std::vector<VkDescriptorBufferInfo> infos;
+    std::vector<VkWriteDescriptorSet> writes;
+};
+
+static VkDescriptorPool
+create_pool(handles_t *handles)
+{
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = sizeof(pool_sizes) / sizeof(pool_sizes[0]);
+    poolInfo.pPoolSizes = pool_sizes;
+    poolInfo.maxSets = DESCRIPTOR_POOL_SETS;
+
+    VkDescriptorPool pool;
+    check_res(
+        vkCreateDescriptorPool(handles->device, &poolInfo, NULL, &pool),
+        "vkCreateDescriptorPool");
+
+    return pool;
+}
+
+static void
+allocate(handles_t *handles, pool_list_t *list, VkDescriptorSetLayout layout,
+         uint32_t count, VkDescriptorSet *sets)
+{
+    descriptors_s *state = handles->descriptors;
+
+    while (count > 0)
+    {
+        bool fresh = false;
+        if (list->current == list->pools.size())
+        {
+            list->pools.push_back(create_pool(handles));
+            list->setsLeft = DESCRIPTOR_POOL_SETS;
+            fresh = true;
+        }
+
+        uint32_t n = std::min(count, list->setsLeft);
+        if (n == 0)
+        {
+            list->current++;
+            list->setsLeft = DESCRIPTOR_POOL_SETS;
+            continue;
+        }
+
+        state->layouts.assign(n, layout);
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = list->pools[list->current];
+        allocInfo.descriptorSetCount = n;
+        allocInfo.pSetLayouts = state->layouts.data();
+
+        VkResult res = vkAllocateDescriptorSets(handles->device, &allocInfo, sets);
+        if (!fresh && (res == VK_ERROR_OUT_OF_POOL_MEMORY_KHR || res == VK_ERROR_FRAGMENTED_POOL))
+        {
+            /* out of some descriptor type before running out of sets, try the next pool */
+            list->current++;
+            list->setsLeft = DESCRIPTOR_POOL_SETS;
+            continue;
+        }
+        check_res(res, "vkAllocateDescriptorSets");
+
+        list->setsLeft -= n;
+        sets += n;
+        count -= n;
+    }
+}
+
+static void
+destroy_pools(handles_t *handles, pool_list_t *list)
+{
+    for (auto pool = list->pools.begin(); pool != list->pools.end(); ++pool)
+    {
+        vkDestroyDescriptorPool(handles->device, *pool, NULL);
+    }
+    list->pools.clear();
+}
+
+static void
+append_bytes(std::string *key, const void *data, size_t size)
+{
+    key->append((const char *)data, size);
+}
+
+void
+descriptors_init(handles_t *handles)
+{
+    descriptors_s *state = new descriptors_s();
+
+    state->cached.current = 0;
+    state->cached.setsLeft = 0;
+    state->frames.resize(handles->framesInFlight);
+    for (auto frame = state->frames.begin(); frame != state->frames.end(); ++frame)
+    {
+        frame->current = 0;
+        frame->setsLeft = 0;
+    }
+
+    handles->descriptors = state;
+}
+
+void
+descriptors_cleanup(handles_t *handles)
+{
+    descriptors_s *state = handles->descriptors;
+
+    if (state == NULL)
+    {
+        return;
+    }
+
+    destroy_pools(handles, &(state->cached));
+    for (auto frame = state->frames.begin(); frame != state->frames.end(); ++frame)
+    {
+        destroy_pools(handles, &(*frame));
+    }
+
+    delete state;
+    handles->descriptors = NULL;
+}
+
+VkDescriptorSet
+descriptor_set_cached(handles_t *handles, VkDescriptorSetLayout layout,
+                      const descriptor_buffer_t *buffers, uint32_t count)
+{
+    descriptors_s *state = handles->descriptors;
+
+    /* field by field, padding would make equal bindings differ */
+    std::string key;
+    append_bytes(&key, &layout, sizeof(layout));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        append_bytes(&key, &(buffers[i].binding), sizeof(buffers[i].binding));
+        append_bytes(&key, &(buffers[i].type), sizeof(buffers[i].type));
+        append_bytes(&key, &(buffers[i].buffer), sizeof(buffers[i].buffer));
+        append_bytes(&key, &(buffers[i].offset), sizeof(buffers[i].offset));
+        append_bytes(&key, &(buffers[i].range), sizeof(buffers[i].range));
+    }
+
+    auto hit = state->cache.find(key);
+    if (hit != state->cache.end())
+    {
+        return hit->second;
+    }
+
+    VkDescriptorSet set;
+    allocate(handles, &(state->cached), layout, 1, &set);
+    descriptor_write(handles, set, buffers, count);
+    state->cache[key] = set;
+
+    return set;
+}
+
+void
+descriptor_sets_frame(handles_t *handles, uint32_t frame, VkDescriptorSetLayout layout,
+                      uint32_t count, VkDescriptorSet *sets)
+{
+    allocate(handles, &(handles->descriptors->frames[frame]), layout, count, sets);
+}
+
+void
+descriptor_write(handles_t *handles, VkDescriptorSet set,
+                 const descriptor_buffer_t *buffers, uint32_t count)
+{
+    descriptors_s *state = handles->descriptors;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        pending_write_t write = {set, buffers[i]};
+        state->pending.push_back(write);
+    }
+}
+
+void
+descriptors_flush(handles_t *handles)
+{
+    descriptors_s *state = handles->descriptors;
+    size_t count = state->pending.size();
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    /* sized up front, the writes point into infos */
+    state->infos.resize(count);
+    state->writes.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const pending_write_t *p = &(state->pending[i]);
+
+        state->infos[i].buffer = p->buffer.buffer;
+        state->infos[i].offset = p->buffer.offset;
+        state->infos[i].range = p->buffer.range;
+
+        VkWriteDescriptorSet *write = &(state->writes[i]);
+        memset(write, 0, sizeof(*write));
+        write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write->dstSet = p->set;
+        write->dstBinding = p->buffer.binding;
+        write->dstArrayElement = 0;
+        write->descriptorType = p->buffer.type;
+        write->descriptorCount = 1;
+        write->pBufferInfo = &(state->infos[i]);
+    }
+
+    vkUpdateDescriptorSets(handles->device, (uint32_t)count, state->writes.data(), 0, NULL);
+    state->pending.clear();
+}
+
+void
+descriptors_frame(handles_t *handles, uint32_t frame)
+{
+    pool_list_t *list = &(handles->descriptors->frames[frame]);
+
+    /* the GPU is done with the frame's sets, drop them all at once */
+    for (size_t i = 0; i < list->pools.size() && i <= list->current; i++)
+    {
+        check_res(
+            vkResetDescriptorPool(handles->device, list->pools[i], 0),
+            "vkResetDescriptorPool");
+    }
+    list->current = 0;
+    list->setsLeft = list->pools.empty() ? 0 : DESCRIPTOR_POOL_SETS;
+}
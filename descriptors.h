@@ -0,0 +1,70 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Descriptor set allocation out of pools sized for many sets at once.
+ *
+ * Sets that never change are allocated from a growing list of pools and
+ * cached by layout and bound buffers, asking for the same set twice gives
+ * the same handle. Per frame sets come from pools owned by a frame in
+ * flight, which are reset with vkResetDescriptorPool() once the frame's
+ * fence has signaled, instead of freeing sets one by one. Pools are
+ * created without VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, so
+ * drivers can allocate sets linearly, and are only ever added, never
+ * destroyed before descriptors_cleanup().
+ *
+ * Writes are queued and go to the driver in a single
+ * vkUpdateDescriptorSets() call on descriptors_flush().
+ *
+ * Not thread safe, use from the thread recording frames.
+ */
+
+/* sets per pool */
+#define DESCRIPTOR_POOL_SETS 1024
+
+/* a buffer bound to one binding of a set */
+typedef struct descriptor_buffer_s
+{
+    uint32_t binding;
+    VkDescriptorType type;
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize range;
+} descriptor_buffer_t;
+
+/* needs handles->framesInFlight */
+void
+descriptors_init(handles_t *handles);
+
+void
+descriptors_cleanup(handles_t *handles);
+
+/*
+ * set of layout with buffers bound, allocated and written on the first
+ * call, the buffers must stay alive until descriptors_cleanup()
+ */
+VkDescriptorSet
+descriptor_set_cached(handles_t *handles, VkDescriptorSetLayout layout,
+                      const descriptor_buffer_t *buffers, uint32_t count);
+
+/*
+ * allocate count sets of layout, usable until frame's slot is reused,
+ * in as few vkAllocateDescriptorSets() calls as the pools allow
+ */
+void
+descriptor_sets_frame(handles_t *handles, uint32_t frame, VkDescriptorSetLayout layout,
+                      uint32_t count, VkDescriptorSet *sets);
+
+/* queue binding buffers to set */
+void
+descriptor_write(handles_t *handles, VkDescriptorSet set,
+                 const descriptor_buffer_t *buffers, uint32_t count);
+
+/* apply all queued writes, before recording commands that use the sets */
+void
+descriptors_flush(handles_t *handles);
+
+/* call once per frame after its fence wait, releases frame's sets */
+void
+descriptors_frame(handles_t *handles, uint32_t frame);
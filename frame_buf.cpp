@@ -12,13 +12,14 @@ create_framebuffers(handles_t *handles)
     for (size_t i = 0; i < image_num; i++)
     {
         VkImageView attachments[] = {
-            handles->swapChainImageViews[i]
+            handles->swapChainImageViews[i],
+            handles->depthBuffers[i].view
         };
 
         VkFramebufferCreateInfo framebufferInfo = {};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = handles->renderPass;
-        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.attachmentCount = 2;
         framebufferInfo.pAttachments = attachments;
         framebufferInfo.width = handles->swapchainExtend.width;
         framebufferInfo.height = handles->swapchainExtend.height;
@@ -1,6 +1,7 @@
 #pragma once
 #include "main.h"
 
+/* needs the depth buffers */
 void
 create_framebuffers(handles_t *handles);
 
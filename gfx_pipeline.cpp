@@ -1,8 +1,8 @@
 #include "gfx_pipeline.h"
-#include "shaders.h"
+#include "descriptors.h"
 #include "utils.h"
 
-static void
+void
 create_render_pass(handles_t *handles)
 {
     VkAttachmentDescription colorAttachment = {};
@@ -13,33 +13,74 @@ create_render_pass(handles_t *handles)
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    /* offscreen images are copied out rather than presented */
+    colorAttachment.finalLayout = handles->headless ?
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    /* cleared and dropped, so tilers never write it to memory */
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = handles->depthFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
 
     VkAttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
     VkSubpassDescription subpass = {};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    VkSubpassDependency dependency = {};
+    VkSubpassDependency dependencies[2] = {};
+    VkSubpassDependency& dependency = dependencies[0];
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    /* the depth clear also waits for the last frame that tested against the image */
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    if (handles->headless)
+    {
+        /* don't overwrite the image while the previous readback still copies it */
+        dependency.srcStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+        /* make rendered pixels visible to the readback copy */
+        VkSubpassDependency& out = dependencies[1];
+        out.srcSubpass = 0;
+        out.dstSubpass = VK_SUBPASS_EXTERNAL;
+        out.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        out.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        out.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        out.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    }
 
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = handles->headless ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies;
 
     check_res(
         vkCreateRenderPass(
@@ -48,37 +89,101 @@ create_render_pass(handles_t *handles)
 }
 
 void
-create_gfk_pipeline(handles_t *handles)
+create_pipeline_layout(handles_t *handles)
 {
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &(handles->descriptorSetLayout);
+
+    /* the draw's transform, see DrawPushConstants */
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(DrawPushConstants);
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+    check_res(
+        vkCreatePipelineLayout(
+            handles->device, &pipelineLayoutInfo,
+            NULL, &(handles->pipelineLayout)),
+        "error vkCreatePipelineLayout");
+}
+
+VkPipeline
+create_gfk_pipeline(handles_t *handles,
+                    const pipeline_key_t *key,
+                    VkShaderModule vertShaderModule,
+                    VkShaderModule fragShaderModule)
+{
+    bool instanced = key->instanced;
+
+    /* constant_id i is spec[i], the same for both stages */
+    VkSpecializationMapEntry specEntries[PIPELINE_MAX_SPEC_CONSTANTS];
+    for (uint32_t i = 0; i < key->specCount; i++)
+    {
+        specEntries[i].constantID = i;
+        specEntries[i].offset = i * sizeof(key->spec[0]);
+        specEntries[i].size = sizeof(key->spec[0]);
+    }
+
+    VkSpecializationInfo specInfo = {};
+    specInfo.mapEntryCount = key->specCount;
+    specInfo.pMapEntries = specEntries;
+    specInfo.dataSize = key->specCount * sizeof(key->spec[0]);
+    specInfo.pData = key->spec;
+
     /*
      * set-up shaders
      */
-    auto vertShaderModule = load_shader(handles, "vert.spv");
-
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
     vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
     vertShaderStageInfo.module = vertShaderModule;
     vertShaderStageInfo.pName = "main";
-
-    auto fragShaderModule = load_shader(handles, "frag.spv");
+    vertShaderStageInfo.pSpecializationInfo = key->specCount > 0 ? &specInfo : NULL;
 
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     fragShaderStageInfo.module = fragShaderModule;
     fragShaderStageInfo.pName = "main";
+    fragShaderStageInfo.pSpecializationInfo = vertShaderStageInfo.pSpecializationInfo;
 
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
-
-    /* vertex input */
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    /* depth only variants have no fragment shader */
+    uint32_t stageCount = fragShaderModule != VK_NULL_HANDLE ? 2 : 1;
+
+    /* vertex input, plus per instance data in binding 1 if instanced */
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+
+    if (key->vertexFormat == VERTEX_FORMAT_PACKED && !instanced)
+    {
+        bindingDescriptions.push_back(VertexPacked::getBindingDescription());
+        auto vertexAttributes = VertexPacked::getAttributeDescriptions();
+        attributeDescriptions.assign(vertexAttributes.begin(), vertexAttributes.end());
+    }
+    else
+    {
+        bindingDescriptions.push_back(Vertex::getBindingDescription());
+        auto vertexAttributes = Vertex::getAttributeDescriptions();
+        attributeDescriptions.assign(vertexAttributes.begin(), vertexAttributes.end());
+    }
+
+    if (instanced)
+    {
+        bindingDescriptions.push_back(Instance::getBindingDescription());
+        auto instanceAttributes = Instance::getAttributeDescriptions();
+        attributeDescriptions.insert(attributeDescriptions.end(),
+                                     instanceAttributes.begin(), instanceAttributes.end());
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
     vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -88,34 +193,30 @@ create_gfk_pipeline(handles_t *handles)
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    /* view port */
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float) handles->swapchainExtend.width;
-    viewport.height = (float) handles->swapchainExtend.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = handles->swapchainExtend;
-
+    /*
+     * view port, set when recording so that the pipeline doesn't
+     * depend on the swapchain size
+     */
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
 
     /* rasterizer */
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
     rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
     rasterizer.depthClampEnable = VK_FALSE;
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.polygonMode = key->polygonMode;
     rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.cullMode = key->cullMode;
     rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
     rasterizer.depthBiasEnable = VK_FALSE;
 
@@ -125,10 +226,29 @@ create_gfk_pipeline(handles_t *handles)
     multisampling.sampleShadingEnable = VK_FALSE;
     multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
+    /*
+     * depth test, the fragment shader neither writes depth nor discards,
+     * so the test runs before it
+     */
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = key->depthTest ? VK_TRUE : VK_FALSE;
+    depthStencil.depthWriteEnable = key->depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = key->depthCompare;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
     /* color blending */
     VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
+    colorBlendAttachment.colorWriteMask = key->colorWrite ?
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT : 0;
+    colorBlendAttachment.blendEnable = key->blend ? VK_TRUE : VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
     VkPipelineColorBlendStateCreateInfo colorBlending = {};
     colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -141,49 +261,34 @@ create_gfk_pipeline(handles_t *handles)
     colorBlending.blendConstants[2] = 0.0f;
     colorBlending.blendConstants[3] = 0.0f;
 
-    /* pipeline layout */
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &(handles->descriptorSetLayout);
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-
-    check_res(
-        vkCreatePipelineLayout(
-            handles->device, &pipelineLayoutInfo,
-            NULL, &(handles->pipelineLayout)),
-        "error vkCreatePipelineLayout");
-
-    /* set-up render pass */
-    create_render_pass(handles);
-
     /*
      * set-up Graphics Pipeline
      */
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
+    pipelineInfo.stageCount = stageCount;
     pipelineInfo.pStages = shaderStages;
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = handles->pipelineLayout;
     pipelineInfo.renderPass = handles->renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
+    VkPipeline pipeline;
     check_res(
         vkCreateGraphicsPipelines(
-            handles->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL,
-            &(handles->gfxPipeline)),
+            handles->device, handles->pipelineCache, 1, &pipelineInfo, NULL,
+            &pipeline),
         "error vkCreateGraphicsPipelines");
 
-    /* clean-up */
-    vkDestroyShaderModule(handles->device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(handles->device, vertShaderModule, nullptr);
+    return pipeline;
 }
 
 void
@@ -192,7 +297,7 @@ create_descriptor_set_layout(handles_t *handles)
     VkDescriptorSetLayoutBinding uboLayoutBinding = {};
     uboLayoutBinding.binding = 0;
     uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.pImmutableSamplers = NULL;
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
@@ -208,52 +313,17 @@ create_descriptor_set_layout(handles_t *handles)
         "vkCreateDescriptorSetLayout");
 }
 
-void
-create_descriptor_pool(handles_t *handles)
-{
-    VkDescriptorPoolSize poolSize = {};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize.descriptorCount = 1;
-
-    VkDescriptorPoolCreateInfo poolInfo = {};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = 1;
-
-    check_res(
-        vkCreateDescriptorPool(handles->device, &poolInfo, NULL, &(handles->descriptorPool)),
-        "vkCreateDescriptorPool");
-}
-
 void
 create_descriptor_set(handles_t *handles)
 {
-    VkDescriptorSetLayout layouts[] = {handles->descriptorSetLayout};
-    VkDescriptorSetAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = handles->descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = layouts;
-
-    check_res(
-        vkAllocateDescriptorSets(
-            handles->device, &allocInfo, &(handles->descriptorSet)),
-        "vkAllocateDescriptorSets");
-
-    VkDescriptorBufferInfo bufferInfo = {};
-    bufferInfo.buffer = handles->uniformBuffer;
-    bufferInfo.offset = 0;
-    bufferInfo.range = sizeof(UniformBufferObject);
-
-    VkWriteDescriptorSet descriptorWrite = {};
-    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrite.dstSet = handles->descriptorSet;
-    descriptorWrite.dstBinding = 0;
-    descriptorWrite.dstArrayElement = 0;
-    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrite.descriptorCount = 1;
-    descriptorWrite.pBufferInfo = &bufferInfo;
-
-    vkUpdateDescriptorSets(handles->device, 1, &descriptorWrite, 0, nullptr);
+    /* the frame's slot in the ring is selected with a dynamic offset */
+    descriptor_buffer_t ubo = {};
+    ubo.binding = 0;
+    ubo.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    ubo.buffer = handles->uniformBuffer;
+    ubo.offset = 0;
+    ubo.range = sizeof(UniformBufferObject);
+
+    handles->descriptorSet = descriptor_set_cached(handles, handles->descriptorSetLayout,
+                                                   &ubo, 1);
 }
\ No newline at end of file
@@ -3,13 +3,26 @@
 #include "main.h"
 
 void
-create_gfk_pipeline(handles_t *handles);
+create_render_pass(handles_t *handles);
 
+/* needs the descriptor set layout */
 void
-create_descriptor_set_layout(handles_t *handles);
+create_pipeline_layout(handles_t *handles);
+
+/*
+ * pipeline of the variant key with the modules of its shaders, needs the
+ * render pass and pipeline layout, safe to call from any thread, see
+ * pipelines.h for creating variants on the thread pool
+ */
+VkPipeline
+create_gfk_pipeline(handles_t *handles,
+                    const pipeline_key_t *key,
+                    VkShaderModule vertShaderModule,
+                    VkShaderModule fragShaderModule);
 
 void
-create_descriptor_pool(handles_t *handles);
+create_descriptor_set_layout(handles_t *handles);
 
+/* needs the uniform buffer, written on the next descriptors_flush() */
 void
 create_descriptor_set(handles_t *handles);
\ No newline at end of file
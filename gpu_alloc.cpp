@@ -0,0 +1,574 @@
+#include <stdio.h>
+#include <stdexcept>
+#include <iterator>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <algorithm>
+
+#include "gpu_alloc.h"
+#include "main.h"
+#include "utils.h"
+
+/* size of the device memory blocks that are sub-allocated */
+#define BLOCK_SIZE (64ull * 1024 * 1024)
+
+/* heaps smaller than this get proportionally smaller blocks */
+#define SMALL_HEAP_SIZE (1024ull * 1024 * 1024)
+
+typedef struct used_range_s
+{
+    VkDeviceSize size;
+    bool linear;
+} used_range_t;
+
+typedef struct mem_block_s
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    uint32_t memoryType;
+    /* single allocation that did not fit in a regular block */
+    bool dedicated;
+    void *mapped;
+    /* offset -> size, neighbouring free ranges are always merged */
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+    /* offset -> allocation */
+    std::map<VkDeviceSize, used_range_t> usedRanges;
+} mem_block_t;
+
+struct gpu_allocator_s
+{
+    std::mutex lock;
+    VkPhysicalDeviceMemoryProperties memProps;
+    VkDeviceSize granularity;
+    VkDeviceSize atomSize;
+    uint32_t maxAllocations;
+
+    /* NULL entries are released blocks, slots are reused */
+    std::vector<mem_block_t *> blocks;
+
+    uint32_t deviceAllocations;
+    VkDeviceSize reserved;
+    VkDeviceSize peakReserved;
+    VkDeviceSize used;
+};
+
+static VkDeviceSize
+align_up(VkDeviceSize value, VkDeviceSize align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+/*
+ * check if a resource ending at end (exclusive) shares a
+ * bufferImageGranularity page with a resource starting at start
+ */
+static bool
+on_same_page(VkDeviceSize end, VkDeviceSize start, VkDeviceSize granularity)
+{
+    return ((end - 1) & ~(granularity - 1)) == (start & ~(granularity - 1));
+}
+
+static int
+find_memory_type(gpu_allocator_s *alloc, uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+    for (uint32_t i = 0; i < alloc->memProps.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1 << i)) &&
+            (alloc->memProps.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static bool
+is_host_visible(gpu_allocator_s *alloc, uint32_t memoryType)
+{
+    return alloc->memProps.memoryTypes[memoryType].propertyFlags &
+           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+static bool
+is_non_coherent(gpu_allocator_s *alloc, uint32_t memoryType)
+{
+    VkMemoryPropertyFlags flags = alloc->memProps.memoryTypes[memoryType].propertyFlags;
+
+    return (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+           !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+static VkDeviceSize
+block_size_for_type(gpu_allocator_s *alloc, uint32_t memoryType)
+{
+    uint32_t heap = alloc->memProps.memoryTypes[memoryType].heapIndex;
+    VkDeviceSize heapSize = alloc->memProps.memoryHeaps[heap].size;
+
+    if (heapSize <= SMALL_HEAP_SIZE)
+    {
+        return align_up(heapSize / 8, 1024);
+    }
+
+    return BLOCK_SIZE;
+}
+
+/*
+ * Best fit search of the block's free ranges. Returns false if the
+ * allocation does not fit, otherwise sets offset and the range to carve it from.
+ */
+static bool
+find_fit(gpu_allocator_s *alloc, mem_block_t *block,
+         VkDeviceSize size, VkDeviceSize align, bool linear,
+         VkDeviceSize *offset, VkDeviceSize *rangeStart)
+{
+    VkDeviceSize bestSize = VK_WHOLE_SIZE;
+    VkDeviceSize granularity = alloc->granularity;
+
+    for (auto range = block->freeRanges.begin(); range != block->freeRanges.end(); ++range)
+    {
+        VkDeviceSize start = range->first;
+        VkDeviceSize end = range->first + range->second;
+
+        if (range->second < size || range->second >= bestSize)
+        {
+            continue;
+        }
+
+        VkDeviceSize off = align_up(start, align);
+
+        if (granularity > 1)
+        {
+            /*
+             * linear and optimal resources may not share a granularity page,
+             * free ranges are maximal so the neighbours are adjacent
+             */
+            auto next = block->usedRanges.lower_bound(start);
+            if (next != block->usedRanges.begin())
+            {
+                auto prev = std::prev(next);
+                if (prev->second.linear != linear &&
+                    on_same_page(prev->first + prev->second.size, off, granularity))
+                {
+                    off = align_up(off, granularity);
+                }
+            }
+
+            if (off + size > end)
+            {
+                continue;
+            }
+
+            if (next != block->usedRanges.end() &&
+                next->second.linear != linear &&
+                on_same_page(off + size, next->first, granularity))
+            {
+                continue;
+            }
+        }
+
+        if (off + size > end)
+        {
+            continue;
+        }
+
+        bestSize = range->second;
+        *offset = off;
+        *rangeStart = start;
+    }
+
+    return bestSize != VK_WHOLE_SIZE;
+}
+
+static void
+carve(mem_block_t *block, VkDeviceSize rangeStart,
+      VkDeviceSize offset, VkDeviceSize size, bool linear)
+{
+    auto range = block->freeRanges.find(rangeStart);
+    VkDeviceSize rangeEnd = range->first + range->second;
+
+    block->freeRanges.erase(range);
+
+    if (offset > rangeStart)
+    {
+        block->freeRanges[rangeStart] = offset - rangeStart;
+    }
+
+    if (offset + size < rangeEnd)
+    {
+        block->freeRanges[offset + size] = rangeEnd - (offset + size);
+    }
+
+    used_range_t used = { size, linear };
+    block->usedRanges[offset] = used;
+    block->used += size;
+}
+
+static void
+release(mem_block_t *block, VkDeviceSize offset)
+{
+    auto used = block->usedRanges.find(offset);
+    if (used == block->usedRanges.end())
+    {
+        bail_out("gpu_free of unknown allocation");
+    }
+
+    VkDeviceSize start = offset;
+    VkDeviceSize end = offset + used->second.size;
+
+    block->used -= used->second.size;
+    block->usedRanges.erase(used);
+
+    /* merge with free neighbours */
+    auto next = block->freeRanges.lower_bound(start);
+    if (next != block->freeRanges.end() && next->first == end)
+    {
+        end += next->second;
+        next = block->freeRanges.erase(next);
+    }
+
+    if (next != block->freeRanges.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == start)
+        {
+            start = prev->first;
+            block->freeRanges.erase(prev);
+        }
+    }
+
+    block->freeRanges[start] = end - start;
+}
+
+static uint32_t
+new_block(handles_t *handles, uint32_t memoryType, VkDeviceSize size, bool dedicated)
+{
+    gpu_allocator_s *alloc = handles->allocator;
+
+    if (alloc->deviceAllocations >= alloc->maxAllocations)
+    {
+        bail_out("maxMemoryAllocationCount reached");
+    }
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    mem_block_t *block = new mem_block_t();
+    block->size = size;
+    block->used = 0;
+    block->memoryType = memoryType;
+    block->dedicated = dedicated;
+    block->mapped = NULL;
+    block->freeRanges[0] = size;
+
+    check_res(
+        vkAllocateMemory(handles->device, &allocInfo, NULL, &(block->memory)),
+        "vkAllocateMemory");
+
+    /* host visible blocks are mapped once for their whole lifetime */
+    if (is_host_visible(alloc, memoryType))
+    {
+        check_res(
+            vkMapMemory(handles->device, block->memory, 0, VK_WHOLE_SIZE, 0, &(block->mapped)),
+            "vkMapMemory block");
+    }
+
+    alloc->deviceAllocations += 1;
+    alloc->reserved += size;
+    if (alloc->reserved > alloc->peakReserved)
+    {
+        alloc->peakReserved = alloc->reserved;
+    }
+
+    for (uint32_t i = 0; i < alloc->blocks.size(); i++)
+    {
+        if (alloc->blocks[i] == NULL)
+        {
+            alloc->blocks[i] = block;
+            return i;
+        }
+    }
+
+    alloc->blocks.push_back(block);
+    return (uint32_t)alloc->blocks.size() - 1;
+}
+
+static void
+free_block(handles_t *handles, uint32_t idx)
+{
+    gpu_allocator_s *alloc = handles->allocator;
+    mem_block_t *block = alloc->blocks[idx];
+
+    if (block->mapped)
+    {
+        vkUnmapMemory(handles->device, block->memory);
+    }
+    vkFreeMemory(handles->device, block->memory, NULL);
+
+    alloc->deviceAllocations -= 1;
+    alloc->reserved -= block->size;
+
+    delete block;
+    alloc->blocks[idx] = NULL;
+}
+
+void
+gpu_alloc_init(handles_t *handles)
+{
+    gpu_allocator_s *alloc = new gpu_allocator_s();
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(handles->phyDevice, &props);
+    vkGetPhysicalDeviceMemoryProperties(handles->phyDevice, &(alloc->memProps));
+
+    alloc->granularity = props.limits.bufferImageGranularity;
+    alloc->atomSize = props.limits.nonCoherentAtomSize;
+    alloc->maxAllocations = props.limits.maxMemoryAllocationCount;
+    alloc->deviceAllocations = 0;
+    alloc->reserved = 0;
+    alloc->peakReserved = 0;
+    alloc->used = 0;
+
+    handles->allocator = alloc;
+}
+
+void
+gpu_alloc_cleanup(handles_t *handles)
+{
+    gpu_allocator_s *alloc = handles->allocator;
+
+    for (uint32_t i = 0; i < alloc->blocks.size(); i++)
+    {
+        if (alloc->blocks[i] == NULL)
+        {
+            continue;
+        }
+
+        if (!alloc->blocks[i]->usedRanges.empty())
+        {
+            printf("gpu memory: %zu allocations leaked in block %u\n",
+                   alloc->blocks[i]->usedRanges.size(), i);
+        }
+        free_block(handles, i);
+    }
+
+    delete alloc;
+    handles->allocator = NULL;
+}
+
+gpu_allocation_t
+gpu_alloc(handles_t *handles,
+          const VkMemoryRequirements& reqs,
+          VkMemoryPropertyFlags required,
+          VkMemoryPropertyFlags preferred,
+          bool linear)
+{
+    gpu_allocator_s *alloc = handles->allocator;
+    std::lock_guard<std::mutex> guard(alloc->lock);
+
+    int memoryType = find_memory_type(alloc, reqs.memoryTypeBits, required | preferred);
+    if (memoryType < 0)
+    {
+        memoryType = find_memory_type(alloc, reqs.memoryTypeBits, required);
+    }
+    if (memoryType < 0)
+    {
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    VkDeviceSize size = reqs.size;
+    VkDeviceSize align = reqs.alignment > 0 ? reqs.alignment : 1;
+
+    /* keep flush/invalidate ranges of different allocations apart */
+    if (is_non_coherent(alloc, memoryType))
+    {
+        align = std::max(align, alloc->atomSize);
+        size = align_up(size, alloc->atomSize);
+    }
+
+    VkDeviceSize offset = 0;
+    VkDeviceSize rangeStart = 0;
+    int blockIdx = -1;
+
+    VkDeviceSize blockSize = block_size_for_type(alloc, memoryType);
+    if (size > blockSize / 2)
+    {
+        blockIdx = new_block(handles, memoryType, size, true);
+        rangeStart = 0;
+        offset = 0;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < alloc->blocks.size(); i++)
+        {
+            mem_block_t *block = alloc->blocks[i];
+            if (block == NULL || block->dedicated ||
+                block->memoryType != (uint32_t)memoryType ||
+                block->size - block->used < size)
+            {
+                continue;
+            }
+
+            if (find_fit(alloc, block, size, align, linear, &offset, &rangeStart))
+            {
+                blockIdx = i;
+                break;
+            }
+        }
+
+        if (blockIdx < 0)
+        {
+            blockIdx = new_block(handles, memoryType, blockSize, false);
+            rangeStart = 0;
+            offset = 0;
+        }
+    }
+
+    mem_block_t *block = alloc->blocks[blockIdx];
+    carve(block, rangeStart, offset, size, linear);
+    alloc->used += size;
+
+    gpu_allocation_t res = {};
+    res.memory = block->memory;
+    res.offset = offset;
+    res.size = size;
+    res.mapped = block->mapped ? (char *)block->mapped + offset : NULL;
+    res.memoryType = memoryType;
+    res.block = blockIdx;
+
+    return res;
+}
+
+void
+gpu_free(handles_t *handles, gpu_allocation_t *res)
+{
+    gpu_allocator_s *alloc = handles->allocator;
+    std::lock_guard<std::mutex> guard(alloc->lock);
+
+    if (res->memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    mem_block_t *block = alloc->blocks[res->block];
+    release(block, res->offset);
+    alloc->used -= res->size;
+
+    if (block->usedRanges.empty())
+    {
+        /* keep one empty regular block per memory type around for reuse */
+        bool spare = false;
+        for (uint32_t i = 0; i < alloc->blocks.size() && !block->dedicated; i++)
+        {
+            mem_block_t *other = alloc->blocks[i];
+            if (other != NULL && other != block && !other->dedicated &&
+                other->memoryType == block->memoryType && other->usedRanges.empty())
+            {
+                spare = true;
+                break;
+            }
+        }
+
+        if (block->dedicated || spare)
+        {
+            free_block(handles, res->block);
+        }
+    }
+
+    res->memory = VK_NULL_HANDLE;
+    res->mapped = NULL;
+}
+
+VkMemoryPropertyFlags
+gpu_alloc_memory_flags(handles_t *handles, const gpu_allocation_t *res)
+{
+    return handles->allocator->memProps.memoryTypes[res->memoryType].propertyFlags;
+}
+
+void
+gpu_alloc_usage(handles_t *handles, VkDeviceSize *used, VkDeviceSize *peakReserved)
+{
+    gpu_allocator_s *alloc = handles->allocator;
+    std::lock_guard<std::mutex> guard(alloc->lock);
+
+    *used = alloc->used;
+    *peakReserved = alloc->peakReserved;
+}
+
+static float
+to_mib(VkDeviceSize bytes)
+{
+    return bytes / (1024.0f * 1024.0f);
+}
+
+void
+gpu_alloc_dump_stats(handles_t *handles)
+{
+    gpu_allocator_s *alloc = handles->allocator;
+    std::lock_guard<std::mutex> guard(alloc->lock);
+
+    printf("gpu memory: %u device allocations (limit %u), "
+           "%.2f MiB reserved, %.2f MiB used, %.2f MiB peak reserved\n",
+           alloc->deviceAllocations, alloc->maxAllocations,
+           to_mib(alloc->reserved), to_mib(alloc->used), to_mib(alloc->peakReserved));
+
+    for (uint32_t type = 0; type < alloc->memProps.memoryTypeCount; type++)
+    {
+        uint32_t blocks = 0;
+        size_t allocations = 0;
+        size_t freeRanges = 0;
+        VkDeviceSize reserved = 0;
+        VkDeviceSize used = 0;
+        VkDeviceSize largestFree = 0;
+
+        for (auto it = alloc->blocks.begin(); it != alloc->blocks.end(); ++it)
+        {
+            mem_block_t *block = *it;
+            if (block == NULL || block->memoryType != type)
+            {
+                continue;
+            }
+
+            blocks += 1;
+            reserved += block->size;
+            used += block->used;
+            allocations += block->usedRanges.size();
+            freeRanges += block->freeRanges.size();
+
+            for (auto range = block->freeRanges.begin(); range != block->freeRanges.end(); ++range)
+            {
+                largestFree = std::max(largestFree, range->second);
+            }
+        }
+
+        if (blocks == 0)
+        {
+            continue;
+        }
+
+        /*
+         * fragmentation is the share of free memory not usable
+         * by a single allocation as large as all free space
+         */
+        VkDeviceSize freeBytes = reserved - used;
+        float fragmentation = freeBytes > 0 ? 1.0f - (float)largestFree / freeBytes : 0.0f;
+
+        VkMemoryPropertyFlags flags = alloc->memProps.memoryTypes[type].propertyFlags;
+        printf("  type %u [%s%s%s%s%s]: %u block%s, %.2f MiB reserved, %.2f MiB used "
+               "in %zu allocations, %zu free ranges, largest free %.2f MiB, "
+               "fragmentation %.1f%%\n",
+               type,
+               flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT ? " device" : "",
+               flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT ? " visible" : "",
+               flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT ? " coherent" : "",
+               flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT ? " cached" : "",
+               flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT ? " lazy" : "",
+               blocks, blocks > 1 ? "s" : "",
+               to_mib(reserved), to_mib(used), allocations, freeRanges,
+               to_mib(largestFree), fragmentation * 100.0f);
+    }
+}
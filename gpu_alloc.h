@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+typedef struct handles_s handles_t;
+struct gpu_allocator_s;
+
+/*
+ * a piece of a larger VkDeviceMemory block handed out by the allocator,
+ * bind resources at (memory, offset)
+ */
+typedef struct gpu_allocation_s
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    /* host pointer to offset, NULL if memory is not host visible */
+    void *mapped;
+    uint32_t memoryType;
+    uint32_t block;
+} gpu_allocation_t;
+
+void
+gpu_alloc_init(handles_t *handles);
+
+void
+gpu_alloc_cleanup(handles_t *handles);
+
+/*
+ * Allocate memory satisfying reqs. Memory with required | preferred
+ * property flags is tried first, then memory with only required flags.
+ * Set linear for buffers and linear images, unset for optimal tiling
+ * images, so that bufferImageGranularity can be respected.
+ */
+gpu_allocation_t
+gpu_alloc(handles_t *handles,
+          const VkMemoryRequirements& reqs,
+          VkMemoryPropertyFlags required,
+          VkMemoryPropertyFlags preferred,
+          bool linear);
+
+void
+gpu_free(handles_t *handles, gpu_allocation_t *alloc);
+
+/* property flags of the memory type backing alloc */
+VkMemoryPropertyFlags
+gpu_alloc_memory_flags(handles_t *handles, const gpu_allocation_t *alloc);
+
+/* bytes currently handed out and high water mark of device memory blocks */
+void
+gpu_alloc_usage(handles_t *handles, VkDeviceSize *used, VkDeviceSize *peakReserved);
+
+void
+gpu_alloc_dump_stats(handles_t *handles);
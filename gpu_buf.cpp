@@ -1,29 +1,14 @@
 #include <string.h>
 
 #include "gpu_buf.h"
+#include "upload.h"
 #include "utils.h"
+#include "vertex_pack.h"
 
 
-static uint32_t
-findMemoryType(handles_t *handles, uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(handles->phyDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-    {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-        {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("failed to find suitable memory type!");
-}
-
-static void
+void
 createBuffer(handles_t *handles, VkDeviceSize size, VkBufferUsageFlags usage,
-             VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+             VkMemoryPropertyFlags properties, VkBuffer& buffer, gpu_allocation_t& bufferAlloc)
 {
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -31,6 +16,16 @@ createBuffer(handles_t *handles, VkDeviceSize size, VkBufferUsageFlags usage,
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    /* buffers filled on a dedicated transfer queue are used on both queues */
+    uint32_t families[] = {handles->gfxFamilyIndex, handles->transferFamilyIndex};
+    if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) &&
+        handles->transferFamilyIndex != handles->gfxFamilyIndex)
+    {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = families;
+    }
+
     check_res(
         vkCreateBuffer(handles->device, &bufferInfo, NULL, &buffer),
         "vkCreateBuffer");
@@ -38,132 +33,106 @@ createBuffer(handles_t *handles, VkDeviceSize size, VkBufferUsageFlags usage,
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(handles->device, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(handles, memRequirements.memoryTypeBits, properties);
+    bufferAlloc = gpu_alloc(handles, memRequirements, properties, 0, true);
 
     check_res(
-        vkAllocateMemory(handles->device, &allocInfo, nullptr, &bufferMemory),
-        "vkAllocateMemory");
-
-    vkBindBufferMemory(handles->device, buffer, bufferMemory, 0);
-}
-
-static void
-copyBuffer(handles_t *handles, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
-{
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = handles->commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    check_res(
-        vkAllocateCommandBuffers(handles->device, &allocInfo, &commandBuffer),
-        "vkAllocateCommandBuffers");
-
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    check_res(
-        vkBeginCommandBuffer(commandBuffer, &beginInfo),
-        "vkBeginCommandBuffer");
-
-        VkBufferCopy copyRegion = {};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    check_res(
-        vkEndCommandBuffer(commandBuffer),
-        "vkEndCommandBuffer");
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-
-    check_res(
-        vkQueueSubmit(handles->gfxQueue, 1, &submitInfo, VK_NULL_HANDLE),
-        "vkQueueSubmit");
-
-    check_res(
-        vkQueueWaitIdle(handles->gfxQueue),
-        "vkQueueWaitIdle");
-
-    vkFreeCommandBuffers(handles->device, handles->commandPool, 1, &commandBuffer);
+        vkBindBufferMemory(handles->device, buffer, bufferAlloc.memory, bufferAlloc.offset),
+        "vkBindBufferMemory");
 }
 
 void
-create_vertex_buffer(handles_t *handles, std::vector<Vertex> vertices)
+create_vertex_buffer(handles_t *handles, const Vertex *vertices, size_t count)
 {
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+    std::vector<VertexPacked> packed;
+    const void *data = vertices;
+    VkDeviceSize bufferSize = sizeof(Vertex) * count;
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(handles,
-                 bufferSize,
-                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(handles->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t) bufferSize);
-    vkUnmapMemory(handles->device, stagingBufferMemory);
+    handles->posScale = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    handles->posOffset = glm::vec4(0.0f);
+    if (handles->vertexFormat == VERTEX_FORMAT_PACKED)
+    {
+        packed.resize(count);
+        vertex_pack(vertices, count, packed.data(), &(handles->posScale), &(handles->posOffset));
+        data = packed.data();
+        bufferSize = sizeof(VertexPacked) * count;
+    }
 
     createBuffer(handles,
                  bufferSize,
                  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                  handles->vertexBuffer,
-                 handles->vertexBufferMemory);
-
-    copyBuffer(handles, stagingBuffer, handles->vertexBuffer, bufferSize);
+                 handles->vertexBufferAlloc);
 
-    vkDestroyBuffer(handles->device, stagingBuffer, nullptr);
-    vkFreeMemory(handles->device, stagingBufferMemory, nullptr);
+    /* copied through the staging ring on the next upload_flush() */
+    upload_buffer(handles, handles->vertexBuffer, 0, data, bufferSize);
 }
 
 void
-create_index_buffer(handles_t *handles, std::vector<uint16_t> indices)
+create_index_buffer(handles_t *handles, const void *indices, size_t count, VkIndexType type)
 {
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(handles,
-                 bufferSize,
-                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(handles->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t) bufferSize);
-    vkUnmapMemory(handles->device, stagingBufferMemory);
+    VkDeviceSize bufferSize = (type == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t)) * count;
+    handles->indexType = type;
 
     createBuffer(handles,
                  bufferSize,
                  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                  handles->indexBuffer,
-                 handles->indexBufferMemory);
-
-    copyBuffer(handles, stagingBuffer, handles->indexBuffer, bufferSize);
+                 handles->indexBufferAlloc);
 
-    vkDestroyBuffer(handles->device, stagingBuffer, nullptr);
-    vkFreeMemory(handles->device, stagingBufferMemory, nullptr);
+    /* copied through the staging ring on the next upload_flush() */
+    upload_buffer(handles, handles->indexBuffer, 0, indices, bufferSize);
 }
 
 void
 create_uniform_buffer(handles_t *handles)
 {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(handles->phyDevice, &props);
+
+    /* each slot must start at a valid dynamic offset */
+    VkDeviceSize align = props.limits.minUniformBufferOffsetAlignment;
+    VkDeviceSize uboSize = sizeof(UniformBufferObject);
+    if (align > 0)
+    {
+        uboSize = (uboSize + align - 1) & ~(align - 1);
+    }
+    handles->uniformBufferStride = uboSize;
+
+    VkDeviceSize bufferSize = uboSize * handles->framesInFlight;
     createBuffer(handles, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  handles->uniformBuffer,
-                 handles->uniformBufferMemory);
-}
\ No newline at end of file
+                 handles->uniformBufferAlloc);
+
+    /* host visible memory stays mapped for the lifetime of the buffer */
+    handles->uniformBufferMapped = handles->uniformBufferAlloc.mapped;
+}
+
+void
+create_instance_buffer(handles_t *handles)
+{
+    /* keep slots 16 byte aligned */
+    VkDeviceSize slotSize = sizeof(Instance) * handles->instanceCount;
+    handles->instanceBufferStride = (slotSize + 15) & ~(VkDeviceSize)15;
+
+    /*
+     * rewritten by the CPU every frame and read once by the GPU, so
+     * this lives in host visible memory rather than going through staging
+     */
+    VkDeviceSize bufferSize = handles->instanceBufferStride * handles->framesInFlight;
+    createBuffer(handles, bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 handles->instanceBuffer,
+                 handles->instanceBufferAlloc);
+
+    handles->instanceBufferMapped = handles->instanceBufferAlloc.mapped;
+}
+
+Instance *
+instance_buffer_slot(handles_t *handles, uint32_t frame)
+{
+    char *slot = (char *)handles->instanceBufferMapped + frame * handles->instanceBufferStride;
+    return (Instance *)slot;
+}
@@ -3,11 +3,32 @@
 #include "main.h"
 
 void
-create_vertex_buffer(handles_t *handles, std::vector<Vertex> vertices);
+createBuffer(handles_t *handles, VkDeviceSize size, VkBufferUsageFlags usage,
+             VkMemoryPropertyFlags properties, VkBuffer& buffer, gpu_allocation_t& bufferAlloc);
 
+/*
+ * vertices may point into a mapped file, they are copied to staging as is,
+ * or packed first if handles->vertexFormat is VERTEX_FORMAT_PACKED, which
+ * also sets handles->posScale and posOffset
+ */
 void
-create_index_buffer(handles_t *handles, std::vector<uint16_t> indices);
+create_vertex_buffer(handles_t *handles, const Vertex *vertices, size_t count);
+
+/* type sets handles->indexType for binding the buffer */
+void
+create_index_buffer(handles_t *handles, const void *indices, size_t count, VkIndexType type);
 
 void
 create_uniform_buffer(handles_t *handles);
 
+/* ring of handles->instanceCount instances per frame in flight */
+void
+create_instance_buffer(handles_t *handles);
+
+/*
+ * the frame's slot in the instance ring, write all instanceCount
+ * instances there after the frame's fence has signaled
+ */
+Instance *
+instance_buffer_slot(handles_t *handles, uint32_t frame);
+
@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdexcept>
+
+#include "json.h"
+
+/* deep enough for any sane document, keeps the recursion bounded */
+#define JSON_MAX_DEPTH 256
+
+typedef struct json_parser_s
+{
+    const char *pos;
+    const char *end;
+} json_parser_t;
+
+static void
+fail(const char *msg)
+{
+    throw std::runtime_error(std::string("json: ") + msg);
+}
+
+static void
+skip_space(json_parser_t *p)
+{
+    while (p->pos < p->end &&
+           (*p->pos == ' ' || *p->pos == '\t' || *p->pos == '\n' || *p->pos == '\r'))
+    {
+        p->pos++;
+    }
+}
+
+static bool
+accept(json_parser_t *p, const char *literal)
+{
+    size_t len = strlen(literal);
+    if ((size_t)(p->end - p->pos) >= len && memcmp(p->pos, literal, len) == 0)
+    {
+        p->pos += len;
+        return true;
+    }
+    return false;
+}
+
+static void
+put_utf8(std::string *out, uint32_t c)
+{
+    if (c < 0x80)
+    {
+        out->push_back((char)c);
+    }
+    else if (c < 0x800)
+    {
+        out->push_back((char)(0xc0 | (c >> 6)));
+        out->push_back((char)(0x80 | (c & 0x3f)));
+    }
+    else if (c < 0x10000)
+    {
+        out->push_back((char)(0xe0 | (c >> 12)));
+        out->push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+        out->push_back((char)(0x80 | (c & 0x3f)));
+    }
+    else
+    {
+        out->push_back((char)(0xf0 | (c >> 18)));
+        out->push_back((char)(0x80 | ((c >> 12) & 0x3f)));
+        out->push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+        out->push_back((char)(0x80 | (c & 0x3f)));
+    }
+}
+
+static uint32_t
+parse_hex4(json_parser_t *p)
+{
+    if (p->end - p->pos < 4)
+    {
+        fail("truncated \\u escape");
+    }
+
+    uint32_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char h = *p->pos++;
+        c <<= 4;
+        if (h >= '0' && h <= '9')
+        {
+            c |= h - '0';
+        }
+        else if (h >= 'a' && h <= 'f')
+        {
+            c |= h - 'a' + 10;
+        }
+        else if (h >= 'A' && h <= 'F')
+        {
+            c |= h - 'A' + 10;
+        }
+        else
+        {
+            fail("bad \\u escape");
+        }
+    }
+    return c;
+}
+
+static void
+parse_string(json_parser_t *p, std::string *out)
+{
+    /* opening quote already checked */
+    p->pos++;
+
+    for (;;)
+    {
+        if (p->pos >= p->end)
+        {
+            fail("unterminated string");
+        }
+
+        char c = *p->pos++;
+        if (c == '"')
+        {
+            return;
+        }
+        if (c != '\\')
+        {
+            out->push_back(c);
+            continue;
+        }
+
+        if (p->pos >= p->end)
+        {
+            fail("unterminated string");
+        }
+        c = *p->pos++;
+        switch (c)
+        {
+            case '"':
+            case '\\':
+            case '/':
+                out->push_back(c);
+                break;
+            case 'b':
+                out->push_back('\b');
+                break;
+            case 'f':
+                out->push_back('\f');
+                break;
+            case 'n':
+                out->push_back('\n');
+                break;
+            case 'r':
+                out->push_back('\r');
+                break;
+            case 't':
+                out->push_back('\t');
+                break;
+            case 'u':
+            {
+                uint32_t code = parse_hex4(p);
+                /* surrogate pair */
+                if (code >= 0xd800 && code < 0xdc00 && accept(p, "\\u"))
+                {
+                    uint32_t low = parse_hex4(p);
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                put_utf8(out, code);
+                break;
+            }
+            default:
+                fail("bad escape");
+        }
+    }
+}
+
+static void
+parse_value(json_parser_t *p, json_value_t *v, int depth)
+{
+    if (depth > JSON_MAX_DEPTH)
+    {
+        fail("nested too deep");
+    }
+
+    skip_space(p);
+    if (p->pos >= p->end)
+    {
+        fail("unexpected end");
+    }
+
+    v->type = JSON_NULL;
+    v->number = 0.0;
+
+    char c = *p->pos;
+    if (c == '{')
+    {
+        v->type = JSON_OBJECT;
+        p->pos++;
+        skip_space(p);
+        if (accept(p, "}"))
+        {
+            return;
+        }
+        for (;;)
+        {
+            skip_space(p);
+            if (p->pos >= p->end || *p->pos != '"')
+            {
+                fail("expected member name");
+            }
+            v->keys.push_back(std::string());
+            parse_string(p, &(v->keys.back()));
+
+            skip_space(p);
+            if (!accept(p, ":"))
+            {
+                fail("expected ':'");
+            }
+
+            v->items.push_back(json_value_t());
+            parse_value(p, &(v->items.back()), depth + 1);
+
+            skip_space(p);
+            if (accept(p, "}"))
+            {
+                return;
+            }
+            if (!accept(p, ","))
+            {
+                fail("expected ',' or '}'");
+            }
+        }
+    }
+    else if (c == '[')
+    {
+        v->type = JSON_ARRAY;
+        p->pos++;
+        skip_space(p);
+        if (accept(p, "]"))
+        {
+            return;
+        }
+        for (;;)
+        {
+            v->items.push_back(json_value_t());
+            parse_value(p, &(v->items.back()), depth + 1);
+
+            skip_space(p);
+            if (accept(p, "]"))
+            {
+                return;
+            }
+            if (!accept(p, ","))
+            {
+                fail("expected ',' or ']'");
+            }
+        }
+    }
+    else if (c == '"')
+    {
+        v->type = JSON_STRING;
+        parse_string(p, &(v->string));
+    }
+    else if (accept(p, "true"))
+    {
+        v->type = JSON_BOOL;
+        v->number = 1.0;
+    }
+    else if (accept(p, "false"))
+    {
+        v->type = JSON_BOOL;
+    }
+    else if (accept(p, "null"))
+    {
+        v->type = JSON_NULL;
+    }
+    else
+    {
+        /* strtod needs a terminated string, numbers are short */
+        char buf[64];
+        size_t len = 0;
+        while (p->pos + len < p->end && len < sizeof(buf) - 1 &&
+               strchr("+-.eE0123456789", p->pos[len]) != NULL)
+        {
+            len++;
+        }
+        memcpy(buf, p->pos, len);
+        buf[len] = '\0';
+
+        char *numEnd;
+        v->type = JSON_NUMBER;
+        v->number = strtod(buf, &numEnd);
+        if (len == 0 || numEnd != buf + len)
+        {
+            fail("bad value");
+        }
+        p->pos += len;
+    }
+}
+
+void
+json_parse(const char *text, size_t size, json_value_t *root)
+{
+    json_parser_t p;
+    p.pos = text;
+    p.end = text + size;
+
+    *root = json_value_t();
+    parse_value(&p, root, 0);
+
+    skip_space(&p);
+    if (p.pos != p.end)
+    {
+        fail("trailing data");
+    }
+}
+
+const json_value_t *
+json_get(const json_value_t *obj, const char *key)
+{
+    if (obj == NULL || obj->type != JSON_OBJECT)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < obj->keys.size(); i++)
+    {
+        if (obj->keys[i] == key)
+        {
+            return &(obj->items[i]);
+        }
+    }
+    return NULL;
+}
+
+const json_value_t *
+json_at(const json_value_t *arr, size_t i)
+{
+    if (arr == NULL || arr->type != JSON_ARRAY || i >= arr->items.size())
+    {
+        return NULL;
+    }
+    return &(arr->items[i]);
+}
+
+size_t
+json_count(const json_value_t *arr)
+{
+    if (arr == NULL || arr->type != JSON_ARRAY)
+    {
+        return 0;
+    }
+    return arr->items.size();
+}
+
+double
+json_number(const json_value_t *v, double def)
+{
+    if (v == NULL || v->type != JSON_NUMBER)
+    {
+        return def;
+    }
+    return v->number;
+}
+
+const char *
+json_string(const json_value_t *v, const char *def)
+{
+    if (v == NULL || v->type != JSON_STRING)
+    {
+        return def;
+    }
+    return v->string.c_str();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Small JSON reader for asset metadata like glTF, the whole document is
+ * parsed into a tree of values.
+ */
+
+typedef enum
+{
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} json_type_t;
+
+typedef struct json_value_s
+{
+    json_type_t type;
+    /* numbers, and 0 or 1 for booleans */
+    double number;
+    std::string string;
+    /* array elements or object member values */
+    std::vector<json_value_s> items;
+    /* object member names, parallel to items */
+    std::vector<std::string> keys;
+} json_value_t;
+
+/* throws std::runtime_error on malformed input */
+void
+json_parse(const char *text, size_t size, json_value_t *root);
+
+/* member key of an object, NULL if obj is NULL, not an object or has no such member */
+const json_value_t *
+json_get(const json_value_t *obj, const char *key);
+
+/* element i of an array, NULL if arr is NULL, not an array or too short */
+const json_value_t *
+json_at(const json_value_t *arr, size_t i);
+
+/* number of array elements, 0 if arr is NULL or not an array */
+size_t
+json_count(const json_value_t *arr);
+
+/* def if v is NULL or not a number */
+double
+json_number(const json_value_t *v, double def);
+
+/* def if v is NULL or not a string */
+const char *
+json_string(const json_value_t *v, const char *def);
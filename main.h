@@ -7,12 +7,32 @@
 
 #include <vector>
 #include <array>
+#include <mutex>
+#include <chrono>
+
+#include "gpu_alloc.h"
+
+struct upload_s;
+struct readback_s;
+struct profiler_s;
+struct thread_pool_s;
+struct cull_s;
+struct object_store_s;
+struct mesh_cache_s;
+struct swapchain_s;
+struct descriptors_s;
+struct shader_reload_s;
+struct pipelines_s;
 
 #define FRAME_BUF_FORMAT VK_FORMAT_B8G8R8A8_UNORM
 
+/* how many frames the CPU may record ahead of the GPU */
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 8
+
 struct Vertex
 {
-    glm::vec2 pos;
+    glm::vec3 pos;
     glm::vec3 color;
 
     static VkVertexInputBindingDescription getBindingDescription()
@@ -31,7 +51,7 @@ struct Vertex
 
         attributeDescriptions[0].binding = 0;
         attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
         attributeDescriptions[0].offset = offsetof(Vertex, pos);
 
         attributeDescriptions[1].binding = 0;
@@ -43,6 +63,165 @@ struct Vertex
     }
 };
 
+/*
+ * compact vertex, 12 instead of 24 bytes, see vertex_pack.h
+ *
+ * pos is quantized to 16 bits over the mesh bounds, scaling it back is
+ * folded into DrawPushConstants::transform
+ */
+struct VertexPacked
+{
+    /* xyz and a zero pad, 3 component 16 bit formats are optional */
+    uint16_t pos[4];
+    /* rgb and 255 */
+    uint8_t color[4];
+
+    static VkVertexInputBindingDescription getBindingDescription()
+    {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(VertexPacked);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions()
+    {
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
+
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attributeDescriptions[0].offset = offsetof(VertexPacked, pos);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_UNORM;
+        attributeDescriptions[1].offset = offsetof(VertexPacked, color);
+
+        return attributeDescriptions;
+    }
+};
+
+/* layout of the vertex buffer */
+typedef enum
+{
+    /* packed for non-instanced scenes of at least VERTEX_PACK_MIN_VERTICES */
+    VERTEX_FORMAT_AUTO,
+    VERTEX_FORMAT_FLOAT,
+    VERTEX_FORMAT_PACKED,
+} vertex_format_t;
+
+/* specialization constants of a pipeline variant, constant_id 0 and up */
+#define PIPELINE_MAX_SPEC_CONSTANTS 4
+
+/* everything a graphics pipeline variant is created from, see pipelines.h */
+typedef struct pipeline_key_s
+{
+    /* SPIR-V files, must outlive the variant, frag NULL for depth only */
+    const char *vert;
+    const char *frag;
+    /* vertex layout, plus per instance data in binding 1 if instanced */
+    vertex_format_t vertexFormat;
+    bool instanced;
+    VkPolygonMode polygonMode;
+    VkCullModeFlags cullMode;
+    /* alpha blending */
+    bool blend;
+    /* color writes off for a depth only pass */
+    bool colorWrite;
+    bool depthTest;
+    bool depthWrite;
+    VkCompareOp depthCompare;
+    /* for both stages, 32 bits each */
+    uint32_t specCount;
+    uint32_t spec[PIPELINE_MAX_SPEC_CONSTANTS];
+} pipeline_key_t;
+
+/*
+ * per instance data of instanced draws, the mesh is placed in the world
+ * with model and its vertex colors are multiplied by color
+ */
+struct Instance
+{
+    glm::mat4 model;
+    glm::vec3 color;
+
+    static VkVertexInputBindingDescription getBindingDescription()
+    {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 1;
+        bindingDescription.stride = sizeof(Instance);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+        return bindingDescription;
+    }
+
+    /* a mat4 attribute takes one location per column */
+    static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions()
+    {
+        std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = {};
+
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            attributeDescriptions[i].binding = 1;
+            attributeDescriptions[i].location = 2 + i;
+            attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+            attributeDescriptions[i].offset = offsetof(Instance, model) + i * sizeof(glm::vec4);
+        }
+
+        attributeDescriptions[4].binding = 1;
+        attributeDescriptions[4].location = 6;
+        attributeDescriptions[4].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[4].offset = offsetof(Instance, color);
+
+        return attributeDescriptions;
+    }
+};
+
+/* one indexed draw from the vertex and index buffers */
+typedef struct draw_s
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    /* instances in the instance buffer, 1 and 0 for non-instanced scenes */
+    uint32_t instanceCount;
+    uint32_t firstInstance;
+    /* index of the placing transform in handles->objectModels, 0 if there is one */
+    uint32_t object;
+} draw_t;
+
+/* one level of detail of a draw, in the same vertex and index buffers */
+typedef struct draw_lod_s
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    /* largest distance to the full detail surface, in mesh units */
+    float error;
+} draw_lod_t;
+
+/* depth attachment of one framebuffer */
+typedef struct depth_buffer_s
+{
+    VkImage image;
+    VkImageView view;
+    gpu_allocation_t alloc;
+} depth_buffer_t;
+
+/* command recording state of one frame in flight */
+typedef struct frame_cmds_s
+{
+    VkCommandPool primaryPool;
+    VkCommandBuffer primary;
+    /* one pool and secondary buffer per recording slice */
+    std::vector<VkCommandPool> slicePools;
+    std::vector<VkCommandBuffer> secondaries;
+    /* depth pre-pass of each slice, from the same pool, empty unless depthPrepass */
+    std::vector<VkCommandBuffer> depthSecondaries;
+} frame_cmds_t;
+
 struct UniformBufferObject
 {
     glm::mat4 model;
@@ -50,42 +229,185 @@ struct UniformBufferObject
     glm::mat4 proj;
 };
 
+/* vertex shader data of a draw, pushed instead of read from the UBO */
+struct DrawPushConstants
+{
+    /*
+     * object to clip space, premultiplied on the CPU with the packed
+     * vertex dequantization folded in, instanced draws apply their
+     * instance's model matrix before it
+     */
+    glm::mat4 transform;
+};
+
 typedef struct handles_s
 {
+    /* render into offscreen images, no window, surface or swapchain */
+    bool headless;
+    /* number of frames to render in headless mode */
+    uint32_t headlessFrames;
+    /* copy headless frames back to the CPU */
+    bool readbackEnabled;
+    /* if set, write read back frames to <prefix>NNNNNN.ppm */
+    const char *dumpFramesPrefix;
+    /* collect CPU and GPU timings, optionally into a trace file */
+    bool profileEnabled;
+    const char *tracePath;
+    /* cull draws and build their indirect commands on the GPU */
+    bool gpuDriven;
+    /* requested vertex layout, the one in use after init_vulkan() */
+    vertex_format_t vertexFormat;
+    /* requested present mode, the one in use after init_vulkan() */
+    VkPresentModeKHR presentMode;
+    /*
+     * draw the coarsest level of detail whose error projects to at most
+     * this many pixels, 0 always draws full detail
+     */
+    float lodPixelError;
+    /* rebuild the graphics pipelines when shader sources change */
+    bool hotReload;
+    /* lay down depth first, then shade only the visible fragments */
+    bool depthPrepass;
+
     GLFWwindow* window;
     VkInstance instance;
     VkDebugReportCallbackEXT debug_cb;
     VkSurfaceKHR surface;
     uint32_t gfxFamilyIndex;
     uint32_t presentationFamilyIndex;
+    /* same as gfxFamilyIndex if device has no dedicated transfer queue */
+    uint32_t transferFamilyIndex;
     VkQueue gfxQueue;
     VkQueue presentationQueue;
+    VkQueue transferQueue;
+    /* serializes submissions to gfxQueue from different threads */
+    std::mutex queueLock;
     VkPhysicalDevice phyDevice;
     VkDevice device;
+    /* optional device capabilities, only enabled in GPU driven mode */
+    bool drawIndirectCount;
+    bool multiDrawIndirect;
+    /* VK_GOOGLE_display_timing, enabled with a window to measure present latency */
+    bool displayTiming;
     VkSwapchainKHR swapchain;
+    /* the window was resized, recreate the swapchain before the next frame */
+    bool swapchainStale;
+    /* retired swapchains and present history, NULL in headless mode */
+    swapchain_s *swapchainState;
     VkExtent2D swapchainExtend;
     std::vector<VkImage> swapChainImages;
     std::vector<VkImageView> swapChainImageViews;
     std::vector<VkFramebuffer> swapChainFramebuffers;
+    /* memory of the headless mode images in swapChainImages */
+    std::vector<gpu_allocation_t> offscreenImageAllocs;
+    /* one per image in swapChainImages, see depth.h */
+    VkFormat depthFormat;
+    std::vector<depth_buffer_t> depthBuffers;
+    VkPipelineCache pipelineCache;
+    /* pipelineCache was seeded with valid data from disk */
+    bool pipelineCacheWarm;
+    /* graphics pipeline variants, they own the pipelines below */
+    pipelines_s *pipelines;
+    pipeline_key_t gfxPipelineKey;
     VkPipeline gfxPipeline;
+    /* VK_NULL_HANDLE unless the scene has instances */
+    pipeline_key_t instancedPipelineKey;
+    VkPipeline instancedPipeline;
+    /* depth only variant of the one in use, VK_NULL_HANDLE unless depthPrepass */
+    pipeline_key_t depthPipelineKey;
+    VkPipeline depthPipeline;
     VkPipelineLayout pipelineLayout;
     VkRenderPass renderPass;
     VkDescriptorSetLayout descriptorSetLayout;
-    VkCommandPool commandPool;
-    std::vector<VkCommandBuffer> commandBuffers;
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
+    std::vector<frame_cmds_t> frameCmds;
+
+    /* per frame-in-flight synchronization */
+    uint32_t framesInFlight;
+    uint32_t currentFrame;
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    std::vector<VkFence> inFlightFences;
+
+    /* sub-allocates all device memory */
+    gpu_allocator_s *allocator;
+
+    /* staging ring and batched copies */
+    upload_s *upload;
+
+    /* headless frame readback ring and consumer thread */
+    readback_s *readback;
+
+    /* NULL unless profiling is enabled */
+    profiler_s *profiler;
+
+    /* workers for parallel initialization */
+    thread_pool_s *threadPool;
+
+    /* NULL unless gpuDriven */
+    cull_s *cull;
+
+    /* shader source watcher, NULL unless hotReload */
+    shader_reload_s *shaderReload;
+
+    /* time spent in init_vulkan() and on the scene upload */
+    std::chrono::high_resolution_clock::time_point initStart;
+    bool firstFrameSubmitted;
+    float startupSeconds;
+    VkDeviceSize uploadBytes;
+    float uploadSeconds;
 
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    gpu_allocation_t vertexBufferAlloc;
+    /*
+     * dequantization of packed vertex positions, pos * scale + offset,
+     * identity unless vertexFormat is VERTEX_FORMAT_PACKED
+     */
+    glm::vec4 posScale;
+    glm::vec4 posOffset;
 
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    gpu_allocation_t indexBufferAlloc;
+    /* 16 or 32 bit, as the scene needs */
+    VkIndexType indexType;
+
+    /* draws recorded into each frame's command buffer */
+    std::vector<draw_t> draws;
+    /*
+     * levels of detail of draws[i], finest first, and the bounding spheres
+     * they are selected by, empty if there is nothing to select
+     */
+    std::vector<std::vector<draw_lod_t> > drawLods;
+    std::vector<glm::vec4> drawSpheres;
+    /* triangles drawn by all frames so far */
+    uint64_t trianglesDrawn;
+
+    /*
+     * per instance data, one slot of instanceCount instances per frame in
+     * flight, persistently mapped, filled from the visible objects
+     */
+    object_store_s *objects;
+    uint32_t instanceCount;
+    VkBuffer instanceBuffer;
+    gpu_allocation_t instanceBufferAlloc;
+    VkDeviceSize instanceBufferStride;
+    void *instanceBufferMapped;
+
+    /* model transforms of the scene's objects, draw_t::object indexes them */
+    std::vector<glm::mat4> objectModels;
+    /*
+     * transform of each object, written with the frame's UBO and pushed
+     * whenever the object changes between draws
+     */
+    std::vector<DrawPushConstants> objectPush;
 
+    /* one UniformBufferObject slot per frame in flight, persistently mapped */
     VkBuffer uniformBuffer;
-    VkDeviceMemory uniformBufferMemory;
+    gpu_allocation_t uniformBufferAlloc;
+    VkDeviceSize uniformBufferStride;
+    void *uniformBufferMapped;
 
-    VkDescriptorPool descriptorPool;
+    /* descriptor pools and the cache of sets that never change */
+    descriptors_s *descriptors;
     VkDescriptorSet descriptorSet;
 } handles_t;
 
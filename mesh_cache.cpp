@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+
+#include "mesh_cache.h"
+#include "utils.h"
+
+struct mesh_cache_s
+{
+    mapped_file_t file;
+    const Vertex *vertices;
+    size_t vertexCount;
+    const void *indices;
+    size_t indexCount;
+    VkIndexType indexType;
+
+    ~mesh_cache_s()
+    {
+        unmap_file(&file);
+    }
+};
+
+static void
+cache_fail(const char *path, const char *msg)
+{
+    throw std::runtime_error(std::string(path) + ": " + msg);
+}
+
+static uint64_t
+align_up(uint64_t offset)
+{
+    return (offset + MESH_CACHE_ALIGN - 1) & ~(uint64_t)(MESH_CACHE_ALIGN - 1);
+}
+
+/* FNV-1a over 8 byte words, the tail bytewise */
+static uint64_t
+checksum(const char *data, size_t size)
+{
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ (uint8_t)data[i]) * prime;
+    }
+
+    return hash;
+}
+
+/* the layout of Vertex this build uploads */
+static void
+vertex_layout(mesh_cache_header_t *header)
+{
+    static_assert(std::tuple_size<decltype(Vertex::getAttributeDescriptions())>::value <=
+                  MESH_CACHE_MAX_ATTRIBUTES, "too many vertex attributes for the mesh cache");
+
+    auto attributes = Vertex::getAttributeDescriptions();
+
+    header->vertexStride = Vertex::getBindingDescription().stride;
+    header->attributeCount = (uint32_t)attributes.size();
+    for (size_t i = 0; i < attributes.size(); i++)
+    {
+        header->attributes[i].location = attributes[i].location;
+        header->attributes[i].format = attributes[i].format;
+        header->attributes[i].offset = attributes[i].offset;
+    }
+}
+
+void
+mesh_cache_write(const scene_t *scene, const char *path)
+{
+    size_t vertexCount, indexCount;
+    const Vertex *vertices = scene_vertices(scene, &vertexCount);
+    VkIndexType indexType;
+    const void *indices = scene_indices(scene, &indexCount, &indexType);
+
+    mesh_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    vertex_layout(&header);
+    header.indexSize = (uint32_t)index_size(indexType);
+    header.drawCount = (uint32_t)scene->draws.size();
+    for (auto lods = scene->lods.begin(); lods != scene->lods.end(); ++lods)
+    {
+        header.lodCount += (uint32_t)lods->size();
+    }
+    header.vertexCount = vertexCount;
+    header.indexCount = indexCount;
+
+    header.drawOffset = align_up(sizeof(header));
+    header.lodOffset = align_up(header.drawOffset + sizeof(mesh_cache_draw_t) * header.drawCount);
+    header.vertexOffset = align_up(header.lodOffset + sizeof(mesh_cache_lod_t) * header.lodCount);
+    header.indexOffset = align_up(header.vertexOffset + sizeof(Vertex) * vertexCount);
+    uint64_t fileSize = header.indexOffset + header.indexSize * indexCount;
+
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        glm::vec3 pos = vertices[i].pos;
+        for (int c = 0; c < 3; c++)
+        {
+            header.boundsMin[c] = i == 0 ? pos[c] : std::min(header.boundsMin[c], pos[c]);
+            header.boundsMax[c] = i == 0 ? pos[c] : std::max(header.boundsMax[c], pos[c]);
+        }
+    }
+
+    /* assembled in memory, so the checksum covers exactly what is written */
+    std::vector<char> data(fileSize, 0);
+    size_t lodIndex = 0;
+    for (size_t i = 0; i < scene->draws.size(); i++)
+    {
+        const draw_t *draw = &(scene->draws[i]);
+        mesh_cache_draw_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.indexCount = draw->indexCount;
+        entry.firstIndex = draw->firstIndex;
+        entry.vertexOffset = draw->vertexOffset;
+
+        if (i < scene->lods.size())
+        {
+            const std::vector<draw_lod_t>& lods = scene->lods[i];
+            entry.lodCount = (uint32_t)lods.size();
+            for (auto lod = lods.begin(); lod != lods.end(); ++lod, lodIndex++)
+            {
+                mesh_cache_lod_t level;
+                memset(&level, 0, sizeof(level));
+                level.indexCount = lod->indexCount;
+                level.firstIndex = lod->firstIndex;
+                level.error = lod->error;
+                memcpy(&(data[header.lodOffset + sizeof(level) * lodIndex]), &level, sizeof(level));
+            }
+        }
+
+        glm::vec4 sphere = scene_draw_sphere(scene, i);
+        for (int c = 0; c < 4; c++)
+        {
+            entry.sphere[c] = sphere[c];
+        }
+
+        memcpy(&(data[header.drawOffset + sizeof(entry) * i]), &entry, sizeof(entry));
+    }
+    if (vertexCount > 0)
+    {
+        memcpy(&(data[header.vertexOffset]), vertices, sizeof(Vertex) * vertexCount);
+    }
+    if (indexCount > 0)
+    {
+        memcpy(&(data[header.indexOffset]), indices, header.indexSize * indexCount);
+    }
+
+    header.checksum = checksum(data.data() + sizeof(header), data.size() - sizeof(header));
+    memcpy(data.data(), &header, sizeof(header));
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        cache_fail(path, "can't open for writing");
+    }
+    size_t written = fwrite(data.data(), 1, data.size(), f);
+    if (fclose(f) != 0 || written != data.size())
+    {
+        cache_fail(path, "write failed");
+    }
+}
+
+/* check that count elements of size at offset are within the file */
+static bool
+in_file(const mapped_file_t *file, uint64_t offset, uint64_t count, uint64_t size)
+{
+    return offset % MESH_CACHE_ALIGN == 0 && offset <= file->size &&
+           count <= (file->size - offset) / size;
+}
+
+/*
+ * check that indexCount indices from firstIndex are in the file, and if
+ * verify is set that they address vertices in the file
+ */
+static void
+check_range(const char *path, const mesh_cache_s *cache, const mesh_cache_header_t *header,
+            uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset, bool verify)
+{
+    if (indexCount > header->indexCount || firstIndex > header->indexCount - indexCount)
+    {
+        cache_fail(path, "mesh cache draw out of range");
+    }
+
+    /* reads the indices, only trusted caches skip this */
+    if (!verify)
+    {
+        return;
+    }
+    for (uint32_t j = 0; j < indexCount; j++)
+    {
+        int64_t index = (int64_t)read_index(cache->indices, cache->indexType,
+                                            firstIndex + j) + vertexOffset;
+        if (index < 0 || (uint64_t)index >= header->vertexCount)
+        {
+            cache_fail(path, "mesh cache index out of range");
+        }
+    }
+}
+
+scene_t
+mesh_cache_load(const char *path, bool verify)
+{
+    std::shared_ptr<mesh_cache_s> cache(new mesh_cache_s());
+    map_file(path, &(cache->file));
+    const mapped_file_t *file = &(cache->file);
+
+    mesh_cache_header_t header;
+    if (file->size < sizeof(header))
+    {
+        cache_fail(path, "truncated mesh cache");
+    }
+    memcpy(&header, file->data, sizeof(header));
+
+    if (header.magic != MESH_CACHE_MAGIC)
+    {
+        cache_fail(path, "not a mesh cache");
+    }
+    if (header.version != MESH_CACHE_VERSION)
+    {
+        cache_fail(path, "mesh cache version mismatch, convert it again");
+    }
+
+    /* the blobs are uploaded as is, so the layout must match exactly */
+    mesh_cache_header_t expected;
+    memset(&expected, 0, sizeof(expected));
+    vertex_layout(&expected);
+    if (header.vertexStride != expected.vertexStride ||
+        header.attributeCount != expected.attributeCount ||
+        memcmp(header.attributes, expected.attributes, sizeof(header.attributes)) != 0 ||
+        (header.indexSize != sizeof(uint16_t) && header.indexSize != sizeof(uint32_t)))
+    {
+        cache_fail(path, "mesh cache vertex layout mismatch, convert it again");
+    }
+
+    if (!in_file(file, header.drawOffset, header.drawCount, sizeof(mesh_cache_draw_t)) ||
+        !in_file(file, header.lodOffset, header.lodCount, sizeof(mesh_cache_lod_t)) ||
+        !in_file(file, header.vertexOffset, header.vertexCount, sizeof(Vertex)) ||
+        !in_file(file, header.indexOffset, header.indexCount, header.indexSize))
+    {
+        cache_fail(path, "truncated mesh cache");
+    }
+
+    if (verify &&
+        checksum(file->data + sizeof(header), file->size - sizeof(header)) != header.checksum)
+    {
+        cache_fail(path, "mesh cache checksum mismatch");
+    }
+
+    cache->vertices = (const Vertex *)(file->data + header.vertexOffset);
+    cache->vertexCount = header.vertexCount;
+    cache->indices = file->data + header.indexOffset;
+    cache->indexCount = header.indexCount;
+    cache->indexType = header.indexSize == sizeof(uint32_t) ? VK_INDEX_TYPE_UINT32 :
+                                                              VK_INDEX_TYPE_UINT16;
+
+    scene_t scene;
+    const char *slash = strrchr(path, '/');
+    scene.name = slash != NULL ? slash + 1 : path;
+
+    const mesh_cache_draw_t *draws = (const mesh_cache_draw_t *)(file->data + header.drawOffset);
+    const mesh_cache_lod_t *lods = (const mesh_cache_lod_t *)(file->data + header.lodOffset);
+    uint32_t lodIndex = 0;
+    for (uint32_t i = 0; i < header.drawCount; i++)
+    {
+        const mesh_cache_draw_t *entry = &(draws[i]);
+
+        check_range(path, cache.get(), &header, entry->indexCount, entry->firstIndex,
+                    entry->vertexOffset, verify);
+
+        draw_t draw = {entry->indexCount, entry->firstIndex, entry->vertexOffset, 1, 0, 0};
+        scene.draws.push_back(draw);
+        scene.spheres.push_back(glm::vec4(entry->sphere[0], entry->sphere[1],
+                                          entry->sphere[2], entry->sphere[3]));
+
+        if (entry->lodCount > header.lodCount - lodIndex)
+        {
+            cache_fail(path, "mesh cache levels of detail out of range");
+        }
+
+        std::vector<draw_lod_t> levels;
+        for (uint32_t l = 0; l < entry->lodCount; l++, lodIndex++)
+        {
+            const mesh_cache_lod_t *lod = &(lods[lodIndex]);
+            check_range(path, cache.get(), &header, lod->indexCount, lod->firstIndex,
+                        entry->vertexOffset, verify);
+            levels.push_back({lod->indexCount, lod->firstIndex, lod->error});
+        }
+        if (header.lodCount > 0)
+        {
+            scene.lods.push_back(levels);
+        }
+    }
+
+    scene.cache = cache;
+    return scene;
+}
+
+const Vertex *
+mesh_cache_vertices(const mesh_cache_s *cache, size_t *count)
+{
+    *count = cache->vertexCount;
+    return cache->vertices;
+}
+
+const void *
+mesh_cache_indices(const mesh_cache_s *cache, size_t *count, VkIndexType *type)
+{
+    *count = cache->indexCount;
+    *type = cache->indexType;
+    return cache->indices;
+}
+
+size_t
+mesh_cache_file_size(const mesh_cache_s *cache)
+{
+    return cache->file.size;
+}
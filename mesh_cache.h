@@ -0,0 +1,108 @@
+#pragma once
+
+#include "main.h"
+#include "scene.h"
+
+/*
+ * Binary mesh cache, written once by mesh_convert and memory mapped at
+ * load time. The vertex and index blobs are stored exactly as they are
+ * uploaded, so loading is validating the header and pointing the scene
+ * at the mapping; the only copy is the one into the staging ring.
+ *
+ * Layout, little endian, blobs aligned to MESH_CACHE_ALIGN bytes:
+ *
+ *   mesh_cache_header_t
+ *   mesh_cache_draw_t[drawCount]
+ *   mesh_cache_lod_t[lodCount], the levels of each draw in draw order
+ *   Vertex[vertexCount]
+ *   uint16_t or uint32_t[indexCount]
+ */
+
+#define MESH_CACHE_MAGIC 0x48534d56 /* "VMSH" */
+#define MESH_CACHE_VERSION 2
+#define MESH_CACHE_ALIGN 64
+#define MESH_CACHE_MAX_ATTRIBUTES 8
+
+/* must match Vertex::getAttributeDescriptions() to be loaded */
+typedef struct mesh_cache_attribute_s
+{
+    uint32_t location;
+    uint32_t format;
+    uint32_t offset;
+} mesh_cache_attribute_t;
+
+typedef struct mesh_cache_header_s
+{
+    uint32_t magic;
+    uint32_t version;
+
+    uint32_t vertexStride;
+    uint32_t attributeCount;
+    mesh_cache_attribute_t attributes[MESH_CACHE_MAX_ATTRIBUTES];
+    /* bytes per index, 2 or 4 */
+    uint32_t indexSize;
+    uint32_t drawCount;
+    uint32_t lodCount;
+    uint32_t reserved;
+
+    uint64_t vertexCount;
+    uint64_t indexCount;
+
+    /* from the start of the file */
+    uint64_t drawOffset;
+    uint64_t lodOffset;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+
+    /* of all vertices */
+    float boundsMin[3];
+    float boundsMax[3];
+
+    /* of everything after the header */
+    uint64_t checksum;
+} mesh_cache_header_t;
+
+/* a draw of the scene and the bounding sphere of its vertices */
+typedef struct mesh_cache_draw_s
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    /* levels of detail, 0 or at least 2 with the draw itself first */
+    uint32_t lodCount;
+    float sphere[4];
+} mesh_cache_draw_t;
+
+/* see draw_lod_t */
+typedef struct mesh_cache_lod_s
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    float error;
+    uint32_t reserved;
+} mesh_cache_lod_t;
+
+/* throws std::runtime_error if path can't be written */
+void
+mesh_cache_write(const scene_t *scene, const char *path);
+
+/*
+ * map a mesh cache, the scene references the mapping until it and all
+ * its copies are gone
+ *
+ * Throws std::runtime_error if the file is not a cache of this version
+ * and vertex layout or is truncated. The checksum and index ranges are
+ * only checked if verify is set, as that reads the whole file.
+ */
+scene_t
+mesh_cache_load(const char *path, bool verify);
+
+/* the vertex and index data of a scene loaded by mesh_cache_load() */
+const Vertex *
+mesh_cache_vertices(const mesh_cache_s *cache, size_t *count);
+
+const void *
+mesh_cache_indices(const mesh_cache_s *cache, size_t *count, VkIndexType *type);
+
+size_t
+mesh_cache_file_size(const mesh_cache_s *cache);
@@ -0,0 +1,191 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "main.h"
+#include "mesh_cache.h"
+#include "mesh_loader.h"
+#include "mesh_lod.h"
+#include "mesh_optimize.h"
+#include "thread_pool.h"
+
+/*
+ * Converts an OBJ or glTF mesh to a .vkmesh cache, optimized for the
+ * vertex cache, overdraw and vertex fetch unless --no-optimize is given
+ * and with level of detail chains unless --no-lods is given, and compares
+ * loading the two, cold (evicted from the page cache) and warm. Every load is
+ * followed by copying the vertex and index data once, like the copy
+ * into the staging ring at init_vulkan(), so mapping a cache without
+ * touching its pages does not count as loading it.
+ *
+ *   mesh_convert [--threads N] [--no-optimize] [--no-lods] in.obj|in.gltf|in.glb out.vkmesh
+ *   mesh_convert --verify file.vkmesh
+ */
+
+#define WARM_RUNS 5
+
+static void
+usage(const char *prog)
+{
+    printf("usage: %s [--threads N] [--no-optimize] [--no-lods] in.obj|in.gltf|in.glb out.vkmesh\n"
+           "       %s --verify file.vkmesh\n", prog, prog);
+    exit(EXIT_FAILURE);
+}
+
+static float
+ms_since(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+}
+
+/*
+ * best effort, drops the clean pages of path from the page cache, external
+ * glTF buffers stay cached
+ */
+static void
+evict(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/* load path and copy its data to staging, returns the milliseconds taken */
+static float
+timed_load(handles_t *handles, const char *path, std::vector<char> *staging)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    scene_t scene = scene_parse(handles, path);
+
+    size_t vertexCount, indexCount;
+    const Vertex *vertices = scene_vertices(&scene, &vertexCount);
+    VkIndexType indexType;
+    const void *indices = scene_indices(&scene, &indexCount, &indexType);
+    size_t vertexBytes = sizeof(Vertex) * vertexCount;
+    size_t indexBytes = index_size(indexType) * indexCount;
+
+    staging->resize(vertexBytes + indexBytes);
+    memcpy(staging->data(), vertices, vertexBytes);
+    memcpy(staging->data() + vertexBytes, indices, indexBytes);
+
+    return ms_since(start);
+}
+
+static void
+compare(handles_t *handles, const char *text, const char *cache)
+{
+    const char *paths[] = {text, cache};
+    std::vector<char> staging;
+
+    printf("%-10s %10s %10s\n", "path", "cold ms", "warm ms");
+    for (int i = 0; i < 2; i++)
+    {
+        evict(paths[i]);
+        float cold = timed_load(handles, paths[i], &staging);
+
+        float warm = 0.0f;
+        for (int run = 0; run < WARM_RUNS; run++)
+        {
+            float ms = timed_load(handles, paths[i], &staging);
+            warm = run == 0 ? ms : std::min(warm, ms);
+        }
+
+        printf("%-10s %10.2f %10.2f\n", i == 0 ? "text" : "cache", cold, warm);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *paths[2] = {NULL, NULL};
+    uint32_t pathCount = 0;
+    uint32_t threads = 0;
+    bool verify = false;
+    bool optimize = true;
+    bool lods = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-optimize") == 0)
+        {
+            optimize = false;
+        }
+        else if (strcmp(argv[i], "--no-lods") == 0)
+        {
+            lods = false;
+        }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            verify = true;
+        }
+        else if (argv[i][0] != '-' && pathCount < 2)
+        {
+            paths[pathCount++] = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    if (verify ? pathCount != 1 : pathCount != 2)
+    {
+        usage(argv[0]);
+    }
+
+    try
+    {
+        if (verify)
+        {
+            scene_t scene = mesh_cache_load(paths[0], true);
+            printf("%s: ok, %zu draws\n", paths[0], scene.draws.size());
+            return 0;
+        }
+
+        handles_t *handles = new handles_t();
+        thread_pool_init(handles, threads);
+
+        scene_t scene = scene_load(handles, paths[0]);
+        if (optimize)
+        {
+            scene_optimize(&scene);
+        }
+        if (lods)
+        {
+            scene_build_lods(&scene);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        mesh_cache_write(&scene, paths[1]);
+        printf("wrote %s in %.1f ms\n", paths[1], ms_since(start));
+
+        compare(handles, paths[0], paths[1]);
+
+        thread_pool_cleanup(handles);
+        delete handles;
+    }
+    catch (const std::exception& e)
+    {
+        printf("%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
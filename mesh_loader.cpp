@@ -0,0 +1,1409 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "mesh_loader.h"
+#include "mesh_cache.h"
+#include "json.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+/* 16 bit indices per draw */
+#define MAX_DRAW_VERTICES 65536
+
+/* vertex map slots, twice the vertices of a draw keeps probe chains short */
+#define VERTEX_MAP_BITS 17
+
+/* aim for a few chunks per thread, but not smaller than this */
+#define MIN_OBJ_CHUNK (256 * 1024)
+#define CHUNKS_PER_THREAD 4
+
+/*
+ * triangles are deduplicated in ranges of this many, independent of the
+ * thread count so that the output is too
+ */
+#define RANGE_TRIANGLES (64 * 1024)
+
+/* no normal index in an OBJ face */
+#define NO_INDEX 0xffffffffu
+
+#define GLTF_FLOAT 5126
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_TRIANGLES 4
+
+#define GLB_MAGIC 0x46546c67
+#define GLB_CHUNK_JSON 0x4e4f534a
+#define GLB_CHUNK_BIN 0x004e4942
+
+/* marks a vertex color to be derived from the position */
+static const glm::vec3 NO_COLOR(-1.0f);
+
+/*
+ * vertex key to index within the current draw, cleared in O(1) by
+ * bumping the stamp
+ */
+typedef struct vertex_map_s
+{
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> stamps;
+    std::vector<uint16_t> values;
+    uint32_t stamp;
+} vertex_map_t;
+
+/* writes the vertex of key to out */
+typedef void (*fetch_fn)(const void *ctx, uint64_t key, Vertex *out);
+
+/* vertices and draws deduplicated from one range of triangles */
+typedef struct batch_s
+{
+    std::vector<Vertex> vertices;
+    /* firstIndex is final, vertexOffset relative to the batch */
+    std::vector<draw_t> draws;
+} batch_t;
+
+/*
+ * run fn(item, worker) for items [0, count) on the thread pool and the
+ * calling thread, worker < workers is unique among concurrent calls
+ */
+static void
+parallel_for(handles_t *handles, size_t count, size_t workers,
+             const std::function<void(size_t, size_t)>& fn)
+{
+    std::atomic<size_t> next(0);
+    auto work = [&next, count, &fn](size_t worker) {
+        try
+        {
+            for (size_t item = next++; item < count; item = next++)
+            {
+                fn(item, worker);
+            }
+        }
+        catch (...)
+        {
+            /* stop the other workers at their next item */
+            next = count;
+            throw;
+        }
+    };
+
+    std::vector<std::future<void> > jobs;
+    for (size_t w = 1; w < workers; w++)
+    {
+        jobs.push_back(thread_pool_run(handles, [&work, w] { work(w); }));
+    }
+
+    std::exception_ptr error;
+    try
+    {
+        work(0);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    /* the jobs reference this frame, all must be done before anything is rethrown */
+    for (auto job = jobs.begin(); job != jobs.end(); ++job)
+    {
+        job->wait();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    for (auto job = jobs.begin(); job != jobs.end(); ++job)
+    {
+        job->get();
+    }
+}
+
+static size_t
+worker_count(handles_t *handles, size_t items)
+{
+    size_t threads = handles != NULL ? thread_pool_size(handles) : 1;
+    return std::max<size_t>(1, std::min(items, threads));
+}
+
+static inline uint32_t
+hash_key(uint64_t key)
+{
+    /* murmur3 finalizer */
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static void
+vertex_map_init(vertex_map_t *map)
+{
+    map->keys.resize(1 << VERTEX_MAP_BITS);
+    map->stamps.assign(1 << VERTEX_MAP_BITS, 0);
+    map->values.resize(1 << VERTEX_MAP_BITS);
+    map->stamp = 0;
+}
+
+static void
+vertex_map_clear(vertex_map_t *map)
+{
+    map->stamp++;
+    if (map->stamp == 0)
+    {
+        std::fill(map->stamps.begin(), map->stamps.end(), 0);
+        map->stamp = 1;
+    }
+}
+
+/*
+ * deduplicate the count corners in keys, starting at corner firstCorner
+ * of the mesh, writes their indices to indices[firstCorner...] and the
+ * new vertices and draws to batch
+ */
+static void
+build_batch(const uint64_t *keys, size_t count, size_t firstCorner,
+            fetch_fn fetch, const void *ctx, vertex_map_t *map,
+            uint16_t *indices, batch_t *batch)
+{
+    const uint32_t mask = (1 << VERTEX_MAP_BITS) - 1;
+    draw_t *draw = NULL;
+    uint32_t drawVertices = 0;
+
+    for (size_t c = 0; c < count; c++)
+    {
+        /* a triangle never straddles two draws */
+        if (c % 3 == 0 && (draw == NULL || drawVertices + 3 > MAX_DRAW_VERTICES))
+        {
+            draw_t next = {0, (uint32_t)(firstCorner + c), (int32_t)batch->vertices.size(), 1, 0, 0};
+            batch->draws.push_back(next);
+            draw = &(batch->draws.back());
+            drawVertices = 0;
+            vertex_map_clear(map);
+        }
+
+        uint64_t key = keys[c];
+        uint32_t slot = hash_key(key) & mask;
+        while (map->stamps[slot] == map->stamp && map->keys[slot] != key)
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        if (map->stamps[slot] != map->stamp)
+        {
+            map->stamps[slot] = map->stamp;
+            map->keys[slot] = key;
+            map->values[slot] = (uint16_t)drawVertices++;
+
+            Vertex v;
+            fetch(ctx, key, &v);
+            batch->vertices.push_back(v);
+        }
+
+        indices[firstCorner + c] = map->values[slot];
+        draw->indexCount++;
+    }
+}
+
+/*
+ * join the batches into the scene, center the mesh, scale it to the unit
+ * sphere and fill in missing colors
+ */
+static void
+finish_scene(handles_t *handles, std::vector<batch_t>& batches, scene_t *scene)
+{
+    size_t total = 0;
+    std::vector<size_t> bases(batches.size());
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        bases[b] = total;
+        total += batches[b].vertices.size();
+        for (auto draw = batches[b].draws.begin(); draw != batches[b].draws.end(); ++draw)
+        {
+            draw->vertexOffset += (int32_t)bases[b];
+            scene->draws.push_back(*draw);
+        }
+    }
+
+    scene->vertices.resize(total);
+    parallel_for(handles, batches.size(), worker_count(handles, batches.size()),
+                 [&](size_t b, size_t) {
+        std::copy(batches[b].vertices.begin(), batches[b].vertices.end(),
+                  scene->vertices.begin() + bases[b]);
+        std::vector<Vertex>().swap(batches[b].vertices);
+    });
+
+    if (total == 0)
+    {
+        return;
+    }
+
+    glm::vec3 lo = scene->vertices[0].pos;
+    glm::vec3 hi = lo;
+    for (auto v = scene->vertices.begin(); v != scene->vertices.end(); ++v)
+    {
+        lo = glm::min(lo, v->pos);
+        hi = glm::max(hi, v->pos);
+    }
+
+    glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = glm::length(hi - center);
+    float scale = radius > 0.0f ? 1.0f / radius : 1.0f;
+
+    for (auto v = scene->vertices.begin(); v != scene->vertices.end(); ++v)
+    {
+        v->pos = (v->pos - center) * scale;
+        if (v->color.x < 0.0f)
+        {
+            v->color = v->pos * 0.5f + glm::vec3(0.5f);
+        }
+    }
+}
+
+/*
+ * number parsing, on [p, end) without terminators or allocations
+ */
+
+static inline bool
+is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *
+skip_spaces(const char *p, const char *end)
+{
+    while (p < end && is_space(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+/* returns the end of the number, p if there is none */
+static const char *
+parse_float(const char *p, const char *end, float *out)
+{
+    static const double pow10[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    const char *start = p;
+    bool neg = false;
+    uint64_t mant = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool any = false;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        neg = *p == '-';
+        p++;
+    }
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        any = true;
+        if (digits < 19)
+        {
+            mant = mant * 10 + (*p - '0');
+            digits += mant != 0;
+        }
+        else
+        {
+            exp10++;
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            any = true;
+            if (digits < 19)
+            {
+                mant = mant * 10 + (*p - '0');
+                digits += mant != 0;
+                exp10--;
+            }
+        }
+    }
+
+    if (!any)
+    {
+        return start;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *e = p + 1;
+        bool eneg = false;
+        int exp = 0;
+
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            eneg = *e == '-';
+            e++;
+        }
+        if (e < end && *e >= '0' && *e <= '9')
+        {
+            for (; e < end && *e >= '0' && *e <= '9'; e++)
+            {
+                exp = std::min(exp * 10 + (*e - '0'), 1000);
+            }
+            exp10 += eneg ? -exp : exp;
+            p = e;
+        }
+    }
+
+    double v = (double)mant;
+    if (exp10 >= 0 && exp10 <= 22)
+    {
+        v *= pow10[exp10];
+    }
+    else if (exp10 < 0 && exp10 >= -22)
+    {
+        v /= pow10[-exp10];
+    }
+    else
+    {
+        v *= pow(10.0, exp10);
+    }
+
+    *out = (float)(neg ? -v : v);
+    return p;
+}
+
+/* returns the end of the number, p if there is none */
+static const char *
+parse_int(const char *p, const char *end, int64_t *out)
+{
+    const char *start = p;
+    bool neg = false;
+    int64_t v = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        neg = *p == '-';
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9')
+    {
+        return start;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        v = v * 10 + (*p - '0');
+    }
+
+    *out = neg ? -v : v;
+    return p;
+}
+
+/*
+ * Wavefront OBJ
+ *
+ * Two passes over the same chunks, the first counts positions, normals
+ * and triangle corners so that the second can write them straight to
+ * their final place. Face indices are global, or relative to the
+ * positions seen so far, so chunks need the counts of those before them.
+ */
+
+typedef struct obj_chunk_s
+{
+    const char *begin;
+    const char *end;
+
+    uint32_t positions;
+    uint32_t normals;
+    size_t corners;
+
+    uint32_t positionBase;
+    uint32_t normalBase;
+    size_t cornerBase;
+
+    bool colors;
+} obj_chunk_t;
+
+typedef struct obj_mesh_s
+{
+    /* xyz, and rgb if any position has a color */
+    std::vector<float> positions;
+    std::vector<float> colors;
+    std::vector<float> normals;
+    /* position index, normal index << 32 per triangle corner */
+    std::vector<uint64_t> keys;
+    bool hasColors;
+} obj_mesh_t;
+
+/* line type, p is moved past the keyword */
+typedef enum
+{
+    OBJ_OTHER,
+    OBJ_POSITION,
+    OBJ_NORMAL,
+    OBJ_FACE,
+} obj_line_t;
+
+static obj_line_t
+obj_line_type(const char **p, const char *end)
+{
+    const char *s = skip_spaces(*p, end);
+    obj_line_t type = OBJ_OTHER;
+
+    if (end - s >= 2 && s[0] == 'v' && is_space(s[1]))
+    {
+        type = OBJ_POSITION;
+        s += 2;
+    }
+    else if (end - s >= 3 && s[0] == 'v' && s[1] == 'n' && is_space(s[2]))
+    {
+        type = OBJ_NORMAL;
+        s += 3;
+    }
+    else if (end - s >= 2 && s[0] == 'f' && is_space(s[1]))
+    {
+        type = OBJ_FACE;
+        s += 2;
+    }
+
+    *p = s;
+    return type;
+}
+
+static inline const char *
+line_end(const char *p, const char *end)
+{
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return nl != NULL ? nl : end;
+}
+
+static void
+obj_count(obj_chunk_t *chunk)
+{
+    chunk->positions = 0;
+    chunk->normals = 0;
+    chunk->corners = 0;
+
+    for (const char *p = chunk->begin; p < chunk->end; )
+    {
+        const char *eol = line_end(p, chunk->end);
+
+        switch (obj_line_type(&p, eol))
+        {
+            case OBJ_POSITION:
+                chunk->positions++;
+                break;
+            case OBJ_NORMAL:
+                chunk->normals++;
+                break;
+            case OBJ_FACE:
+            {
+                /* fan of n - 2 triangles */
+                uint32_t refs = 0;
+                for (p = skip_spaces(p, eol); p < eol; p = skip_spaces(p, eol))
+                {
+                    refs++;
+                    while (p < eol && !is_space(*p))
+                    {
+                        p++;
+                    }
+                }
+                chunk->corners += refs >= 3 ? (refs - 2) * 3 : 0;
+                break;
+            }
+            default:
+                break;
+        }
+
+        p = eol + 1;
+    }
+}
+
+/* resolve a 1 based or negative relative index against count seen so far */
+static inline uint32_t
+obj_index(int64_t index, uint32_t seen)
+{
+    if (index > 0)
+    {
+        return (uint32_t)(index - 1);
+    }
+    if (index < 0 && -index <= seen)
+    {
+        return (uint32_t)(seen + index);
+    }
+    throw std::runtime_error("obj: bad face index");
+}
+
+static void
+obj_parse(obj_chunk_t *chunk, obj_mesh_t *mesh)
+{
+    uint32_t position = chunk->positionBase;
+    uint32_t normal = chunk->normalBase;
+    uint64_t *keys = mesh->keys.data() + chunk->cornerBase;
+    chunk->colors = false;
+
+    for (const char *p = chunk->begin; p < chunk->end; )
+    {
+        const char *eol = line_end(p, chunk->end);
+
+        switch (obj_line_type(&p, eol))
+        {
+            case OBJ_POSITION:
+            {
+                float v[6] = {0.0f, 0.0f, 0.0f, -1.0f, -1.0f, -1.0f};
+                int n = 0;
+                for (p = skip_spaces(p, eol); n < 6 && p < eol; p = skip_spaces(p, eol), n++)
+                {
+                    const char *next = parse_float(p, eol, &(v[n]));
+                    if (next == p)
+                    {
+                        break;
+                    }
+                    p = next;
+                }
+                memcpy(&(mesh->positions[position * 3]), v, sizeof(float) * 3);
+                if (n == 6)
+                {
+                    memcpy(&(mesh->colors[position * 3]), v + 3, sizeof(float) * 3);
+                    chunk->colors = true;
+                }
+                position++;
+                break;
+            }
+            case OBJ_NORMAL:
+            {
+                float *v = &(mesh->normals[normal * 3]);
+                for (int n = 0; n < 3; n++)
+                {
+                    p = parse_float(skip_spaces(p, eol), eol, &(v[n]));
+                }
+                normal++;
+                break;
+            }
+            case OBJ_FACE:
+            {
+                uint64_t first = 0;
+                uint64_t prev = 0;
+                uint32_t refs = 0;
+
+                /* v, v/vt, v//vn or v/vt/vn */
+                for (p = skip_spaces(p, eol); p < eol; p = skip_spaces(p, eol))
+                {
+                    int64_t v = 0;
+                    int64_t vn = 0;
+                    const char *next = parse_int(p, eol, &v);
+                    if (next == p)
+                    {
+                        throw std::runtime_error("obj: bad face");
+                    }
+                    p = next;
+                    if (p < eol && *p == '/')
+                    {
+                        int64_t vt;
+                        p = parse_int(p + 1, eol, &vt);
+                        if (p < eol && *p == '/')
+                        {
+                            p = parse_int(p + 1, eol, &vn);
+                        }
+                    }
+                    while (p < eol && !is_space(*p))
+                    {
+                        p++;
+                    }
+
+                    uint64_t key = obj_index(v, position);
+                    key |= (uint64_t)(vn != 0 ? obj_index(vn, normal) : NO_INDEX) << 32;
+
+                    if (refs == 0)
+                    {
+                        first = key;
+                    }
+                    else if (refs >= 2)
+                    {
+                        *keys++ = first;
+                        *keys++ = prev;
+                        *keys++ = key;
+                    }
+                    prev = key;
+                    refs++;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        p = eol + 1;
+    }
+}
+
+static void
+obj_fetch(const void *ctx, uint64_t key, Vertex *out)
+{
+    const obj_mesh_t *mesh = (const obj_mesh_t *)ctx;
+    uint32_t position = (uint32_t)key;
+    uint32_t normal = (uint32_t)(key >> 32);
+
+    if ((size_t)position * 3 >= mesh->positions.size())
+    {
+        throw std::runtime_error("obj: face index out of range");
+    }
+
+    const float *p = &(mesh->positions[position * 3]);
+    out->pos = glm::vec3(p[0], p[1], p[2]);
+
+    if (mesh->hasColors)
+    {
+        const float *c = &(mesh->colors[position * 3]);
+        out->color = glm::vec3(c[0], c[1], c[2]);
+    }
+    else if (normal != NO_INDEX && (size_t)normal * 3 < mesh->normals.size())
+    {
+        const float *n = &(mesh->normals[normal * 3]);
+        out->color = glm::vec3(n[0], n[1], n[2]) * 0.5f + glm::vec3(0.5f);
+    }
+    else
+    {
+        out->color = NO_COLOR;
+    }
+}
+
+static void
+load_obj(handles_t *handles, const mapped_file_t *file, scene_t *scene)
+{
+    /* split at line starts */
+    size_t threads = handles != NULL ? thread_pool_size(handles) : 1;
+    size_t chunkCount = std::max<size_t>(1, std::min(file->size / MIN_OBJ_CHUNK,
+                                                     threads * CHUNKS_PER_THREAD));
+    std::vector<obj_chunk_t> chunks;
+    const char *end = file->data + file->size;
+    const char *p = file->data;
+    for (size_t i = 0; i < chunkCount && p < end; i++)
+    {
+        obj_chunk_t chunk;
+        chunk.begin = p;
+        chunk.end = i + 1 == chunkCount ? end :
+                    std::min(end, line_end(file->data + file->size / chunkCount * (i + 1), end) + 1);
+        chunk.end = std::max(chunk.end, p);
+        chunks.push_back(chunk);
+        p = chunk.end;
+    }
+
+    size_t workers = worker_count(handles, chunks.size());
+    parallel_for(handles, chunks.size(), workers, [&](size_t i, size_t) {
+        obj_count(&(chunks[i]));
+    });
+
+    uint32_t positions = 0;
+    uint32_t normals = 0;
+    size_t corners = 0;
+    for (auto chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+    {
+        chunk->positionBase = positions;
+        chunk->normalBase = normals;
+        chunk->cornerBase = corners;
+        positions += chunk->positions;
+        normals += chunk->normals;
+        corners += chunk->corners;
+    }
+
+    obj_mesh_t mesh;
+    mesh.positions.resize((size_t)positions * 3);
+    mesh.colors.resize((size_t)positions * 3);
+    mesh.normals.resize((size_t)normals * 3);
+    mesh.keys.resize(corners);
+
+    parallel_for(handles, chunks.size(), workers, [&](size_t i, size_t) {
+        obj_parse(&(chunks[i]), &mesh);
+    });
+
+    mesh.hasColors = false;
+    for (auto chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+    {
+        mesh.hasColors |= chunk->colors;
+    }
+
+    size_t perRange = RANGE_TRIANGLES * 3;
+    size_t ranges = (corners + perRange - 1) / perRange;
+    std::vector<batch_t> batches(ranges);
+    std::vector<vertex_map_t> maps(worker_count(handles, ranges));
+    scene->indices.resize(corners);
+
+    parallel_for(handles, ranges, maps.size(), [&](size_t r, size_t worker) {
+        size_t first = std::min(corners, r * perRange);
+        size_t count = std::min(corners - first, perRange);
+        if (maps[worker].keys.empty())
+        {
+            vertex_map_init(&(maps[worker]));
+        }
+        build_batch(mesh.keys.data() + first, count, first, obj_fetch, &mesh,
+                    &(maps[worker]), scene->indices.data(), &(batches[r]));
+    });
+
+    finish_scene(handles, batches, scene);
+}
+
+/*
+ * glTF 2.0
+ *
+ * Primitives are deduplicated in ranges of triangles, by their vertex
+ * index, after the transforms of the nodes referencing them are applied.
+ */
+
+typedef struct gltf_accessor_s
+{
+    const uint8_t *data;
+    size_t count;
+    size_t stride;
+    uint32_t componentType;
+    uint32_t components;
+    bool normalized;
+} gltf_accessor_t;
+
+typedef struct gltf_prim_s
+{
+    gltf_accessor_t position;
+    gltf_accessor_t normal;
+    gltf_accessor_t color;
+    gltf_accessor_t indices;
+    glm::mat4 transform;
+    size_t corners;
+    size_t cornerBase;
+} gltf_prim_t;
+
+typedef struct gltf_range_s
+{
+    const gltf_prim_t *prim;
+    /* corners within the primitive */
+    size_t first;
+    size_t count;
+} gltf_range_t;
+
+typedef struct gltf_doc_s
+{
+    json_value_t json;
+    std::string dir;
+    /* data of each buffer */
+    std::vector<const uint8_t *> buffers;
+    std::vector<size_t> bufferSizes;
+    /* storage of external and embedded buffers */
+    std::vector<mapped_file_t> files;
+    std::vector<std::vector<uint8_t> > decoded;
+    size_t bytes;
+} gltf_doc_t;
+
+static void
+gltf_fail(const char *msg)
+{
+    throw std::runtime_error(std::string("gltf: ") + msg);
+}
+
+static size_t
+component_size(uint32_t componentType)
+{
+    switch (componentType)
+    {
+        case GLTF_UNSIGNED_BYTE:
+            return 1;
+        case GLTF_UNSIGNED_SHORT:
+            return 2;
+        case GLTF_UNSIGNED_INT:
+        case GLTF_FLOAT:
+            return 4;
+    }
+    gltf_fail("unsupported component type");
+    return 0;
+}
+
+static void
+decode_base64(const char *s, std::vector<uint8_t> *out)
+{
+    uint32_t bits = 0;
+    int count = 0;
+
+    for (; *s != '\0' && *s != '='; s++)
+    {
+        const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        const char *c = strchr(alphabet, *s);
+        if (c == NULL)
+        {
+            gltf_fail("bad base64 data");
+        }
+
+        bits = (bits << 6) | (uint32_t)(c - alphabet);
+        count += 6;
+        if (count >= 8)
+        {
+            count -= 8;
+            out->push_back((uint8_t)(bits >> count));
+        }
+    }
+}
+
+static void
+gltf_load_buffers(gltf_doc_t *doc, const uint8_t *glbBin, size_t glbBinSize)
+{
+    const json_value_t *buffers = json_get(&(doc->json), "buffers");
+    size_t count = json_count(buffers);
+
+    doc->files.resize(count);
+    doc->decoded.resize(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const json_value_t *buffer = json_at(buffers, i);
+        const char *uri = json_string(json_get(buffer, "uri"), NULL);
+        size_t length = (size_t)json_number(json_get(buffer, "byteLength"), 0);
+        const uint8_t *data;
+        size_t size;
+
+        if (uri == NULL)
+        {
+            /* the binary chunk of a .glb */
+            if (i != 0 || glbBin == NULL)
+            {
+                gltf_fail("buffer without uri");
+            }
+            data = glbBin;
+            size = glbBinSize;
+        }
+        else if (strncmp(uri, "data:", 5) == 0)
+        {
+            const char *comma = strstr(uri, ";base64,");
+            if (comma == NULL)
+            {
+                gltf_fail("unsupported data uri");
+            }
+            decode_base64(comma + 8, &(doc->decoded[i]));
+            data = doc->decoded[i].data();
+            size = doc->decoded[i].size();
+        }
+        else
+        {
+            map_file(doc->dir + uri, &(doc->files[i]));
+            data = (const uint8_t *)doc->files[i].data;
+            size = doc->files[i].size;
+            doc->bytes += size;
+        }
+
+        if (size < length)
+        {
+            gltf_fail("buffer shorter than its byteLength");
+        }
+        doc->buffers.push_back(data);
+        doc->bufferSizes.push_back(size);
+    }
+}
+
+/* accessor index of a primitive attribute, count 0 if absent */
+static void
+gltf_accessor(const gltf_doc_t *doc, const json_value_t *index, gltf_accessor_t *acc)
+{
+    memset(acc, 0, sizeof(*acc));
+    if (index == NULL)
+    {
+        return;
+    }
+
+    const json_value_t *accessor = json_at(json_get(&(doc->json), "accessors"),
+                                           (size_t)json_number(index, -1));
+    if (accessor == NULL)
+    {
+        gltf_fail("bad accessor index");
+    }
+    if (json_get(accessor, "sparse") != NULL)
+    {
+        gltf_fail("sparse accessors are not supported");
+    }
+
+    const json_value_t *view = json_at(json_get(&(doc->json), "bufferViews"),
+                                       (size_t)json_number(json_get(accessor, "bufferView"), -1));
+    if (view == NULL)
+    {
+        gltf_fail("accessor without buffer view");
+    }
+
+    size_t buffer = (size_t)json_number(json_get(view, "buffer"), -1);
+    if (buffer >= doc->buffers.size())
+    {
+        gltf_fail("bad buffer index");
+    }
+
+    const char *type = json_string(json_get(accessor, "type"), "");
+    acc->components = strcmp(type, "SCALAR") == 0 ? 1 :
+                      strcmp(type, "VEC2") == 0 ? 2 :
+                      strcmp(type, "VEC3") == 0 ? 3 :
+                      strcmp(type, "VEC4") == 0 ? 4 : 0;
+    if (acc->components == 0)
+    {
+        gltf_fail("unsupported accessor type");
+    }
+
+    acc->componentType = (uint32_t)json_number(json_get(accessor, "componentType"), 0);
+    const json_value_t *normalized = json_get(accessor, "normalized");
+    acc->normalized = normalized != NULL && normalized->type == JSON_BOOL &&
+                      normalized->number != 0.0;
+    acc->count = (size_t)json_number(json_get(accessor, "count"), 0);
+
+    size_t elementSize = component_size(acc->componentType) * acc->components;
+    acc->stride = (size_t)json_number(json_get(view, "byteStride"), (double)elementSize);
+
+    size_t offset = (size_t)json_number(json_get(view, "byteOffset"), 0) +
+                    (size_t)json_number(json_get(accessor, "byteOffset"), 0);
+    size_t viewEnd = (size_t)json_number(json_get(view, "byteOffset"), 0) +
+                     (size_t)json_number(json_get(view, "byteLength"), 0);
+
+    if (acc->count > 0 &&
+        (viewEnd > doc->bufferSizes[buffer] ||
+         offset + (acc->count - 1) * acc->stride + elementSize > viewEnd))
+    {
+        gltf_fail("accessor out of bounds");
+    }
+
+    acc->data = doc->buffers[buffer] + offset;
+}
+
+/* component c of element i, normalized integers are mapped to [0, 1] */
+static inline float
+gltf_read(const gltf_accessor_t *acc, size_t i, uint32_t c)
+{
+    const uint8_t *p = acc->data + i * acc->stride;
+
+    switch (acc->componentType)
+    {
+        case GLTF_FLOAT:
+        {
+            float f;
+            memcpy(&f, p + c * 4, 4);
+            return f;
+        }
+        case GLTF_UNSIGNED_BYTE:
+            return acc->normalized ? p[c] / 255.0f : p[c];
+        case GLTF_UNSIGNED_SHORT:
+        {
+            uint16_t s;
+            memcpy(&s, p + c * 2, 2);
+            return acc->normalized ? s / 65535.0f : s;
+        }
+        default:
+        {
+            uint32_t u;
+            memcpy(&u, p + c * 4, 4);
+            return (float)u;
+        }
+    }
+}
+
+static inline uint32_t
+gltf_index(const gltf_accessor_t *acc, size_t i)
+{
+    if (acc->data == NULL)
+    {
+        return (uint32_t)i;
+    }
+
+    const uint8_t *p = acc->data + i * acc->stride;
+    switch (acc->componentType)
+    {
+        case GLTF_UNSIGNED_BYTE:
+            return p[0];
+        case GLTF_UNSIGNED_SHORT:
+        {
+            uint16_t s;
+            memcpy(&s, p, 2);
+            return s;
+        }
+        default:
+        {
+            uint32_t u;
+            memcpy(&u, p, 4);
+            return u;
+        }
+    }
+}
+
+static glm::mat4
+gltf_node_matrix(const json_value_t *node)
+{
+    const json_value_t *matrix = json_get(node, "matrix");
+    if (json_count(matrix) == 16)
+    {
+        glm::mat4 m;
+        for (int i = 0; i < 16; i++)
+        {
+            m[i / 4][i % 4] = (float)json_number(json_at(matrix, i), 0);
+        }
+        return m;
+    }
+
+    const json_value_t *t = json_get(node, "translation");
+    const json_value_t *r = json_get(node, "rotation");
+    const json_value_t *s = json_get(node, "scale");
+
+    glm::mat4 m = glm::translate(glm::mat4(1.0f),
+                                 glm::vec3((float)json_number(json_at(t, 0), 0),
+                                           (float)json_number(json_at(t, 1), 0),
+                                           (float)json_number(json_at(t, 2), 0)));
+
+    /* unit quaternion x, y, z, w */
+    float x = (float)json_number(json_at(r, 0), 0);
+    float y = (float)json_number(json_at(r, 1), 0);
+    float z = (float)json_number(json_at(r, 2), 0);
+    float w = (float)json_number(json_at(r, 3), 1);
+    glm::mat4 rot(1.0f);
+    rot[0][0] = 1 - 2 * (y * y + z * z);
+    rot[0][1] = 2 * (x * y + z * w);
+    rot[0][2] = 2 * (x * z - y * w);
+    rot[1][0] = 2 * (x * y - z * w);
+    rot[1][1] = 1 - 2 * (x * x + z * z);
+    rot[1][2] = 2 * (y * z + x * w);
+    rot[2][0] = 2 * (x * z + y * w);
+    rot[2][1] = 2 * (y * z - x * w);
+    rot[2][2] = 1 - 2 * (x * x + y * y);
+
+    m = m * rot;
+    return glm::scale(m, glm::vec3((float)json_number(json_at(s, 0), 1),
+                                   (float)json_number(json_at(s, 1), 1),
+                                   (float)json_number(json_at(s, 2), 1)));
+}
+
+static void
+gltf_add_mesh(const gltf_doc_t *doc, size_t meshIndex, const glm::mat4& transform,
+              std::vector<gltf_prim_t> *prims)
+{
+    const json_value_t *mesh = json_at(json_get(&(doc->json), "meshes"), meshIndex);
+    const json_value_t *primitives = json_get(mesh, "primitives");
+
+    if (mesh == NULL)
+    {
+        gltf_fail("bad mesh index");
+    }
+
+    for (size_t i = 0; i < json_count(primitives); i++)
+    {
+        const json_value_t *primitive = json_at(primitives, i);
+        const json_value_t *attributes = json_get(primitive, "attributes");
+
+        if (json_number(json_get(primitive, "mode"), GLTF_TRIANGLES) != GLTF_TRIANGLES)
+        {
+            printf("gltf: skipping primitive that is not a triangle list\n");
+            continue;
+        }
+
+        gltf_prim_t prim;
+        gltf_accessor(doc, json_get(attributes, "POSITION"), &(prim.position));
+        gltf_accessor(doc, json_get(attributes, "NORMAL"), &(prim.normal));
+        gltf_accessor(doc, json_get(attributes, "COLOR_0"), &(prim.color));
+        gltf_accessor(doc, json_get(primitive, "indices"), &(prim.indices));
+        prim.transform = transform;
+
+        if (prim.position.count == 0 || prim.position.componentType != GLTF_FLOAT ||
+            prim.position.components != 3)
+        {
+            gltf_fail("primitive without float VEC3 positions");
+        }
+
+        size_t corners = prim.indices.data != NULL ? prim.indices.count : prim.position.count;
+        prim.corners = corners - corners % 3;
+
+        /* indices must stay within the vertex attributes */
+        for (size_t c = 0; c < prim.corners; c++)
+        {
+            uint32_t index = gltf_index(&(prim.indices), c);
+            if (index >= prim.position.count ||
+                (prim.normal.data != NULL && index >= prim.normal.count) ||
+                (prim.color.data != NULL && index >= prim.color.count))
+            {
+                gltf_fail("index out of range");
+            }
+        }
+
+        prims->push_back(prim);
+    }
+}
+
+static void
+gltf_visit(const gltf_doc_t *doc, size_t nodeIndex, const glm::mat4& parent,
+           int depth, std::vector<gltf_prim_t> *prims)
+{
+    const json_value_t *node = json_at(json_get(&(doc->json), "nodes"), nodeIndex);
+    if (node == NULL || depth > 64)
+    {
+        gltf_fail("bad node hierarchy");
+    }
+
+    glm::mat4 transform = parent * gltf_node_matrix(node);
+
+    const json_value_t *mesh = json_get(node, "mesh");
+    if (mesh != NULL)
+    {
+        gltf_add_mesh(doc, (size_t)json_number(mesh, 0), transform, prims);
+    }
+
+    const json_value_t *children = json_get(node, "children");
+    for (size_t i = 0; i < json_count(children); i++)
+    {
+        gltf_visit(doc, (size_t)json_number(json_at(children, i), 0), transform,
+                   depth + 1, prims);
+    }
+}
+
+static void
+gltf_fetch(const void *ctx, uint64_t key, Vertex *out)
+{
+    const gltf_prim_t *prim = (const gltf_prim_t *)ctx;
+    size_t i = (size_t)key;
+
+    glm::vec4 pos(gltf_read(&(prim->position), i, 0),
+                  gltf_read(&(prim->position), i, 1),
+                  gltf_read(&(prim->position), i, 2), 1.0f);
+    pos = prim->transform * pos;
+    out->pos = glm::vec3(pos.x, pos.y, pos.z);
+
+    if (prim->color.data != NULL)
+    {
+        out->color = glm::vec3(gltf_read(&(prim->color), i, 0),
+                               gltf_read(&(prim->color), i, 1),
+                               gltf_read(&(prim->color), i, 2));
+    }
+    else if (prim->normal.data != NULL)
+    {
+        /* fine for rotations and uniform scales */
+        glm::vec4 n(gltf_read(&(prim->normal), i, 0),
+                    gltf_read(&(prim->normal), i, 1),
+                    gltf_read(&(prim->normal), i, 2), 0.0f);
+        n = prim->transform * n;
+        glm::vec3 dir(n.x, n.y, n.z);
+        float len = glm::length(dir);
+        out->color = (len > 0.0f ? dir / len : dir) * 0.5f + glm::vec3(0.5f);
+    }
+    else
+    {
+        out->color = NO_COLOR;
+    }
+}
+
+static void
+load_gltf(handles_t *handles, const mapped_file_t *file, const char *path, scene_t *scene)
+{
+    gltf_doc_t doc;
+    const uint8_t *bin = NULL;
+    size_t binSize = 0;
+
+    const char *slash = strrchr(path, '/');
+    doc.dir = slash != NULL ? std::string(path, slash + 1 - path) : std::string();
+    doc.bytes = file->size;
+
+    uint32_t header[3];
+    if (file->size >= 12)
+    {
+        memcpy(header, file->data, 12);
+    }
+
+    if (file->size >= 12 && header[0] == GLB_MAGIC)
+    {
+        /* header, JSON chunk and optional binary chunk */
+        const uint8_t *p = (const uint8_t *)file->data + 12;
+        const uint8_t *end = (const uint8_t *)file->data + std::min<size_t>(file->size, header[2]);
+        bool haveJson = false;
+
+        while (end - p >= 8)
+        {
+            uint32_t chunk[2];
+            memcpy(chunk, p, 8);
+            p += 8;
+            if ((size_t)(end - p) < chunk[0])
+            {
+                gltf_fail("truncated glb chunk");
+            }
+
+            if (chunk[1] == GLB_CHUNK_JSON && !haveJson)
+            {
+                json_parse((const char *)p, chunk[0], &(doc.json));
+                haveJson = true;
+            }
+            else if (chunk[1] == GLB_CHUNK_BIN && bin == NULL)
+            {
+                bin = p;
+                binSize = chunk[0];
+            }
+            p += (chunk[0] + 3) & ~3u;
+        }
+
+        if (!haveJson)
+        {
+            gltf_fail("glb without JSON chunk");
+        }
+    }
+    else
+    {
+        json_parse(file->data, file->size, &(doc.json));
+    }
+
+    gltf_load_buffers(&doc, bin, binSize);
+
+    /* flatten the node hierarchy of the default scene into primitives */
+    std::vector<gltf_prim_t> prims;
+    const json_value_t *scenes = json_get(&(doc.json), "scenes");
+    const json_value_t *roots = json_get(json_at(scenes, (size_t)json_number(json_get(&(doc.json), "scene"), 0)), "nodes");
+    if (roots != NULL)
+    {
+        for (size_t i = 0; i < json_count(roots); i++)
+        {
+            gltf_visit(&doc, (size_t)json_number(json_at(roots, i), 0), glm::mat4(1.0f), 0, &prims);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < json_count(json_get(&(doc.json), "meshes")); i++)
+        {
+            gltf_add_mesh(&doc, i, glm::mat4(1.0f), &prims);
+        }
+    }
+
+    size_t corners = 0;
+    std::vector<gltf_range_t> ranges;
+    for (auto prim = prims.begin(); prim != prims.end(); ++prim)
+    {
+        prim->cornerBase = corners;
+        corners += prim->corners;
+
+        for (size_t first = 0; first < prim->corners; first += RANGE_TRIANGLES * 3)
+        {
+            gltf_range_t range;
+            range.prim = &(*prim);
+            range.first = first;
+            range.count = std::min<size_t>(prim->corners - first, RANGE_TRIANGLES * 3);
+            ranges.push_back(range);
+        }
+    }
+
+    std::vector<batch_t> batches(ranges.size());
+    std::vector<vertex_map_t> maps(worker_count(handles, ranges.size()));
+    std::vector<std::vector<uint64_t> > keys(maps.size());
+    scene->indices.resize(corners);
+
+    parallel_for(handles, ranges.size(), maps.size(), [&](size_t r, size_t worker) {
+        const gltf_range_t *range = &(ranges[r]);
+        if (maps[worker].keys.empty())
+        {
+            vertex_map_init(&(maps[worker]));
+        }
+
+        keys[worker].resize(range->count);
+        for (size_t c = 0; c < range->count; c++)
+        {
+            keys[worker][c] = gltf_index(&(range->prim->indices), range->first + c);
+        }
+
+        build_batch(keys[worker].data(), range->count,
+                    range->prim->cornerBase + range->first, gltf_fetch, range->prim,
+                    &(maps[worker]), scene->indices.data(), &(batches[r]));
+    });
+
+    finish_scene(handles, batches, scene);
+
+    for (auto f = doc.files.begin(); f != doc.files.end(); ++f)
+    {
+        unmap_file(&(*f));
+    }
+}
+
+static bool
+has_extension(const char *path, const char *ext)
+{
+    size_t len = strlen(path);
+    size_t extLen = strlen(ext);
+    return len >= extLen && strcasecmp(path + len - extLen, ext) == 0;
+}
+
+static scene_t
+parse_file(handles_t *handles, const char *path, size_t *fileSize)
+{
+    if (has_extension(path, ".vkmesh"))
+    {
+        /* already in upload layout, mapping it is all the loading there is */
+        scene_t scene = mesh_cache_load(path, false);
+        *fileSize = mesh_cache_file_size(scene.cache.get());
+        return scene;
+    }
+
+    scene_t scene;
+    mapped_file_t file;
+
+    const char *slash = strrchr(path, '/');
+    scene.name = slash != NULL ? slash + 1 : path;
+
+    map_file(path, &file);
+    try
+    {
+        if (has_extension(path, ".obj"))
+        {
+            load_obj(handles, &file, &scene);
+        }
+        else if (has_extension(path, ".gltf") || has_extension(path, ".glb"))
+        {
+            load_gltf(handles, &file, path, &scene);
+        }
+        else
+        {
+            throw std::runtime_error(std::string("unknown mesh format ") + path);
+        }
+    }
+    catch (...)
+    {
+        unmap_file(&file);
+        throw;
+    }
+
+    *fileSize = file.size;
+    unmap_file(&file);
+
+    return scene;
+}
+
+scene_t
+scene_parse(handles_t *handles, const char *path)
+{
+    size_t fileSize;
+    return parse_file(handles, path, &fileSize);
+}
+
+scene_t
+scene_load(handles_t *handles, const char *path)
+{
+    size_t fileSize;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    scene_t scene = parse_file(handles, path, &fileSize);
+    float seconds = std::chrono::duration<float>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    float mb = fileSize / (1024.0f * 1024.0f);
+    size_t vertexCount, indexCount;
+    scene_vertices(&scene, &vertexCount);
+    VkIndexType indexType;
+    scene_indices(&scene, &indexCount, &indexType);
+    uint32_t triangles = (uint32_t)(indexCount / 3);
+
+    printf("loaded %s: %.1f MB, %u triangles, %zu vertices, %zu draws in %.1f ms\n",
+           scene.name.c_str(), mb, triangles, vertexCount, scene.draws.size(),
+           seconds * 1000.0f);
+    printf("  %.1f MB/s, %.2f Mtriangles/s\n",
+           seconds > 0.0f ? mb / seconds : 0.0f,
+           seconds > 0.0f ? triangles / seconds / 1.0e6f : 0.0f);
+
+    return scene;
+}
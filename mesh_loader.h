@@ -0,0 +1,32 @@
+#pragma once
+
+#include "main.h"
+#include "scene.h"
+
+/*
+ * Triangle mesh loading from Wavefront OBJ and glTF 2.0 files, .gltf with
+ * external or embedded buffers and binary .glb.
+ *
+ * Files are memory mapped and parsed in parallel chunks on the thread
+ * pool, without allocations per token. Vertices are deduplicated with an
+ * open addressing hash map and split into draws of at most 65536 vertices,
+ * so 16 bit indices can address them. The mesh is centered and scaled to
+ * fit the unit sphere.
+ *
+ * Vertex colors come from the file if it has any, else from the normals,
+ * else from the positions.
+ *
+ * .vkmesh files written by mesh_convert are mapped with mesh_cache_load()
+ * instead, without parsing.
+ */
+
+/*
+ * throws std::runtime_error if the file can't be read or parsed, parses
+ * on the calling thread only if handles is NULL
+ */
+scene_t
+scene_load(handles_t *handles, const char *path);
+
+/* scene_load() without printing the load statistics */
+scene_t
+scene_parse(handles_t *handles, const char *path);
@@ -0,0 +1,665 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#include "mesh_lod.h"
+#include "mesh_optimize.h"
+
+/* a level must have at most this fraction of the previous level's triangles */
+#define LOD_MIN_REDUCTION 0.85f
+/* reject collapses that turn a triangle by more than about 80 degrees */
+#define LOD_FLIP_COS 0.2f
+/* a pass collapses edges up to this factor over the cost of its goal */
+#define LOD_PASS_SLACK 1.5
+#define LOD_MAX_PASSES 64
+/* tiles closer than this to a translated copy share its levels */
+#define LOD_SHARE_TOLERANCE 1e-5f
+
+/* area weighted sum of squared distances to planes, a symmetric 4x4 */
+typedef struct quadric_s
+{
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+} quadric_t;
+
+typedef struct collapse_s
+{
+    double cost;
+    uint32_t from;
+    uint32_t to;
+} collapse_t;
+
+/* simplification state of one draw, vertices are indexed locally */
+typedef struct simplify_s
+{
+    const Vertex *vertices;
+    size_t vertexCount;
+    /* lowest used vertex at the same position, collapses work on these */
+    std::vector<uint32_t> canon;
+    /* ring of the used vertices at the same position */
+    std::vector<uint32_t> wedgeNext;
+    std::vector<uint8_t> locked;
+    std::vector<quadric_t> quadrics;
+    /* what each position collapsed into, itself if it is still there */
+    std::vector<uint32_t> collapsed;
+    /* triangles around each position */
+    std::vector<uint32_t> adjOffsets;
+    std::vector<uint32_t> adjacency;
+} simplify_t;
+
+/* the sums cancel out to tiny errors, so they are all in double */
+static void
+quadric_add_plane(quadric_t *q, glm::vec3 normal, double d, double w)
+{
+    double x = normal.x, y = normal.y, z = normal.z;
+
+    q->a00 += w * x * x;
+    q->a01 += w * x * y;
+    q->a02 += w * x * z;
+    q->a11 += w * y * y;
+    q->a12 += w * y * z;
+    q->a22 += w * z * z;
+    q->b0 += w * x * d;
+    q->b1 += w * y * d;
+    q->b2 += w * z * d;
+    q->c += w * d * d;
+    q->weight += w;
+}
+
+static void
+quadric_add(quadric_t *q, const quadric_t *other)
+{
+    q->a00 += other->a00;
+    q->a01 += other->a01;
+    q->a02 += other->a02;
+    q->a11 += other->a11;
+    q->a12 += other->a12;
+    q->a22 += other->a22;
+    q->b0 += other->b0;
+    q->b1 += other->b1;
+    q->b2 += other->b2;
+    q->c += other->c;
+    q->weight += other->weight;
+}
+
+/* mean squared distance of p to the planes of q and r together */
+static double
+quadric_error(const quadric_t *q, const quadric_t *r, glm::vec3 p)
+{
+    quadric_t sum = *q;
+    quadric_add(&sum, r);
+    if (sum.weight <= 0.0)
+    {
+        return 0.0;
+    }
+
+    double x = p.x, y = p.y, z = p.z;
+    double e = sum.a00 * x * x + sum.a11 * y * y + sum.a22 * z * z +
+               2.0 * (sum.a01 * x * y + sum.a02 * x * z + sum.a12 * y * z) +
+               2.0 * (sum.b0 * x + sum.b1 * y + sum.b2 * z) + sum.c;
+
+    return std::max(e, 0.0) / sum.weight;
+}
+
+/* merge the used vertices by position, attributes may differ */
+static void
+simplify_init(simplify_t *s, const Vertex *vertices, size_t vertexCount,
+              const std::vector<uint32_t>& indices)
+{
+    s->vertices = vertices;
+    s->vertexCount = vertexCount;
+    s->canon.assign(vertexCount, 0);
+    s->wedgeNext.assign(vertexCount, 0);
+    s->collapsed.resize(vertexCount);
+
+    std::vector<uint8_t> used(vertexCount, 0);
+    for (auto index = indices.begin(); index != indices.end(); ++index)
+    {
+        used[*index] = 1;
+    }
+
+    std::vector<uint32_t> sorted;
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        if (used[v])
+        {
+            sorted.push_back((uint32_t)v);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [vertices](uint32_t a, uint32_t b) {
+        int order = memcmp(&(vertices[a].pos), &(vertices[b].pos), sizeof(glm::vec3));
+        return order < 0 || (order == 0 && a < b);
+    });
+
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        uint32_t v = sorted[i];
+        bool same = i > 0 && memcmp(&(vertices[v].pos), &(vertices[sorted[i - 1]].pos),
+                                    sizeof(glm::vec3)) == 0;
+        if (same)
+        {
+            uint32_t first = s->canon[sorted[i - 1]];
+            s->canon[v] = first;
+            s->wedgeNext[v] = s->wedgeNext[sorted[i - 1]];
+            s->wedgeNext[sorted[i - 1]] = v;
+        }
+        else
+        {
+            s->canon[v] = v;
+            s->wedgeNext[v] = v;
+        }
+    }
+}
+
+/*
+ * lock the positions on open or non-manifold edges and sum the planes
+ * of the triangles around each position
+ */
+static void
+simplify_level_init(simplify_t *s, const std::vector<uint32_t>& indices)
+{
+    const quadric_t zero = {};
+
+    s->locked.assign(s->vertexCount, 0);
+    s->quadrics.assign(s->vertexCount, zero);
+    for (size_t v = 0; v < s->vertexCount; v++)
+    {
+        s->collapsed[v] = (uint32_t)v;
+    }
+
+    std::vector<uint64_t> edges;
+    edges.reserve(indices.size());
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+        uint32_t c[3];
+        for (int k = 0; k < 3; k++)
+        {
+            c[k] = s->canon[indices[t + k]];
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t a = std::min(c[k], c[(k + 1) % 3]);
+            uint32_t b = std::max(c[k], c[(k + 1) % 3]);
+            edges.push_back((uint64_t)a << 32 | b);
+        }
+
+        glm::vec3 p0 = s->vertices[c[0]].pos;
+        glm::vec3 n = glm::cross(s->vertices[c[1]].pos - p0, s->vertices[c[2]].pos - p0);
+        float length = glm::length(n);
+        if (length == 0.0f)
+        {
+            continue;
+        }
+        n /= length;
+        double d = -((double)n.x * p0.x + (double)n.y * p0.y + (double)n.z * p0.z);
+        for (int k = 0; k < 3; k++)
+        {
+            quadric_add_plane(&(s->quadrics[c[k]]), n, d, length * 0.5);
+        }
+    }
+
+    /* every edge of a closed manifold is shared by exactly two triangles */
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();)
+    {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j] == edges[i])
+        {
+            j++;
+        }
+        if (j - i != 2)
+        {
+            s->locked[edges[i] >> 32] = 1;
+            s->locked[edges[i] & 0xffffffffu] = 1;
+        }
+        i = j;
+    }
+}
+
+static void
+build_adjacency(simplify_t *s, const std::vector<uint32_t>& indices)
+{
+    s->adjOffsets.assign(s->vertexCount + 1, 0);
+    for (auto index = indices.begin(); index != indices.end(); ++index)
+    {
+        s->adjOffsets[s->canon[*index] + 1]++;
+    }
+    for (size_t v = 0; v < s->vertexCount; v++)
+    {
+        s->adjOffsets[v + 1] += s->adjOffsets[v];
+    }
+
+    s->adjacency.resize(indices.size());
+    std::vector<uint32_t> fill(s->adjOffsets.begin(), s->adjOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        s->adjacency[fill[s->canon[indices[i]]]++] = (uint32_t)(i / 3);
+    }
+}
+
+/*
+ * check that moving from onto to flips none of the triangles around from,
+ * counts the triangles the collapse removes
+ */
+static bool
+collapse_ok(const simplify_t *s, const std::vector<uint32_t>& indices,
+            uint32_t from, uint32_t to, size_t *removed)
+{
+    glm::vec3 target = s->vertices[to].pos;
+
+    *removed = 0;
+    for (uint32_t a = s->adjOffsets[from]; a < s->adjOffsets[from + 1]; a++)
+    {
+        const uint32_t *tri = &(indices[s->adjacency[a] * 3]);
+        uint32_t c[3];
+        for (int k = 0; k < 3; k++)
+        {
+            c[k] = s->collapsed[s->canon[tri[k]]];
+        }
+
+        /* gone with an earlier collapse of this pass */
+        if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+        {
+            continue;
+        }
+        if (c[0] == to || c[1] == to || c[2] == to)
+        {
+            (*removed)++;
+            continue;
+        }
+
+        glm::vec3 p[3], q[3];
+        for (int k = 0; k < 3; k++)
+        {
+            p[k] = s->vertices[c[k]].pos;
+            q[k] = c[k] == from ? target : p[k];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        float lengths = glm::length(before) * glm::length(after);
+
+        if (glm::length(before) > 0.0f && glm::dot(before, after) <= LOD_FLIP_COS * lengths)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* the vertex at position to whose color is closest to vertex v's */
+static uint32_t
+nearest_wedge(const simplify_t *s, uint32_t to, uint32_t v)
+{
+    glm::vec3 color = s->vertices[v].color;
+    uint32_t best = to;
+    float bestDistance = glm::dot(s->vertices[to].color - color, s->vertices[to].color - color);
+
+    for (uint32_t w = s->wedgeNext[to]; w != to; w = s->wedgeNext[w])
+    {
+        glm::vec3 d = s->vertices[w].color - color;
+        if (glm::dot(d, d) < bestDistance)
+        {
+            best = w;
+            bestDistance = glm::dot(d, d);
+        }
+    }
+
+    return best;
+}
+
+/*
+ * collapse edges in passes of the cheapest independent ones until at most
+ * target triangles are left or nothing can collapse, returns the largest
+ * distance a collapse moved the surface
+ */
+static float
+simplify(simplify_t *s, std::vector<uint32_t>& indices, size_t target)
+{
+    double worst = 0.0;
+
+    simplify_level_init(s, indices);
+
+    for (int pass = 0; pass < LOD_MAX_PASSES && indices.size() / 3 > target; pass++)
+    {
+        size_t triangleCount = indices.size() / 3;
+        build_adjacency(s, indices);
+
+        /* each edge once, interior edges are in two triangles */
+        std::vector<collapse_t> candidates;
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            uint32_t a = s->canon[indices[i]];
+            uint32_t b = s->canon[indices[i - i % 3 + (i % 3 + 1) % 3]];
+            if (a >= b || (s->locked[a] && s->locked[b]))
+            {
+                continue;
+            }
+
+            const quadric_t *qa = &(s->quadrics[a]);
+            const quadric_t *qb = &(s->quadrics[b]);
+            double ab = s->locked[a] ? HUGE_VAL : quadric_error(qa, qb, s->vertices[b].pos);
+            double ba = s->locked[b] ? HUGE_VAL : quadric_error(qa, qb, s->vertices[a].pos);
+            collapse_t c = ab <= ba ? collapse_t{ab, a, b} : collapse_t{ba, b, a};
+            candidates.push_back(c);
+        }
+        if (candidates.empty())
+        {
+            break;
+        }
+
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const collapse_t& x, const collapse_t& y) { return x.cost < y.cost; });
+
+        /* a collapse removes about two triangles */
+        size_t goal = std::min((triangleCount - target) / 2 + 1, candidates.size());
+        double limit = candidates[goal - 1].cost * LOD_PASS_SLACK;
+
+        std::vector<uint8_t> touched(s->vertexCount, 0);
+        size_t removed = 0;
+        size_t collapses = 0;
+        for (auto c = candidates.begin(); c != candidates.end(); ++c)
+        {
+            if (c->cost > limit || removed >= triangleCount - target)
+            {
+                break;
+            }
+            if (touched[c->from] || touched[c->to])
+            {
+                continue;
+            }
+
+            size_t gone;
+            if (!collapse_ok(s, indices, c->from, c->to, &gone))
+            {
+                continue;
+            }
+
+            s->collapsed[c->from] = c->to;
+            quadric_add(&(s->quadrics[c->to]), &(s->quadrics[c->from]));
+            touched[c->from] = 1;
+            touched[c->to] = 1;
+            removed += gone;
+            collapses++;
+            worst = std::max(worst, c->cost);
+        }
+        if (collapses == 0)
+        {
+            break;
+        }
+
+        /* move the corners to the vertex at the new position, drop degenerates */
+        size_t out = 0;
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            uint32_t tri[3];
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = indices[t + k];
+                uint32_t to = s->collapsed[s->canon[v]];
+                tri[k] = to == s->canon[v] ? v : nearest_wedge(s, to, v);
+            }
+
+            if (s->canon[tri[0]] == s->canon[tri[1]] || s->canon[tri[1]] == s->canon[tri[2]] ||
+                s->canon[tri[0]] == s->canon[tri[2]])
+            {
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                indices[out++] = tri[k];
+            }
+        }
+        indices.resize(out);
+    }
+
+    return (float)sqrt(worst);
+}
+
+/* load a cached scene into its vectors, it gets more indices */
+static void
+materialize(scene_t *scene)
+{
+    if (!scene->cache)
+    {
+        return;
+    }
+
+    size_t vertexCount, indexCount;
+    const Vertex *vertices = scene_vertices(scene, &vertexCount);
+    VkIndexType indexType;
+    const void *indices = scene_indices(scene, &indexCount, &indexType);
+
+    scene->vertices.assign(vertices, vertices + vertexCount);
+    if (indexType == VK_INDEX_TYPE_UINT32)
+    {
+        scene->indices32.assign((const uint32_t *)indices, (const uint32_t *)indices + indexCount);
+    }
+    else
+    {
+        scene->indices.assign((const uint16_t *)indices, (const uint16_t *)indices + indexCount);
+    }
+    scene->cache.reset();
+}
+
+/* the whole triangles of a draw, relative to its vertex offset */
+static void
+draw_indices(const scene_t *scene, const draw_t *draw, std::vector<uint32_t>& out)
+{
+    out.clear();
+    for (uint32_t i = 0; i < draw->indexCount - draw->indexCount % 3; i++)
+    {
+        out.push_back(scene->indices32.empty() ? scene->indices[draw->firstIndex + i] :
+                                                 scene->indices32[draw->firstIndex + i]);
+    }
+}
+
+/* append indices to the scene's index buffer, returns the first one */
+static uint32_t
+append_indices(scene_t *scene, const std::vector<uint32_t>& indices)
+{
+    if (!scene->indices32.empty())
+    {
+        uint32_t first = (uint32_t)scene->indices32.size();
+        scene->indices32.insert(scene->indices32.end(), indices.begin(), indices.end());
+        return first;
+    }
+
+    uint32_t first = (uint32_t)scene->indices.size();
+    scene->indices.insert(scene->indices.end(), indices.begin(), indices.end());
+    return first;
+}
+
+/* true if the vertices of draw b are those of draw a moved as a whole */
+static bool
+translated_copy(const scene_t *scene, const draw_t *a, const draw_t *b,
+                const std::vector<uint32_t>& indices)
+{
+    const Vertex *va = &(scene->vertices[a->vertexOffset]);
+    const Vertex *vb = &(scene->vertices[b->vertexOffset]);
+    glm::vec3 offset = vb[indices[0]].pos - va[indices[0]].pos;
+    float tolerance = LOD_SHARE_TOLERANCE * (1.0f + glm::length(offset));
+
+    for (auto index = indices.begin(); index != indices.end(); ++index)
+    {
+        glm::vec3 d = vb[*index].pos - va[*index].pos - offset;
+        if (fabsf(d.x) > tolerance || fabsf(d.y) > tolerance || fabsf(d.z) > tolerance)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void
+build_chain(scene_t *scene, size_t i, std::vector<uint32_t>& level)
+{
+    const draw_t *draw = &(scene->draws[i]);
+    uint32_t vertexCount = *std::max_element(level.begin(), level.end()) + 1;
+
+    simplify_t s;
+    simplify_init(&s, &(scene->vertices[draw->vertexOffset]), vertexCount, level);
+
+    std::vector<draw_lod_t> lods;
+    lods.push_back({draw->indexCount, draw->firstIndex, 0.0f});
+
+    /* errors of the levels add up, each simplifies the previous one */
+    float error = 0.0f;
+    std::vector<uint32_t> next;
+    while (lods.size() < LOD_MAX_LEVELS && level.size() / 3 >= 2 * LOD_MIN_TRIANGLES)
+    {
+        size_t triangleCount = level.size() / 3;
+
+        next = level;
+        error += simplify(&s, next, triangleCount / 2);
+        if (next.size() / 3 > triangleCount * LOD_MIN_REDUCTION)
+        {
+            break;
+        }
+
+        level.resize(next.size());
+        mesh_optimize_vcache(next.data(), next.size() / 3, vertexCount, level.data());
+        lods.push_back({(uint32_t)level.size(), append_indices(scene, level), error});
+    }
+
+    if (lods.size() > 1)
+    {
+        scene->lods[i].swap(lods);
+    }
+}
+
+void
+scene_build_lods(scene_t *scene)
+{
+    /* instances share a tiny mesh */
+    if (!scene->instances.empty() || !scene->lods.empty())
+    {
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    materialize(scene);
+    size_t indexCount = scene->indices32.empty() ? scene->indices.size() : scene->indices32.size();
+
+    scene->lods.assign(scene->draws.size(), std::vector<draw_lod_t>());
+
+    /* first draw of each index range, tiles of a grid share their indices */
+    std::map<std::pair<uint32_t, uint32_t>, size_t> firstDraw;
+    std::vector<uint32_t> level;
+    size_t shared = 0;
+    for (size_t i = 0; i < scene->draws.size(); i++)
+    {
+        const draw_t *draw = &(scene->draws[i]);
+        if (draw->indexCount / 3 < 2 * LOD_MIN_TRIANGLES)
+        {
+            continue;
+        }
+
+        draw_indices(scene, draw, level);
+
+        auto key = std::make_pair(draw->firstIndex, draw->indexCount);
+        auto first = firstDraw.find(key);
+        if (first == firstDraw.end())
+        {
+            firstDraw[key] = i;
+        }
+        else if (translated_copy(scene, &(scene->draws[first->second]), draw, level))
+        {
+            scene->lods[i] = scene->lods[first->second];
+            shared += scene->lods[i].empty() ? 0 : 1;
+            continue;
+        }
+
+        build_chain(scene, i, level);
+    }
+
+    /* triangles and largest error of each level over all draws */
+    uint64_t triangles[LOD_MAX_LEVELS] = {};
+    float errors[LOD_MAX_LEVELS] = {};
+    size_t levels = 0;
+    size_t draws = 0;
+    for (size_t i = 0; i < scene->lods.size(); i++)
+    {
+        const std::vector<draw_lod_t>& lods = scene->lods[i];
+        for (size_t l = 0; l < lods.size(); l++)
+        {
+            triangles[l] += lods[l].indexCount / 3;
+            errors[l] = std::max(errors[l], lods[l].error);
+        }
+        levels = std::max(levels, lods.size());
+        draws += lods.empty() ? 0 : 1;
+    }
+    if (draws == 0)
+    {
+        scene->lods.clear();
+    }
+
+    size_t added = (scene->indices32.empty() ? scene->indices.size() : scene->indices32.size()) -
+                   indexCount;
+    float ms = std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    printf("built levels of detail for %zu of %zu draws in %.1f ms, %zu shared, +%zu indices\n",
+           draws, scene->draws.size(), ms, shared, added);
+    for (size_t l = 0; l < levels; l++)
+    {
+        printf("  level %zu: %10llu triangles, error %g\n", l,
+               (unsigned long long)triangles[l], errors[l]);
+    }
+}
+
+uint64_t
+lod_select(handles_t *handles, const UniformBufferObject *ubo)
+{
+    /* pixels covered by a world unit at distance 1 */
+    float unitPixels = fabsf(ubo->proj[1][1]) * handles->swapchainExtend.height * 0.5f;
+
+    for (size_t i = 0; i < handles->drawLods.size(); i++)
+    {
+        const std::vector<draw_lod_t>& lods = handles->drawLods[i];
+        if (lods.empty())
+        {
+            continue;
+        }
+
+        glm::mat4 model = ubo->model * handles->objectModels[handles->draws[i].object];
+        glm::mat4 modelView = ubo->view * model;
+
+        /* errors and radii grow with the largest scale of the model matrix */
+        float scale = std::max(glm::length(glm::vec3(model[0])),
+                               std::max(glm::length(glm::vec3(model[1])),
+                                        glm::length(glm::vec3(model[2]))));
+        float pixels = unitPixels * scale;
+
+        /* nearest point of the bounding sphere, full detail from inside */
+        glm::vec4 sphere = handles->drawSpheres[i];
+        glm::vec4 center = modelView * glm::vec4(glm::vec3(sphere), 1.0f);
+        float distance = glm::length(glm::vec3(center)) - sphere.w * scale;
+
+        size_t level = 0;
+        while (distance > 0.0f && level + 1 < lods.size() &&
+               lods[level + 1].error * pixels <= handles->lodPixelError * distance)
+        {
+            level++;
+        }
+
+        handles->draws[i].indexCount = lods[level].indexCount;
+        handles->draws[i].firstIndex = lods[level].firstIndex;
+    }
+
+    uint64_t triangles = 0;
+    for (auto draw = handles->draws.begin(); draw != handles->draws.end(); ++draw)
+    {
+        triangles += draw->indexCount / 3 * draw->instanceCount;
+    }
+
+    return triangles;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "main.h"
+#include "scene.h"
+
+/*
+ * Level of detail chains, built when importing a mesh and picked per
+ * frame by projected screen space error.
+ *
+ * Every level is a quadric error metric simplification (Garland and
+ * Heckbert) of the previous one, collapsing edges onto existing vertices,
+ * so the levels are just more index ranges over the draw's vertices and
+ * are appended to the scene's index buffer. Open borders are kept as they
+ * are, so tiles of a mesh drawn at different levels don't crack apart.
+ */
+
+/* levels per draw, the full detail one included */
+#define LOD_MAX_LEVELS 8
+/* don't simplify draws below this many triangles any further */
+#define LOD_MIN_TRIANGLES 64
+#define DEFAULT_LOD_PIXEL_ERROR 1.0f
+
+/*
+ * build the level of detail chain of every draw, each level halving the
+ * triangles of the previous one until that stops working, prints the
+ * triangles and errors per level
+ */
+void
+scene_build_lods(scene_t *scene);
+
+/*
+ * switch the draws with levels of detail to the coarsest level whose
+ * error projects to at most handles->lodPixelError pixels with ubo's
+ * transforms, returns the triangles of all draws
+ */
+uint64_t
+lod_select(handles_t *handles, const UniformBufferObject *ubo);
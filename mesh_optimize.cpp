@@ -0,0 +1,505 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "mesh_optimize.h"
+
+/* cache the Forsyth scores model, larger than any real FIFO on purpose */
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_LAST_TRI_SCORE 0.75f
+#define FORSYTH_CACHE_DECAY 1.5f
+#define FORSYTH_VALENCE_SCALE 2.0f
+#define FORSYTH_VALENCE_POWER 0.5f
+#define FORSYTH_VALENCE_TABLE 32
+
+/* clusters are at least this many triangles, else sorting them costs cache hits */
+#define OVERDRAW_MIN_CLUSTER 64
+
+/*
+ * neighbouring clusters are grouped into draws of at least this many
+ * triangles, small enough to cull and pick levels of detail for parts of
+ * the mesh, large enough to not be bound by draw calls
+ */
+#define MESH_DRAW_MIN_TRIANGLES 1024
+
+#define NO_TRIANGLE 0xffffffffu
+
+void
+mesh_vcache_stats(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+                  uint32_t cacheSize, mesh_vcache_stats_t *stats)
+{
+    /*
+     * a vertex is in the FIFO if fewer than cacheSize misses happened
+     * since its own, stamps start out of reach
+     */
+    std::vector<uint32_t> stamps(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    size_t misses = 0;
+    size_t used = 0;
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t v = indices[i];
+        if (time - stamps[v] > cacheSize)
+        {
+            used += stamps[v] == 0;
+            stamps[v] = time++;
+            misses++;
+        }
+    }
+
+    size_t triangles = indexCount / 3;
+    stats->acmr = triangles > 0 ? (float)misses / triangles : 0.0f;
+    stats->atvr = used > 0 ? (float)misses / used : 0.0f;
+}
+
+typedef struct forsyth_scores_s
+{
+    float cache[FORSYTH_CACHE_SIZE];
+    float valence[FORSYTH_VALENCE_TABLE];
+} forsyth_scores_t;
+
+static void
+forsyth_init(forsyth_scores_t *scores)
+{
+    for (uint32_t i = 0; i < FORSYTH_CACHE_SIZE; i++)
+    {
+        /* the last triangle's vertices score the same, whatever their order */
+        scores->cache[i] = i < 3 ? FORSYTH_LAST_TRI_SCORE :
+            powf(1.0f - (i - 3) / (float)(FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY);
+    }
+    for (uint32_t i = 0; i < FORSYTH_VALENCE_TABLE; i++)
+    {
+        scores->valence[i] = i == 0 ? 0.0f : FORSYTH_VALENCE_SCALE * powf((float)i, -FORSYTH_VALENCE_POWER);
+    }
+}
+
+/* vertices used by fewer remaining triangles score higher, to finish them off */
+static inline float
+forsyth_score(const forsyth_scores_t *scores, int32_t cachePos, uint32_t valence)
+{
+    if (valence == 0)
+    {
+        return -1.0f;
+    }
+
+    float score = cachePos >= 0 ? scores->cache[cachePos] : 0.0f;
+    return score + (valence < FORSYTH_VALENCE_TABLE ? scores->valence[valence] :
+                    FORSYTH_VALENCE_SCALE * powf((float)valence, -FORSYTH_VALENCE_POWER));
+}
+
+/* greedily emit the highest scoring triangle touching the simulated cache */
+void
+mesh_optimize_vcache(const uint32_t *indices, size_t triangleCount, size_t vertexCount,
+                     uint32_t *out)
+{
+    forsyth_scores_t scores;
+    forsyth_init(&scores);
+
+    /* triangles of each vertex, the first valence[v] of them not emitted yet */
+    std::vector<uint32_t> valence(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        valence[indices[i]]++;
+    }
+
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        offsets[v + 1] = offsets[v] + valence[v];
+    }
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<int32_t> cachePos(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        vertexScores[v] = forsyth_score(&scores, -1, valence[v]);
+    }
+
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    uint32_t best = NO_TRIANGLE;
+    float bestScore = -1.0f;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const uint32_t *tri = indices + t * 3;
+        triangleScores[t] = vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+        if (triangleScores[t] > bestScore)
+        {
+            best = (uint32_t)t;
+            bestScore = triangleScores[t];
+        }
+    }
+
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    size_t cursor = 0;
+
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+        /* nothing left around the cache, continue in input order */
+        if (best == NO_TRIANGLE)
+        {
+            while (emitted[cursor])
+            {
+                cursor++;
+            }
+            best = (uint32_t)cursor;
+        }
+
+        const uint32_t *tri = indices + best * 3;
+        emitted[best] = 1;
+        out[i * 3 + 0] = tri[0];
+        out[i * 3 + 1] = tri[1];
+        out[i * 3 + 2] = tri[2];
+
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = tri[k];
+            uint32_t *adj = &(adjacency[offsets[v]]);
+            uint32_t *last = adj + valence[v] - 1;
+            *std::find(adj, last, best) = *last;
+            valence[v]--;
+        }
+
+        /* the triangle's vertices move to the front */
+        uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+        uint32_t newCount = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if (std::find(newCache, newCache + newCount, tri[k]) == newCache + newCount)
+            {
+                newCache[newCount++] = tri[k];
+            }
+        }
+        for (uint32_t c = 0; c < cacheCount; c++)
+        {
+            if (cache[c] != tri[0] && cache[c] != tri[1] && cache[c] != tri[2])
+            {
+                newCache[newCount++] = cache[c];
+            }
+        }
+
+        /* rescore, including the vertices that just fell out */
+        for (uint32_t c = 0; c < newCount; c++)
+        {
+            uint32_t v = newCache[c];
+            cachePos[v] = c < FORSYTH_CACHE_SIZE ? (int32_t)c : -1;
+            vertexScores[v] = forsyth_score(&scores, cachePos[v], valence[v]);
+        }
+
+        best = NO_TRIANGLE;
+        bestScore = -1.0f;
+        for (uint32_t c = 0; c < newCount; c++)
+        {
+            uint32_t v = newCache[c];
+            for (uint32_t a = offsets[v]; a < offsets[v] + valence[v]; a++)
+            {
+                uint32_t t = adjacency[a];
+                const uint32_t *other = indices + t * 3;
+                triangleScores[t] = vertexScores[other[0]] + vertexScores[other[1]] +
+                                    vertexScores[other[2]];
+                if (triangleScores[t] > bestScore)
+                {
+                    best = t;
+                    bestScore = triangleScores[t];
+                }
+            }
+        }
+
+        cacheCount = std::min<uint32_t>(newCount, FORSYTH_CACHE_SIZE);
+        std::copy(newCache, newCache + cacheCount, cache);
+    }
+}
+
+static inline glm::vec3
+triangle_normal(const Vertex *vertices, const uint32_t *tri)
+{
+    glm::vec3 a = vertices[tri[0]].pos;
+    glm::vec3 b = vertices[tri[1]].pos;
+    glm::vec3 c = vertices[tri[2]].pos;
+    glm::vec3 e1 = b - a;
+    glm::vec3 e2 = c - a;
+
+    /* cross product, length is twice the area */
+    return glm::vec3(e1.y * e2.z - e1.z * e2.y,
+                     e1.z * e2.x - e1.x * e2.z,
+                     e1.x * e2.y - e1.y * e2.x);
+}
+
+/* interleave the low 10 bits of x, y and z */
+static inline uint32_t
+morton3(uint32_t x, uint32_t y, uint32_t z)
+{
+    uint32_t code = 0;
+    for (int bit = 0; bit < 10; bit++)
+    {
+        code |= ((x >> bit) & 1) << (bit * 3) |
+                ((y >> bit) & 1) << (bit * 3 + 1) |
+                ((z >> bit) & 1) << (bit * 3 + 2);
+    }
+    return code;
+}
+
+/*
+ * split at cache restarts, group the clusters by position into draws and
+ * sort the clusters of each draw by how much they face away from the mesh
+ * centroid, returns the number of clusters
+ */
+static size_t
+optimize_overdraw(const uint32_t *indices, size_t triangleCount, const Vertex *vertices,
+                  size_t vertexCount, uint32_t *out, std::vector<draw_t>& draws)
+{
+    std::vector<uint32_t> stamps(vertexCount, 0);
+    uint32_t time = MESH_VCACHE_SIZE + 1;
+    std::vector<size_t> starts;
+
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        uint32_t misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[t * 3 + k];
+            if (time - stamps[v] > MESH_VCACHE_SIZE)
+            {
+                stamps[v] = time++;
+                misses++;
+            }
+        }
+
+        if (t == 0 || (misses == 3 && t - starts.back() >= OVERDRAW_MIN_CLUSTER))
+        {
+            starts.push_back(t);
+        }
+    }
+    starts.push_back(triangleCount);
+
+    size_t clusterCount = starts.size() - 1;
+    std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.0f));
+    std::vector<float> areas(clusterCount, 0.0f);
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        for (size_t t = starts[c]; t < starts[c + 1]; t++)
+        {
+            const uint32_t *tri = indices + t * 3;
+            glm::vec3 normal = triangle_normal(vertices, tri);
+            float area = glm::length(normal);
+            glm::vec3 center = (vertices[tri[0]].pos + vertices[tri[1]].pos +
+                                vertices[tri[2]].pos) * (1.0f / 3.0f);
+
+            centroids[c] += center * area;
+            normals[c] += normal;
+            areas[c] += area;
+        }
+
+        meshCentroid += centroids[c];
+        meshArea += areas[c];
+    }
+    meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+    std::vector<float> keys(clusterCount);
+    glm::vec3 lo(0.0f);
+    glm::vec3 hi(0.0f);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        centroids[c] = areas[c] > 0.0f ? centroids[c] / areas[c] : centroids[c];
+        float len = glm::length(normals[c]);
+        glm::vec3 normal = len > 0.0f ? normals[c] / len : normals[c];
+        keys[c] = glm::dot(centroids[c] - meshCentroid, normal);
+
+        lo = c == 0 ? centroids[c] : glm::min(lo, centroids[c]);
+        hi = c == 0 ? centroids[c] : glm::max(hi, centroids[c]);
+    }
+
+    /* clusters along a Z curve, so consecutive ones are close together */
+    glm::vec3 extent = glm::max(hi - lo, glm::vec3(1e-20f));
+    std::vector<uint32_t> codes(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 cell = (centroids[c] - lo) / extent * 1023.0f;
+        codes[c] = morton3((uint32_t)cell.x, (uint32_t)cell.y, (uint32_t)cell.z);
+    }
+
+    std::vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&codes](size_t a, size_t b) { return codes[a] < codes[b]; });
+
+    const uint32_t *first = out;
+    draws.clear();
+    for (size_t group = 0; group < clusterCount;)
+    {
+        size_t end = group;
+        size_t triangles = 0;
+        while (end < clusterCount && triangles < MESH_DRAW_MIN_TRIANGLES)
+        {
+            triangles += starts[order[end] + 1] - starts[order[end]];
+            end++;
+        }
+
+        /* occluders first within the draw */
+        std::stable_sort(order.begin() + group, order.begin() + end,
+                         [&keys](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+        draw_t draw = {(uint32_t)(triangles * 3), (uint32_t)(out - first), 0, 1, 0, 0};
+        draws.push_back(draw);
+
+        for (size_t c = group; c < end; c++)
+        {
+            out = std::copy(indices + starts[order[c]] * 3, indices + starts[order[c] + 1] * 3, out);
+        }
+        group = end;
+    }
+
+    return clusterCount;
+}
+
+/*
+ * point indices of bitwise identical vertices at the same one, the loader
+ * only merges them within ranges of triangles
+ */
+static void
+weld_vertices(std::vector<uint32_t>& indices, const Vertex *vertices, size_t vertexCount)
+{
+    std::vector<uint32_t> sorted(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        sorted[v] = (uint32_t)v;
+    }
+    std::sort(sorted.begin(), sorted.end(), [vertices](uint32_t a, uint32_t b) {
+        int order = memcmp(&(vertices[a]), &(vertices[b]), sizeof(Vertex));
+        return order < 0 || (order == 0 && a < b);
+    });
+
+    std::vector<uint32_t> remap(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        bool same = i > 0 && memcmp(&(vertices[sorted[i]]), &(vertices[sorted[i - 1]]),
+                                    sizeof(Vertex)) == 0;
+        remap[sorted[i]] = same ? remap[sorted[i - 1]] : sorted[i];
+    }
+
+    for (auto index = indices.begin(); index != indices.end(); ++index)
+    {
+        *index = remap[*index];
+    }
+}
+
+/* renumber vertices in order of first use, dropping unused ones */
+static void
+optimize_fetch(std::vector<uint32_t>& indices, const Vertex *vertices, size_t vertexCount,
+               std::vector<Vertex>& out)
+{
+    std::vector<uint32_t> remap(vertexCount, 0xffffffffu);
+
+    out.clear();
+    for (auto index = indices.begin(); index != indices.end(); ++index)
+    {
+        if (remap[*index] == 0xffffffffu)
+        {
+            remap[*index] = (uint32_t)out.size();
+            out.push_back(vertices[*index]);
+        }
+        *index = remap[*index];
+    }
+}
+
+void
+scene_optimize(scene_t *scene)
+{
+    /* instances share the mesh and are drawn with one call already */
+    if (!scene->instances.empty())
+    {
+        return;
+    }
+    /* triangles of differently placed objects can't share a draw */
+    if (scene->objects.size() > 1)
+    {
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    size_t vertexCount, indexCount;
+    VkIndexType indexType;
+    const Vertex *vertices = scene_vertices(scene, &vertexCount);
+    const void *indices = scene_indices(scene, &indexCount, &indexType);
+
+    /* one list of whole triangles indexing the whole vertex buffer */
+    std::vector<uint32_t> flat;
+    flat.reserve(indexCount);
+    for (auto draw = scene->draws.begin(); draw != scene->draws.end(); ++draw)
+    {
+        for (uint32_t i = 0; i < draw->indexCount - draw->indexCount % 3; i++)
+        {
+            flat.push_back(read_index(indices, indexType, draw->firstIndex + i) + draw->vertexOffset);
+        }
+    }
+    size_t triangleCount = flat.size() / 3;
+
+    mesh_vcache_stats_t before, after;
+    mesh_vcache_stats(flat.data(), flat.size(), vertexCount, MESH_VCACHE_SIZE, &before);
+
+    weld_vertices(flat, vertices, vertexCount);
+
+    std::vector<uint32_t> ordered(flat.size());
+    mesh_optimize_vcache(flat.data(), triangleCount, vertexCount, ordered.data());
+    std::vector<draw_t> draws;
+    size_t clusters = optimize_overdraw(ordered.data(), triangleCount, vertices, vertexCount,
+                                        flat.data(), draws);
+
+    std::vector<Vertex> optimized;
+    optimize_fetch(flat, vertices, vertexCount, optimized);
+
+    mesh_vcache_stats(flat.data(), flat.size(), optimized.size(), MESH_VCACHE_SIZE, &after);
+
+    /* vertices and indices may point into the cache, replace them last */
+    scene->vertices.swap(optimized);
+    scene->indices.clear();
+    scene->indices32.clear();
+    if (scene->vertices.size() <= 65536)
+    {
+        scene->indices.assign(flat.begin(), flat.end());
+    }
+    else
+    {
+        scene->indices32.swap(flat);
+    }
+    scene->cache.reset();
+    scene->lods.clear();
+    scene->draws.swap(draws);
+    /* each draw is culled on its own */
+    scene->spheres.clear();
+    for (size_t i = 0; i < scene->draws.size(); i++)
+    {
+        scene->spheres.push_back(scene_draw_sphere(scene, i));
+    }
+
+    float ms = std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    printf("optimized %zu triangles in %.1f ms, %zu clusters in %zu draws, %s indices\n",
+           triangleCount, ms, clusters, scene->draws.size(),
+           scene->indices32.empty() ? "16 bit" : "32 bit");
+    printf("  vertex cache (FIFO %u): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+           MESH_VCACHE_SIZE, before.acmr, after.acmr, before.atvr, after.atvr);
+    printf("  vertex shader invocations %.0f -> %.0f\n",
+           before.acmr * triangleCount, after.acmr * triangleCount);
+}
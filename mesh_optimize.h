@@ -0,0 +1,50 @@
+#pragma once
+
+#include "main.h"
+#include "scene.h"
+
+/*
+ * Offline index and vertex order optimization, run when importing a mesh.
+ *
+ * Triangles are reordered for the post-transform vertex cache with Tom
+ * Forsyth's linear-speed algorithm, then split into clusters wherever the
+ * cache restarts. Neighbouring clusters are grouped into draws, so parts
+ * of the mesh can be culled and simplified on their own, and the clusters
+ * of a draw sorted so that the ones facing away from the mesh center come
+ * first and occlude the rest (Sander et al.).
+ * Finally vertices are renumbered in order of first use, so vertex
+ * fetches walk the vertex buffer front to back.
+ */
+
+/* simulated FIFO post-transform cache, see mesh_vcache_stats() */
+#define MESH_VCACHE_SIZE 16
+
+typedef struct mesh_vcache_stats_s
+{
+    /* vertex shader invocations per triangle, 0.5 to 3 */
+    float acmr;
+    /* vertex shader invocations per vertex, 1 is optimal */
+    float atvr;
+} mesh_vcache_stats_t;
+
+void
+mesh_vcache_stats(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+                  uint32_t cacheSize, mesh_vcache_stats_t *stats);
+
+/*
+ * reorder triangleCount triangles for the vertex cache into out, indices
+ * must be below vertexCount
+ */
+void
+mesh_optimize_vcache(const uint32_t *indices, size_t triangleCount, size_t vertexCount,
+                     uint32_t *out);
+
+/*
+ * optimize the scene's triangles as one mesh, replacing its draws with
+ * draws of neighbouring clusters and their bounding spheres, with 16 bit
+ * indices if there are at most 65536 vertices, 32 bit otherwise, prints
+ * the cache statistics before and after, levels of detail are dropped,
+ * build them afterwards
+ */
+void
+scene_optimize(scene_t *scene);
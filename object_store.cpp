@@ -0,0 +1,484 @@
+#include <math.h>
+
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "object_store.h"
+#include "thread_pool.h"
+
+/* SSE2 is part of x86-64, AVX2 is picked at runtime */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define STORE_X86 1
+#include <immintrin.h>
+#else
+#define STORE_X86 0
+#endif
+
+/* below this many objects per slice, handing work to a thread costs more than it saves */
+#define MIN_OBJECTS_PER_SLICE 8192
+
+#define STORE_PI 3.14159265358979f
+#define STORE_HALF_PI 1.57079632679490f
+#define STORE_TWO_PI 6.28318530717959f
+
+void
+object_store_init(object_store_t *store)
+{
+    store->simd = store_best_simd();
+}
+
+uint32_t
+object_store_add(object_store_t *store, glm::vec3 pos, float angle, float spin,
+                 float scale, float radius, glm::vec3 color)
+{
+    store->posX.push_back(pos.x);
+    store->posY.push_back(pos.y);
+    store->posZ.push_back(pos.z);
+    store->angle.push_back(angle - STORE_TWO_PI * roundf(angle / STORE_TWO_PI));
+    store->spin.push_back(spin);
+    store->scale.push_back(scale);
+    store->radius.push_back(radius);
+    store->color.push_back(color);
+    store->model.push_back(glm::mat4(1.0f));
+    store->visible.push_back(1);
+
+    return (uint32_t)store->posX.size() - 1;
+}
+
+uint32_t
+object_store_size(const object_store_t *store)
+{
+    return (uint32_t)store->posX.size();
+}
+
+store_simd_t
+store_best_simd()
+{
+#if STORE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return STORE_AVX2;
+    }
+    return STORE_SSE;
+#else
+    return STORE_SCALAR;
+#endif
+}
+
+const char *
+store_simd_name(store_simd_t simd)
+{
+    switch (simd)
+    {
+        case STORE_SCALAR:
+            return "scalar";
+        case STORE_SSE:
+            return "sse";
+        case STORE_AVX2:
+            return "avx2";
+    }
+    return "?";
+}
+
+/* the six planes of the clip volume in world space, normalized */
+static void
+frustum_planes(const glm::mat4& m, glm::vec4 planes[6])
+{
+    glm::vec4 r0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 r1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 r2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 r3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    /* -w <= x <= w, -w <= y <= w, 0 <= z <= w */
+    planes[0] = r3 + r0;
+    planes[1] = r3 - r0;
+    planes[2] = r3 + r1;
+    planes[3] = r3 - r1;
+    planes[4] = r2;
+    planes[5] = r3 - r2;
+
+    for (int i = 0; i < 6; i++)
+    {
+        planes[i] = planes[i] / glm::length(glm::vec3(planes[i].x, planes[i].y, planes[i].z));
+    }
+}
+
+/*
+ * scalar kernels, process objects [first, last)
+ */
+
+static void
+update_scalar(object_store_t *store, size_t first, size_t last, float dt)
+{
+    for (size_t i = first; i < last; i++)
+    {
+        float a = store->angle[i] + store->spin[i] * dt;
+        a -= STORE_TWO_PI * roundf(a / STORE_TWO_PI);
+        store->angle[i] = a;
+
+        glm::mat4 m = glm::translate(glm::mat4(1.0f),
+                                     glm::vec3(store->posX[i], store->posY[i], store->posZ[i]));
+        m = glm::rotate(m, a, glm::vec3(0.0f, 0.0f, 1.0f));
+        store->model[i] = glm::scale(m, glm::vec3(store->scale[i]));
+    }
+}
+
+static uint32_t
+cull_scalar(object_store_t *store, size_t first, size_t last, const glm::vec4 planes[6])
+{
+    uint32_t count = 0;
+
+    for (size_t i = first; i < last; i++)
+    {
+        glm::vec4 center(store->posX[i], store->posY[i], store->posZ[i], 1.0f);
+        float r = store->radius[i] * store->scale[i];
+        bool vis = true;
+
+        for (int p = 0; p < 6 && vis; p++)
+        {
+            vis = glm::dot(planes[p], center) >= -r;
+        }
+
+        store->visible[i] = vis ? 1 : 0;
+        count += vis ? 1 : 0;
+    }
+
+    return count;
+}
+
+#if STORE_X86
+
+/*
+ * SSE kernels, 4 objects per iteration, the remainder goes to the
+ * scalar kernels
+ */
+
+static inline __m128
+select_ps(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/* wrap x to [-pi, pi] */
+static inline __m128
+wrap_angle_ps(__m128 x)
+{
+    __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.0f / STORE_TWO_PI))));
+    return _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(STORE_TWO_PI)));
+}
+
+/* sin of x in [-pi, pi], folded to [-pi/2, pi/2] for the Taylor series to x^11 */
+static inline __m128
+sin_ps(__m128 x)
+{
+    __m128 pi = _mm_set1_ps(STORE_PI);
+    x = select_ps(_mm_cmpgt_ps(x, _mm_set1_ps(STORE_HALF_PI)), _mm_sub_ps(pi, x), x);
+    x = select_ps(_mm_cmplt_ps(x, _mm_set1_ps(-STORE_HALF_PI)), _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), pi), x), x);
+
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 p = _mm_set1_ps(-2.5052108e-8f);
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(2.7557319e-6f));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.9841270e-4f));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(8.3333333e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.6666667e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+
+    return _mm_mul_ps(x, p);
+}
+
+/* cos(x) = sin(x + pi/2), rewrapped to [-pi, pi] */
+static inline __m128
+cos_ps(__m128 x)
+{
+    x = _mm_add_ps(x, _mm_set1_ps(STORE_HALF_PI));
+    x = select_ps(_mm_cmpgt_ps(x, _mm_set1_ps(STORE_PI)), _mm_sub_ps(x, _mm_set1_ps(STORE_TWO_PI)), x);
+    return sin_ps(x);
+}
+
+/*
+ * write the model matrices of 4 objects, rows hold one matrix element of
+ * each object and are transposed to columns
+ */
+static inline void
+store_matrices_ps(glm::mat4 *model, __m128 cs, __m128 ss, __m128 s,
+                  __m128 px, __m128 py, __m128 pz)
+{
+    __m128 zero = _mm_setzero_ps();
+    __m128 cols[4][4] =
+    {
+        {cs, ss, zero, zero},
+        {_mm_sub_ps(zero, ss), cs, zero, zero},
+        {zero, zero, s, zero},
+        {px, py, pz, _mm_set1_ps(1.0f)},
+    };
+
+    for (int c = 0; c < 4; c++)
+    {
+        _MM_TRANSPOSE4_PS(cols[c][0], cols[c][1], cols[c][2], cols[c][3]);
+        for (int obj = 0; obj < 4; obj++)
+        {
+            _mm_storeu_ps(&(model[obj][c][0]), cols[c][obj]);
+        }
+    }
+}
+
+static void
+update_sse(object_store_t *store, size_t first, size_t last, float dt)
+{
+    size_t i = first;
+    __m128 vdt = _mm_set1_ps(dt);
+
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(&(store->angle[i])),
+                              _mm_mul_ps(_mm_loadu_ps(&(store->spin[i])), vdt));
+        a = wrap_angle_ps(a);
+        _mm_storeu_ps(&(store->angle[i]), a);
+
+        __m128 s = _mm_loadu_ps(&(store->scale[i]));
+        store_matrices_ps(&(store->model[i]),
+                          _mm_mul_ps(cos_ps(a), s), _mm_mul_ps(sin_ps(a), s), s,
+                          _mm_loadu_ps(&(store->posX[i])),
+                          _mm_loadu_ps(&(store->posY[i])),
+                          _mm_loadu_ps(&(store->posZ[i])));
+    }
+
+    update_scalar(store, i, last, dt);
+}
+
+static uint32_t
+cull_sse(object_store_t *store, size_t first, size_t last, const glm::vec4 planes[6])
+{
+    size_t i = first;
+    uint32_t count = 0;
+
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&(store->posX[i]));
+        __m128 y = _mm_loadu_ps(&(store->posY[i]));
+        __m128 z = _mm_loadu_ps(&(store->posZ[i]));
+        __m128 negR = _mm_sub_ps(_mm_setzero_ps(),
+                                 _mm_mul_ps(_mm_loadu_ps(&(store->radius[i])),
+                                            _mm_loadu_ps(&(store->scale[i]))));
+        __m128 vis = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), x),
+                                  _mm_set1_ps(planes[p].w));
+            d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].y), y), d);
+            d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), z), d);
+            vis = _mm_and_ps(vis, _mm_cmpge_ps(d, negR));
+        }
+
+        int mask = _mm_movemask_ps(vis);
+        for (int obj = 0; obj < 4; obj++)
+        {
+            store->visible[i + obj] = (mask >> obj) & 1;
+        }
+        count += __builtin_popcount(mask);
+    }
+
+    return count + cull_scalar(store, i, last, planes);
+}
+
+/*
+ * AVX2 kernels, 8 objects per iteration
+ */
+
+#define STORE_AVX2_TARGET __attribute__((target("avx2,fma")))
+
+static inline STORE_AVX2_TARGET __m256
+select_ps256(__m256 mask, __m256 a, __m256 b)
+{
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+static inline STORE_AVX2_TARGET __m256
+sin_ps256(__m256 x)
+{
+    __m256 pi = _mm256_set1_ps(STORE_PI);
+    x = select_ps256(_mm256_cmp_ps(x, _mm256_set1_ps(STORE_HALF_PI), _CMP_GT_OQ),
+                     _mm256_sub_ps(pi, x), x);
+    x = select_ps256(_mm256_cmp_ps(x, _mm256_set1_ps(-STORE_HALF_PI), _CMP_LT_OQ),
+                     _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), pi), x), x);
+
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_set1_ps(-2.5052108e-8f);
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(2.7557319e-6f));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(-1.9841270e-4f));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(8.3333333e-3f));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(-1.6666667e-1f));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(1.0f));
+
+    return _mm256_mul_ps(x, p);
+}
+
+static inline STORE_AVX2_TARGET __m256
+cos_ps256(__m256 x)
+{
+    x = _mm256_add_ps(x, _mm256_set1_ps(STORE_HALF_PI));
+    x = select_ps256(_mm256_cmp_ps(x, _mm256_set1_ps(STORE_PI), _CMP_GT_OQ),
+                     _mm256_sub_ps(x, _mm256_set1_ps(STORE_TWO_PI)), x);
+    return sin_ps256(x);
+}
+
+static STORE_AVX2_TARGET void
+update_avx2(object_store_t *store, size_t first, size_t last, float dt)
+{
+    size_t i = first;
+    __m256 vdt = _mm256_set1_ps(dt);
+
+    for (; i + 8 <= last; i += 8)
+    {
+        __m256 a = _mm256_fmadd_ps(_mm256_loadu_ps(&(store->spin[i])), vdt,
+                                   _mm256_loadu_ps(&(store->angle[i])));
+        __m256 turns = _mm256_round_ps(_mm256_mul_ps(a, _mm256_set1_ps(1.0f / STORE_TWO_PI)),
+                                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        a = _mm256_fnmadd_ps(turns, _mm256_set1_ps(STORE_TWO_PI), a);
+        _mm256_storeu_ps(&(store->angle[i]), a);
+
+        __m256 s = _mm256_loadu_ps(&(store->scale[i]));
+        __m256 cs = _mm256_mul_ps(cos_ps256(a), s);
+        __m256 ss = _mm256_mul_ps(sin_ps256(a), s);
+        __m256 px = _mm256_loadu_ps(&(store->posX[i]));
+        __m256 py = _mm256_loadu_ps(&(store->posY[i]));
+        __m256 pz = _mm256_loadu_ps(&(store->posZ[i]));
+
+        /* the transposes and stores are done 4 wide, one half at a time */
+        store_matrices_ps(&(store->model[i]),
+                          _mm256_castps256_ps128(cs), _mm256_castps256_ps128(ss),
+                          _mm256_castps256_ps128(s), _mm256_castps256_ps128(px),
+                          _mm256_castps256_ps128(py), _mm256_castps256_ps128(pz));
+        store_matrices_ps(&(store->model[i + 4]),
+                          _mm256_extractf128_ps(cs, 1), _mm256_extractf128_ps(ss, 1),
+                          _mm256_extractf128_ps(s, 1), _mm256_extractf128_ps(px, 1),
+                          _mm256_extractf128_ps(py, 1), _mm256_extractf128_ps(pz, 1));
+    }
+
+    update_scalar(store, i, last, dt);
+}
+
+static STORE_AVX2_TARGET uint32_t
+cull_avx2(object_store_t *store, size_t first, size_t last, const glm::vec4 planes[6])
+{
+    size_t i = first;
+    uint32_t count = 0;
+
+    for (; i + 8 <= last; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&(store->posX[i]));
+        __m256 y = _mm256_loadu_ps(&(store->posY[i]));
+        __m256 z = _mm256_loadu_ps(&(store->posZ[i]));
+        __m256 negR = _mm256_sub_ps(_mm256_setzero_ps(),
+                                    _mm256_mul_ps(_mm256_loadu_ps(&(store->radius[i])),
+                                                  _mm256_loadu_ps(&(store->scale[i]))));
+        __m256 vis = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (int p = 0; p < 6; p++)
+        {
+            __m256 d = _mm256_fmadd_ps(_mm256_set1_ps(planes[p].x), x, _mm256_set1_ps(planes[p].w));
+            d = _mm256_fmadd_ps(_mm256_set1_ps(planes[p].y), y, d);
+            d = _mm256_fmadd_ps(_mm256_set1_ps(planes[p].z), z, d);
+            vis = _mm256_and_ps(vis, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(vis);
+        for (int obj = 0; obj < 8; obj++)
+        {
+            store->visible[i + obj] = (mask >> obj) & 1;
+        }
+        count += __builtin_popcount(mask);
+    }
+
+    return count + cull_scalar(store, i, last, planes);
+}
+
+#endif /* STORE_X86 */
+
+/*
+ * run fn over [0, count) in slices, slices 1..n on the thread pool and
+ * the first one on the calling thread, returns the sum of the results
+ */
+static uint32_t
+run_sliced(handles_t *handles, size_t count,
+           const std::function<uint32_t(size_t, size_t)>& fn)
+{
+    size_t slices = 1;
+    if (handles != NULL)
+    {
+        slices = std::max<size_t>(1, std::min<size_t>(count / MIN_OBJECTS_PER_SLICE,
+                                                      thread_pool_size(handles)));
+    }
+
+    /* multiple of 8, so only the last slice has a scalar remainder */
+    size_t perSlice = ((count + slices - 1) / slices + 7) & ~(size_t)7;
+
+    std::vector<uint32_t> results(slices, 0);
+    std::vector<std::future<void> > jobs;
+    for (size_t s = 1; s < slices; s++)
+    {
+        size_t first = std::min(count, s * perSlice);
+        size_t last = std::min(count, first + perSlice);
+        uint32_t *result = &(results[s]);
+
+        jobs.push_back(thread_pool_run(handles, [&fn, first, last, result] {
+            *result = fn(first, last);
+        }));
+    }
+    results[0] = fn(0, std::min(count, perSlice));
+
+    uint32_t sum = results[0];
+    for (size_t s = 1; s < slices; s++)
+    {
+        jobs[s - 1].get();
+        sum += results[s];
+    }
+
+    return sum;
+}
+
+void
+object_store_update(handles_t *handles, object_store_t *store, float dt)
+{
+    run_sliced(handles, object_store_size(store), [store, dt](size_t first, size_t last) {
+        switch (store->simd)
+        {
+#if STORE_X86
+            case STORE_AVX2:
+                update_avx2(store, first, last, dt);
+                break;
+            case STORE_SSE:
+                update_sse(store, first, last, dt);
+                break;
+#endif
+            default:
+                update_scalar(store, first, last, dt);
+                break;
+        }
+        return 0u;
+    });
+}
+
+uint32_t
+object_store_cull(handles_t *handles, object_store_t *store, const glm::mat4& viewProj)
+{
+    glm::vec4 planes[6];
+    frustum_planes(viewProj, planes);
+
+    return run_sliced(handles, object_store_size(store), [store, &planes](size_t first, size_t last) {
+        switch (store->simd)
+        {
+#if STORE_X86
+            case STORE_AVX2:
+                return cull_avx2(store, first, last, planes);
+            case STORE_SSE:
+                return cull_sse(store, first, last, planes);
+#endif
+            default:
+                return cull_scalar(store, first, last, planes);
+        }
+    });
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Scene objects in structure of arrays layout, so that the per frame
+ * transform update and frustum culling stream through contiguous floats,
+ * 4 (SSE) or 8 (AVX2) objects at a time, sliced over the thread pool.
+ *
+ * Every object has a position, a rotation around z advanced by its spin
+ * on each update, a uniform scale and a bounding sphere of radius * scale
+ * centered on its position.
+ */
+
+typedef enum
+{
+    /* glm, one object at a time */
+    STORE_SCALAR,
+    STORE_SSE,
+    STORE_AVX2,
+} store_simd_t;
+
+typedef struct object_store_s
+{
+    std::vector<float> posX;
+    std::vector<float> posY;
+    std::vector<float> posZ;
+    /* radians, kept within [-pi, pi] */
+    std::vector<float> angle;
+    /* radians per second */
+    std::vector<float> spin;
+    std::vector<float> scale;
+    std::vector<float> radius;
+    /* not touched by the kernels */
+    std::vector<glm::vec3> color;
+
+    /* written by object_store_update() */
+    std::vector<glm::mat4> model;
+    /* written by object_store_cull(), 1 if the object may be visible */
+    std::vector<uint8_t> visible;
+
+    /* kernels to use, the best the CPU supports after object_store_init() */
+    store_simd_t simd;
+} object_store_t;
+
+void
+object_store_init(object_store_t *store);
+
+/* returns the index of the new object */
+uint32_t
+object_store_add(object_store_t *store, glm::vec3 pos, float angle, float spin,
+                 float scale, float radius, glm::vec3 color);
+
+uint32_t
+object_store_size(const object_store_t *store);
+
+store_simd_t
+store_best_simd();
+
+const char *
+store_simd_name(store_simd_t simd);
+
+/*
+ * advance rotations by dt seconds and rebuild the model matrices, runs
+ * on the calling thread only if handles is NULL
+ */
+void
+object_store_update(handles_t *handles, object_store_t *store, float dt);
+
+/*
+ * test bounding spheres against the frustum planes of viewProj, returns
+ * the number of visible objects, handles may be NULL as for update
+ */
+uint32_t
+object_store_cull(handles_t *handles, object_store_t *store, const glm::mat4& viewProj);
@@ -0,0 +1,78 @@
+#include "offscreen.h"
+#include "utils.h"
+
+void
+create_offscreen_images(handles_t *handles, uint32_t count)
+{
+    handles->swapChainImages.resize(count);
+    handles->swapChainImageViews.resize(count);
+    handles->offscreenImageAllocs.resize(count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = FRAME_BUF_FORMAT;
+        imageInfo.extent.width = handles->swapchainExtend.width;
+        imageInfo.extent.height = handles->swapchainExtend.height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        /* transfer source, so that rendered frames can be read back */
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                          VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        check_res(
+            vkCreateImage(handles->device, &imageInfo, NULL,
+                          &(handles->swapChainImages[i])),
+            "vkCreateImage offscreen");
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(handles->device, handles->swapChainImages[i], &memRequirements);
+
+        gpu_allocation_t& alloc = handles->offscreenImageAllocs[i];
+        alloc = gpu_alloc(handles, memRequirements,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false);
+
+        check_res(
+            vkBindImageMemory(handles->device, handles->swapChainImages[i],
+                              alloc.memory, alloc.offset),
+            "vkBindImageMemory offscreen");
+
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = handles->swapChainImages[i];
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = FRAME_BUF_FORMAT;
+        viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        check_res(
+            vkCreateImageView(handles->device, &viewInfo, NULL,
+                              &(handles->swapChainImageViews[i])),
+            "vkCreateImageView offscreen");
+    }
+}
+
+void
+cleanup_offscreen_images(handles_t *handles)
+{
+    for (size_t i = 0; i < handles->swapChainImages.size(); i++)
+    {
+        vkDestroyImageView(handles->device, handles->swapChainImageViews[i], NULL);
+        vkDestroyImage(handles->device, handles->swapChainImages[i], NULL);
+        gpu_free(handles, &(handles->offscreenImageAllocs[i]));
+    }
+}
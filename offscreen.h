@@ -0,0 +1,18 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Headless rendering targets, a ring of device local color images used
+ * in place of swapchain images when running without a window.
+ *
+ * The images and views are stored in handles->swapChainImages and
+ * handles->swapChainImageViews, so framebuffers and command buffers are
+ * created the same way as for the swapchain.
+ */
+
+void
+create_offscreen_images(handles_t *handles, uint32_t count);
+
+void
+cleanup_offscreen_images(handles_t *handles);
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+
+#include "pipeline_cache.h"
+#include "utils.h"
+
+/* don't let a misbehaving driver fill the disk */
+#define PIPELINE_CACHE_MAX_SIZE (32 * 1024 * 1024)
+
+/* headerSize, headerVersion, vendorID, deviceID and pipelineCacheUUID */
+#define PIPELINE_CACHE_HEADER_SIZE (16 + VK_UUID_SIZE)
+
+static std::string cachePath;
+
+/* header fields are stored least significant byte first */
+static uint32_t
+read_u32(const char *data)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * check that the blob was created by this driver for this device,
+ * drivers are supposed to reject foreign data but not all of them do
+ */
+static bool
+is_cache_valid(handles_t *handles, const std::vector<char>& data)
+{
+    if (data.size() < PIPELINE_CACHE_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(handles->phyDevice, &props);
+
+    uint32_t headerSize = read_u32(&data[0]);
+    uint32_t headerVersion = read_u32(&data[4]);
+    uint32_t vendorID = read_u32(&data[8]);
+    uint32_t deviceID = read_u32(&data[12]);
+
+    return headerSize >= PIPELINE_CACHE_HEADER_SIZE &&
+           headerSize <= data.size() &&
+           headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           vendorID == props.vendorID &&
+           deviceID == props.deviceID &&
+           memcmp(&data[16], props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void
+pipeline_cache_load(handles_t *handles, const char *path)
+{
+    std::vector<char> data;
+
+    cachePath = path;
+    handles->pipelineCacheWarm = false;
+
+    try
+    {
+        data = read_file(cachePath);
+    }
+    catch (const std::runtime_error&)
+    {
+        /* no cache yet */
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+    if (is_cache_valid(handles, data))
+    {
+        cacheInfo.initialDataSize = data.size();
+        cacheInfo.pInitialData = data.data();
+        handles->pipelineCacheWarm = true;
+    }
+    else if (!data.empty())
+    {
+        printf("ignoring stale pipeline cache %s\n", path);
+    }
+
+    check_res(
+        vkCreatePipelineCache(handles->device, &cacheInfo, NULL, &(handles->pipelineCache)),
+        "vkCreatePipelineCache");
+}
+
+void
+pipeline_cache_save(handles_t *handles)
+{
+    size_t size = 0;
+    std::vector<char> data;
+
+    check_res(
+        vkGetPipelineCacheData(handles->device, handles->pipelineCache, &size, NULL),
+        "vkGetPipelineCacheData size");
+
+    if (size > PIPELINE_CACHE_MAX_SIZE)
+    {
+        printf("pipeline cache too large (%zu bytes), not saving\n", size);
+    }
+    else if (size > 0)
+    {
+        data.resize(size);
+        check_res(
+            vkGetPipelineCacheData(handles->device, handles->pipelineCache, &size, data.data()),
+            "vkGetPipelineCacheData");
+
+        /*
+         * write to a temporary file and rename it over the old cache, so that
+         * a crash half way never leaves a truncated cache behind
+         */
+        std::string tmpPath = cachePath + ".tmp";
+        FILE *f = fopen(tmpPath.c_str(), "wb");
+        if (f == NULL)
+        {
+            printf("can't write pipeline cache %s\n", tmpPath.c_str());
+        }
+        else
+        {
+            bool ok = fwrite(data.data(), 1, size, f) == size;
+            ok = fflush(f) == 0 && ok;
+            ok = fsync(fileno(f)) == 0 && ok;
+            ok = fclose(f) == 0 && ok;
+
+            if (ok && rename(tmpPath.c_str(), cachePath.c_str()) == 0)
+            {
+                printf("saved %zu bytes pipeline cache to %s\n", size, cachePath.c_str());
+            }
+            else
+            {
+                printf("failed to save pipeline cache %s\n", cachePath.c_str());
+                remove(tmpPath.c_str());
+            }
+        }
+    }
+
+    vkDestroyPipelineCache(handles->device, handles->pipelineCache, NULL);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Create handles->pipelineCache, seeded from the cache file at path if
+ * it exists and was written by the same driver and device.
+ */
+void
+pipeline_cache_load(handles_t *handles, const char *path);
+
+/*
+ * Write the cache back to the file it was loaded from, replacing it
+ * atomically, and destroy handles->pipelineCache.
+ */
+void
+pipeline_cache_save(handles_t *handles);
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "pipelines.h"
+#include "gfx_pipeline.h"
+#include "shaders.h"
+#include "thread_pool.h"
+
+typedef struct variant_s
+{
+    pipeline_key_t key;
+    /* VK_NULL_HANDLE until the build job is done */
+    VkPipeline pipeline;
+    /* created again after a shader change, not swapped in yet */
+    VkPipeline replacement;
+    std::shared_future<void> build;
+} variant_t;
+
+/* a replaced pipeline, destroyed when no frame in flight uses it */
+typedef struct retired_pipeline_s
+{
+    VkPipeline pipeline;
+    uint64_t frame;
+} retired_pipeline_t;
+
+struct pipelines_s
+{
+    /* guards the pipelines of the variants and the map */
+    std::mutex lock;
+    /* serialized key -> variant, variants never move */
+    std::unordered_map<std::string, variant_t *> variants;
+
+    /* creation time of the requested variants, summed over the builds */
+    float buildMs;
+
+    /* render thread only */
+    uint64_t frame;
+    std::vector<retired_pipeline_t> retired;
+};
+
+void
+pipeline_key_init(pipeline_key_t *key, const char *vert, const char *frag)
+{
+    memset(key, 0, sizeof(*key));
+    key->vert = vert;
+    key->frag = frag;
+    key->vertexFormat = VERTEX_FORMAT_FLOAT;
+    key->instanced = false;
+    key->polygonMode = VK_POLYGON_MODE_FILL;
+    key->cullMode = VK_CULL_MODE_BACK_BIT;
+    key->blend = false;
+    key->colorWrite = frag != NULL;
+    key->depthTest = true;
+    key->depthWrite = true;
+    key->depthCompare = VK_COMPARE_OP_LESS;
+    key->specCount = 0;
+}
+
+/* field by field, padding and unused constants would make equal keys differ */
+static std::string
+serialize(const pipeline_key_t *key)
+{
+    std::string s;
+
+    s.append(key->vert);
+    s.push_back('\0');
+    s.append(key->frag != NULL ? key->frag : "");
+    s.push_back('\0');
+    s.append((const char *)&(key->vertexFormat), sizeof(key->vertexFormat));
+    s.push_back(key->instanced ? 1 : 0);
+    s.append((const char *)&(key->polygonMode), sizeof(key->polygonMode));
+    s.append((const char *)&(key->cullMode), sizeof(key->cullMode));
+    s.push_back(key->blend ? 1 : 0);
+    s.push_back(key->colorWrite ? 1 : 0);
+    s.push_back(key->depthTest ? 1 : 0);
+    s.push_back(key->depthWrite ? 1 : 0);
+    s.append((const char *)&(key->depthCompare), sizeof(key->depthCompare));
+    s.append((const char *)key->spec, key->specCount * sizeof(key->spec[0]));
+
+    return s;
+}
+
+static VkPipeline
+build(handles_t *handles, const pipeline_key_t *key, float *ms)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    VkShaderModule vertShaderModule = load_shader(handles, key->vert);
+    VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+    try
+    {
+        if (key->frag != NULL)
+        {
+            fragShaderModule = load_shader(handles, key->frag);
+        }
+    }
+    catch (...)
+    {
+        vkDestroyShaderModule(handles->device, vertShaderModule, NULL);
+        throw;
+    }
+
+    VkPipeline pipeline = create_gfk_pipeline(handles, key, vertShaderModule, fragShaderModule);
+
+    if (fragShaderModule != VK_NULL_HANDLE)
+    {
+        vkDestroyShaderModule(handles->device, fragShaderModule, NULL);
+    }
+    vkDestroyShaderModule(handles->device, vertShaderModule, NULL);
+
+    *ms = std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+    printf("  pipeline %s %s%s %.2f ms\n", key->vert,
+           key->frag != NULL ? key->frag : "depth only",
+           key->instanced ? " instanced" : "", *ms);
+
+    return pipeline;
+}
+
+static variant_t *
+request(handles_t *handles, const pipeline_key_t *key)
+{
+    pipelines_s *state = handles->pipelines;
+    std::string name = serialize(key);
+
+    std::lock_guard<std::mutex> guard(state->lock);
+
+    auto existing = state->variants.find(name);
+    if (existing != state->variants.end())
+    {
+        return existing->second;
+    }
+
+    variant_t *variant = new variant_t();
+    variant->key = *key;
+    variant->pipeline = VK_NULL_HANDLE;
+    variant->replacement = VK_NULL_HANDLE;
+    state->variants[name] = variant;
+
+    variant->build = thread_pool_run(handles, [handles, state, variant] {
+        float ms;
+        VkPipeline pipeline = build(handles, &(variant->key), &ms);
+
+        std::lock_guard<std::mutex> guard(state->lock);
+        variant->pipeline = pipeline;
+        state->buildMs += ms;
+    }).share();
+
+    return variant;
+}
+
+void
+pipelines_init(handles_t *handles)
+{
+    pipelines_s *state = new pipelines_s();
+    state->buildMs = 0.0f;
+    state->frame = 0;
+
+    handles->pipelines = state;
+}
+
+void
+pipelines_cleanup(handles_t *handles)
+{
+    pipelines_s *state = handles->pipelines;
+    if (state == NULL)
+    {
+        return;
+    }
+
+    for (auto v = state->variants.begin(); v != state->variants.end(); ++v)
+    {
+        variant_t *variant = v->second;
+
+        variant->build.wait();
+        if (variant->pipeline != VK_NULL_HANDLE)
+        {
+            vkDestroyPipeline(handles->device, variant->pipeline, NULL);
+        }
+        if (variant->replacement != VK_NULL_HANDLE)
+        {
+            vkDestroyPipeline(handles->device, variant->replacement, NULL);
+        }
+        delete variant;
+    }
+
+    for (auto retired = state->retired.begin(); retired != state->retired.end(); ++retired)
+    {
+        vkDestroyPipeline(handles->device, retired->pipeline, NULL);
+    }
+
+    delete state;
+    handles->pipelines = NULL;
+}
+
+void
+pipeline_request(handles_t *handles, const pipeline_key_t *key)
+{
+    request(handles, key);
+}
+
+VkPipeline
+pipeline_get(handles_t *handles, const pipeline_key_t *key)
+{
+    pipelines_s *state = handles->pipelines;
+
+    std::lock_guard<std::mutex> guard(state->lock);
+
+    auto variant = state->variants.find(serialize(key));
+    return variant != state->variants.end() ? variant->second->pipeline : VK_NULL_HANDLE;
+}
+
+VkPipeline
+pipeline_wait(handles_t *handles, const pipeline_key_t *key)
+{
+    variant_t *variant = request(handles, key);
+
+    variant->build.get();
+
+    std::lock_guard<std::mutex> guard(handles->pipelines->lock);
+    return variant->pipeline;
+}
+
+float
+pipelines_build_ms(handles_t *handles)
+{
+    pipelines_s *state = handles->pipelines;
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    return state->buildMs;
+}
+
+void
+pipelines_rebuild(handles_t *handles, const char *spirv)
+{
+    pipelines_s *state = handles->pipelines;
+
+    /* variants are never removed, the list stays valid without the lock */
+    std::vector<variant_t *> affected;
+    {
+        std::lock_guard<std::mutex> guard(state->lock);
+
+        for (auto v = state->variants.begin(); v != state->variants.end(); ++v)
+        {
+            variant_t *variant = v->second;
+            if (strcmp(variant->key.vert, spirv) == 0 ||
+                (variant->key.frag != NULL && strcmp(variant->key.frag, spirv) == 0))
+            {
+                affected.push_back(variant);
+            }
+        }
+    }
+
+    /*
+     * on the calling thread, the frame thread waits for jobs on the pool
+     * and would stall behind a compile there
+     */
+    std::vector<VkPipeline> rebuilt;
+    for (auto v = affected.begin(); v != affected.end(); ++v)
+    {
+        try
+        {
+            float ms;
+            rebuilt.push_back(build(handles, &((*v)->key), &ms));
+        }
+        catch (const std::exception& e)
+        {
+            printf("can't rebuild pipeline: %s, keeping the old pipelines\n", e.what());
+            for (auto p = rebuilt.begin(); p != rebuilt.end(); ++p)
+            {
+                vkDestroyPipeline(handles->device, *p, NULL);
+            }
+            return;
+        }
+    }
+
+    /*
+     * all or none, variants of one shader must not mix old and new code,
+     * the depth pre-pass and the EQUAL tested shading pass would disagree
+     */
+    std::lock_guard<std::mutex> guard(state->lock);
+    for (size_t i = 0; i < affected.size(); i++)
+    {
+        /* never used if it wasn't swapped in yet */
+        if (affected[i]->replacement != VK_NULL_HANDLE)
+        {
+            vkDestroyPipeline(handles->device, affected[i]->replacement, NULL);
+        }
+        affected[i]->replacement = rebuilt[i];
+    }
+}
+
+void
+pipelines_frame(handles_t *handles)
+{
+    pipelines_s *state = handles->pipelines;
+
+    /* as for retired swapchains, every slot's fence was waited on since */
+    state->frame++;
+    for (auto retired = state->retired.begin(); retired != state->retired.end();)
+    {
+        if (state->frame > retired->frame + handles->framesInFlight)
+        {
+            vkDestroyPipeline(handles->device, retired->pipeline, NULL);
+            retired = state->retired.erase(retired);
+        }
+        else
+        {
+            ++retired;
+        }
+    }
+
+    bool swapped = false;
+    {
+        /* never held during a build */
+        std::lock_guard<std::mutex> guard(state->lock);
+
+        /* replacements are swapped in together, wait if one still has no pipeline to replace */
+        bool ready = true;
+        for (auto v = state->variants.begin(); v != state->variants.end(); ++v)
+        {
+            if (v->second->replacement != VK_NULL_HANDLE && v->second->pipeline == VK_NULL_HANDLE)
+            {
+                ready = false;
+            }
+        }
+
+        for (auto v = state->variants.begin(); ready && v != state->variants.end(); ++v)
+        {
+            variant_t *variant = v->second;
+            if (variant->replacement == VK_NULL_HANDLE)
+            {
+                continue;
+            }
+
+            retired_pipeline_t retired = {variant->pipeline, state->frame};
+            state->retired.push_back(retired);
+            variant->pipeline = variant->replacement;
+            variant->replacement = VK_NULL_HANDLE;
+            swapped = true;
+        }
+    }
+
+    if (swapped)
+    {
+        handles->gfxPipeline = pipeline_get(handles, &(handles->gfxPipelineKey));
+        if (handles->instanceCount > 0)
+        {
+            handles->instancedPipeline = pipeline_get(handles, &(handles->instancedPipelineKey));
+        }
+        if (handles->depthPrepass)
+        {
+            handles->depthPipeline = pipeline_get(handles, &(handles->depthPipelineKey));
+        }
+    }
+}
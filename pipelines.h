@@ -0,0 +1,71 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Graphics pipeline variants, keyed by pipeline_key_t.
+ *
+ * Requesting a variant that was requested before does nothing, else its
+ * pipeline is created by a thread pool job, all of them through the
+ * shared handles->pipelineCache, so variants requested together are
+ * created in parallel. The variants own their pipelines, which live
+ * until pipelines_cleanup().
+ *
+ * After a shader changes, pipelines_rebuild() creates the variants that
+ * use it again on the calling thread, never on the pool the frame thread
+ * waits on. pipelines_frame() swaps the new pipelines in between frames
+ * and destroys the replaced ones once no frame in flight can use them.
+ * No pipeline is ever created on the thread that records frames.
+ */
+
+/*
+ * vert and frag with float vertices, not instanced, filled and back face
+ * culled polygons, no blending, depth tested with LESS and written and no
+ * specialization constants, frag NULL for a depth only variant without
+ * color writes
+ */
+void
+pipeline_key_init(pipeline_key_t *key, const char *vert, const char *frag);
+
+void
+pipelines_init(handles_t *handles);
+
+/* waits for builds still running, the device must be idle */
+void
+pipelines_cleanup(handles_t *handles);
+
+/* start creating the variant's pipeline unless it exists or is being created */
+void
+pipeline_request(handles_t *handles, const pipeline_key_t *key);
+
+/* the variant's pipeline, VK_NULL_HANDLE if it is not created yet, never blocks */
+VkPipeline
+pipeline_get(handles_t *handles, const pipeline_key_t *key);
+
+/*
+ * request the variant and block until it is created, rethrows what the
+ * build threw, like missing shader files
+ */
+VkPipeline
+pipeline_wait(handles_t *handles, const pipeline_key_t *key);
+
+/*
+ * time spent creating the requested variants so far, summed over the
+ * builds running in parallel, rebuilds not included
+ */
+float
+pipelines_build_ms(handles_t *handles);
+
+/*
+ * create the variants using the SPIR-V file again, blocks until they are,
+ * pipelines_frame() swaps them in only together and none if one failed
+ */
+void
+pipelines_rebuild(handles_t *handles, const char *spirv);
+
+/*
+ * call once per frame after its fence wait, swaps in rebuilt pipelines
+ * and points handles->gfxPipeline, instancedPipeline and depthPipeline at them
+ */
+void
+pipelines_frame(handles_t *handles);
@@ -0,0 +1,352 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "profiler.h"
+#include "utils.h"
+
+/* samples kept per zone for percentiles */
+#define PROF_WINDOW 1024
+
+#define TRACE_CPU_TID 1
+#define TRACE_GPU_TID 2
+/* latencies overlap each other and the frames, keep them on their own row */
+#define TRACE_LATENCY_TID 3
+
+static const char *zone_names[PROF_ZONE_COUNT] =
+{
+    "frame",
+    "fence wait",
+    "update ubo",
+    "acquire",
+    "record",
+    "submit",
+    "present",
+    "latency",
+    "gpu render",
+};
+
+typedef struct zone_samples_s
+{
+    /* ring of the last PROF_WINDOW durations in ms */
+    std::vector<float> samples;
+    uint32_t next;
+} zone_samples_t;
+
+struct profiler_s
+{
+    zone_samples_t zones[PROF_ZONE_COUNT];
+    uint64_t lastFrameStart;
+
+    /* two timestamps per frame slot, none if the queue can't time */
+    VkQueryPool queryPool;
+    std::vector<bool> queryPending;
+    double timestampPeriod;
+    uint64_t timestampMask;
+
+    /* CPU time of the first GPU sample, to line up both timelines */
+    bool gpuSynced;
+    uint64_t gpuOffsetNs;
+    uint64_t gpuBase;
+
+    FILE *trace;
+    bool traceFirst;
+    uint64_t traceStart;
+};
+
+/* CLOCK_MONOTONIC on Linux, the clock of VK_GOOGLE_display_timing present times */
+static uint64_t
+now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+add_sample(profiler_s *prof, prof_zone_t zone, float ms)
+{
+    zone_samples_t *z = &(prof->zones[zone]);
+
+    if (z->samples.size() < PROF_WINDOW)
+    {
+        z->samples.push_back(ms);
+    }
+    else
+    {
+        z->samples[z->next] = ms;
+    }
+    z->next = (z->next + 1) % PROF_WINDOW;
+}
+
+static void
+trace_event(profiler_s *prof, prof_zone_t zone, int tid, uint64_t start, uint64_t end)
+{
+    if (prof->trace == NULL)
+    {
+        return;
+    }
+
+    fprintf(prof->trace, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                         "\"ts\":%.3f,\"dur\":%.3f}",
+            prof->traceFirst ? "" : ",\n",
+            zone_names[zone], tid,
+            (start - prof->traceStart) / 1000.0,
+            (end - start) / 1000.0);
+    prof->traceFirst = false;
+}
+
+static void
+create_query_pool(handles_t *handles, profiler_s *prof)
+{
+    uint32_t count;
+    vkGetPhysicalDeviceQueueFamilyProperties(handles->phyDevice, &count, NULL);
+    std::vector<VkQueueFamilyProperties> qFamilies(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(handles->phyDevice, &count, qFamilies.data());
+
+    uint32_t validBits = qFamilies[handles->gfxFamilyIndex].timestampValidBits;
+    if (validBits == 0)
+    {
+        printf("graphics queue has no timestamps, GPU timing disabled\n");
+        prof->queryPool = VK_NULL_HANDLE;
+        return;
+    }
+    prof->timestampMask = validBits >= 64 ? ~0ULL : (1ULL << validBits) - 1;
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(handles->phyDevice, &props);
+    prof->timestampPeriod = props.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = 2 * handles->framesInFlight;
+
+    check_res(
+        vkCreateQueryPool(handles->device, &poolInfo, NULL, &(prof->queryPool)),
+        "vkCreateQueryPool");
+
+    prof->queryPending.assign(handles->framesInFlight, false);
+}
+
+void
+profiler_init(handles_t *handles, const char *trace_path)
+{
+    profiler_s *prof = new profiler_s();
+    handles->profiler = prof;
+
+    for (int i = 0; i < PROF_ZONE_COUNT; i++)
+    {
+        prof->zones[i].next = 0;
+    }
+    prof->lastFrameStart = 0;
+    prof->gpuSynced = false;
+    prof->traceStart = now_ns();
+    prof->traceFirst = true;
+    prof->trace = NULL;
+
+    if (trace_path != NULL)
+    {
+        prof->trace = fopen(trace_path, "w");
+        if (prof->trace == NULL)
+        {
+            printf("can't write trace %s\n", trace_path);
+        }
+        else
+        {
+            fprintf(prof->trace, "[\n");
+        }
+    }
+
+    create_query_pool(handles, prof);
+}
+
+void
+profiler_cleanup(handles_t *handles)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL)
+    {
+        return;
+    }
+
+    profiler_report(handles);
+
+    if (prof->trace != NULL)
+    {
+        fprintf(prof->trace, "\n]\n");
+        fclose(prof->trace);
+    }
+
+    if (prof->queryPool != VK_NULL_HANDLE)
+    {
+        vkDestroyQueryPool(handles->device, prof->queryPool, NULL);
+    }
+
+    delete prof;
+    handles->profiler = NULL;
+}
+
+uint64_t
+profiler_begin(handles_t *handles)
+{
+    if (handles->profiler == NULL)
+    {
+        return 0;
+    }
+
+    return now_ns();
+}
+
+void
+profiler_end(handles_t *handles, prof_zone_t zone, uint64_t start)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL)
+    {
+        return;
+    }
+
+    profiler_sample(handles, zone, start, now_ns());
+}
+
+void
+profiler_sample(handles_t *handles, prof_zone_t zone, uint64_t start, uint64_t end)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL || end < start)
+    {
+        return;
+    }
+
+    add_sample(prof, zone, (end - start) / 1e6f);
+    int tid = zone == PROF_LATENCY ? TRACE_LATENCY_TID : TRACE_CPU_TID;
+    trace_event(prof, zone, tid, start, end);
+}
+
+void
+profiler_cmd_begin(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL || prof->queryPool == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkCmdResetQueryPool(cmdBuf, prof->queryPool, 2 * frame, 2);
+    vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        prof->queryPool, 2 * frame);
+}
+
+void
+profiler_cmd_end(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL || prof->queryPool == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        prof->queryPool, 2 * frame + 1);
+}
+
+void
+profiler_frame(handles_t *handles, uint32_t frame)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL)
+    {
+        return;
+    }
+
+    uint64_t frameStart = now_ns();
+    if (prof->lastFrameStart != 0)
+    {
+        add_sample(prof, PROF_FRAME, (frameStart - prof->lastFrameStart) / 1e6f);
+        trace_event(prof, PROF_FRAME, TRACE_CPU_TID, prof->lastFrameStart, frameStart);
+    }
+    prof->lastFrameStart = frameStart;
+
+    if (prof->queryPool == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    /* the slot's fence has signaled, so results are available without waiting */
+    if (prof->queryPending[frame])
+    {
+        uint64_t ts[2];
+        VkResult res = vkGetQueryPoolResults(
+            handles->device, prof->queryPool, 2 * frame, 2,
+            sizeof(ts), ts, sizeof(ts[0]), VK_QUERY_RESULT_64_BIT);
+
+        if (res == VK_SUCCESS)
+        {
+            uint64_t ticks = (ts[1] - ts[0]) & prof->timestampMask;
+            double ns = ticks * prof->timestampPeriod;
+            add_sample(prof, PROF_GPU_RENDER, (float)(ns / 1e6));
+
+            /*
+             * GPU and CPU clocks are unrelated, anchor the first GPU
+             * sample at the current CPU time so both show up side by side
+             */
+            if (!prof->gpuSynced)
+            {
+                prof->gpuSynced = true;
+                prof->gpuBase = ts[0];
+                prof->gpuOffsetNs = frameStart - (uint64_t)ns;
+            }
+            uint64_t start = prof->gpuOffsetNs +
+                (uint64_t)(((ts[0] - prof->gpuBase) & prof->timestampMask) * prof->timestampPeriod);
+            trace_event(prof, PROF_GPU_RENDER, TRACE_GPU_TID, start, start + (uint64_t)ns);
+        }
+    }
+
+    /* caller submits this slot's commands next */
+    prof->queryPending[frame] = true;
+}
+
+float
+profiler_percentile(handles_t *handles, prof_zone_t zone, float p)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL || prof->zones[zone].samples.empty())
+    {
+        return 0.0f;
+    }
+
+    std::vector<float> sorted = prof->zones[zone].samples;
+    size_t n = std::min(sorted.size() - 1, (size_t)(sorted.size() * p / 100.0f));
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+
+    return sorted[n];
+}
+
+void
+profiler_report(handles_t *handles)
+{
+    profiler_s *prof = handles->profiler;
+    if (prof == NULL)
+    {
+        return;
+    }
+
+    printf("%-12s %8s %8s %8s (ms)\n", "zone", "p50", "p95", "p99");
+    for (int i = 0; i < PROF_ZONE_COUNT; i++)
+    {
+        std::vector<float> sorted = prof->zones[i].samples;
+        if (sorted.empty())
+        {
+            continue;
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        size_t n = sorted.size();
+        printf("%-12s %8.3f %8.3f %8.3f\n",
+               zone_names[i],
+               sorted[n * 50 / 100],
+               sorted[n * 95 / 100],
+               sorted[n * 99 / 100]);
+    }
+}
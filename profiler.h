@@ -0,0 +1,71 @@
+#pragma once
+
+#include "main.h"
+
+struct profiler_s;
+
+/*
+ * CPU scope timers and GPU timestamps, collected into rolling windows
+ * for percentile reports and optionally written as a Chrome trace-event
+ * JSON file (load it in chrome://tracing or Perfetto).
+ *
+ * All calls are no-ops unless profiler_init() was called.
+ */
+
+typedef enum
+{
+    /* time between the starts of consecutive frames */
+    PROF_FRAME,
+    /* waiting on the frame's in-flight fence, high when GPU bound */
+    PROF_FENCE_WAIT,
+    PROF_UPDATE_UBO,
+    PROF_ACQUIRE,
+    PROF_RECORD,
+    PROF_SUBMIT,
+    PROF_PRESENT,
+    /* input sampled until the frame is on screen, see swapchain.h */
+    PROF_LATENCY,
+    /* render pass execution on the GPU */
+    PROF_GPU_RENDER,
+    PROF_ZONE_COUNT,
+} prof_zone_t;
+
+/* trace_path may be NULL for percentile reports only */
+void
+profiler_init(handles_t *handles, const char *trace_path);
+
+void
+profiler_cleanup(handles_t *handles);
+
+/* returns the start timestamp to pass to profiler_end() */
+uint64_t
+profiler_begin(handles_t *handles);
+
+void
+profiler_end(handles_t *handles, prof_zone_t zone, uint64_t start);
+
+/* a zone that ended at end, a CLOCK_MONOTONIC time in ns like the timestamps */
+void
+profiler_sample(handles_t *handles, prof_zone_t zone, uint64_t start, uint64_t end);
+
+/* write GPU timestamps around commands of a frame slot */
+void
+profiler_cmd_begin(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame);
+
+void
+profiler_cmd_end(handles_t *handles, VkCommandBuffer cmdBuf, uint32_t frame);
+
+/*
+ * Call once per frame after the frame's fence has signaled, collects
+ * GPU timestamps of the previous submission of this frame slot.
+ */
+void
+profiler_frame(handles_t *handles, uint32_t frame);
+
+/* percentile p (0-100) of zone over the rolling window in ms, 0 if no samples */
+float
+profiler_percentile(handles_t *handles, prof_zone_t zone, float p);
+
+/* print p50/p95/p99 of every zone over the rolling window */
+void
+profiler_report(handles_t *handles);
@@ -0,0 +1,332 @@
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <thread>
+
+#include "readback.h"
+#include "utils.h"
+
+/* bytes per pixel of FRAME_BUF_FORMAT */
+#define READBACK_PIXEL_SIZE 4
+
+typedef enum
+{
+    SLOT_FREE,
+    /* copy submitted, waiting for GPU and consumer */
+    SLOT_PENDING,
+} slot_state_t;
+
+typedef struct readback_slot_s
+{
+    VkBuffer buffer;
+    gpu_allocation_t alloc;
+    VkFence fence;
+    /* one copy command buffer per offscreen image */
+    std::vector<VkCommandBuffer> cmdBufs;
+    uint64_t frame;
+    slot_state_t state;
+} readback_slot_t;
+
+struct readback_s
+{
+    VkCommandPool commandPool;
+    std::vector<readback_slot_t> slots;
+    VkDeviceSize frameSize;
+    bool coherent;
+
+    readback_consumer_t consumer;
+    void *user;
+
+    /* next slot to fill, render thread only */
+    uint32_t head;
+    /* next slot to deliver, consumer thread only */
+    uint32_t tail;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    bool stop;
+    std::thread thread;
+
+    /* stats */
+    uint64_t delivered;
+    uint64_t dropped;
+    std::chrono::high_resolution_clock::time_point start;
+};
+
+static void
+record_copy(handles_t *handles, VkCommandBuffer cmdBuf, VkImage image, VkBuffer buffer)
+{
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+    vkBeginCommandBuffer(cmdBuf, &beginInfo);
+
+    /*
+     * image is already in TRANSFER_SRC_OPTIMAL and made available to
+     * transfer reads by the render pass outgoing dependency
+     */
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent.width = handles->swapchainExtend.width;
+    region.imageExtent.height = handles->swapchainExtend.height;
+    region.imageExtent.depth = 1;
+
+    vkCmdCopyImageToBuffer(cmdBuf, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           buffer, 1, &region);
+
+    /* make the copy visible to host reads once the fence signals */
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+    vkCmdPipelineBarrier(cmdBuf,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &barrier, 0, NULL, 0, NULL);
+
+    check_res(
+        vkEndCommandBuffer(cmdBuf),
+        "vkEndCommandBuffer readback");
+}
+
+static void
+consumer_thread(handles_t *handles)
+{
+    readback_s *rb = handles->readback;
+
+    for (;;)
+    {
+        readback_slot_t *slot = &(rb->slots[rb->tail]);
+
+        {
+            std::unique_lock<std::mutex> lock(rb->lock);
+            rb->cond.wait(lock, [rb, slot] {
+                return slot->state == SLOT_PENDING || rb->stop;
+            });
+
+            if (slot->state != SLOT_PENDING)
+            {
+                /* stopped and nothing left to deliver */
+                return;
+            }
+        }
+
+        check_res(
+            vkWaitForFences(handles->device, 1, &(slot->fence), VK_TRUE,
+                            std::numeric_limits<uint64_t>::max()),
+            "vkWaitForFences readback");
+
+        if (!rb->coherent)
+        {
+            VkMappedMemoryRange range = {};
+            range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+            range.memory = slot->alloc.memory;
+            range.offset = slot->alloc.offset;
+            range.size = slot->alloc.size;
+
+            check_res(
+                vkInvalidateMappedMemoryRanges(handles->device, 1, &range),
+                "vkInvalidateMappedMemoryRanges readback");
+        }
+
+        if (rb->consumer != NULL)
+        {
+            rb->consumer(slot->alloc.mapped,
+                         handles->swapchainExtend.width,
+                         handles->swapchainExtend.height,
+                         slot->frame, rb->user);
+        }
+
+        check_res(
+            vkResetFences(handles->device, 1, &(slot->fence)),
+            "vkResetFences readback");
+
+        {
+            std::lock_guard<std::mutex> guard(rb->lock);
+            slot->state = SLOT_FREE;
+            rb->delivered += 1;
+        }
+
+        rb->tail = (rb->tail + 1) % rb->slots.size();
+    }
+}
+
+void
+readback_init(handles_t *handles, uint32_t slots,
+              readback_consumer_t consumer, void *user)
+{
+    readback_s *rb = new readback_s();
+    handles->readback = rb;
+
+    rb->frameSize = (VkDeviceSize)handles->swapchainExtend.width *
+                    handles->swapchainExtend.height * READBACK_PIXEL_SIZE;
+    rb->consumer = consumer;
+    rb->user = user;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->stop = false;
+    rb->delivered = 0;
+    rb->dropped = 0;
+    rb->coherent = true;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = handles->gfxFamilyIndex;
+
+    check_res(
+        vkCreateCommandPool(handles->device, &poolInfo, NULL, &(rb->commandPool)),
+        "vkCreateCommandPool readback");
+
+    uint32_t imageCount = (uint32_t)handles->swapChainImages.size();
+
+    rb->slots.resize(slots);
+    for (uint32_t i = 0; i < slots; i++)
+    {
+        readback_slot_t *slot = &(rb->slots[i]);
+        slot->state = SLOT_FREE;
+        slot->frame = 0;
+
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = rb->frameSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        check_res(
+            vkCreateBuffer(handles->device, &bufferInfo, NULL, &(slot->buffer)),
+            "vkCreateBuffer readback");
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(handles->device, slot->buffer, &memRequirements);
+
+        /* cached memory makes CPU reads of the frame much faster */
+        slot->alloc = gpu_alloc(handles, memRequirements,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                                true);
+
+        check_res(
+            vkBindBufferMemory(handles->device, slot->buffer,
+                               slot->alloc.memory, slot->alloc.offset),
+            "vkBindBufferMemory readback");
+
+        if (!(gpu_alloc_memory_flags(handles, &(slot->alloc)) &
+              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        {
+            rb->coherent = false;
+        }
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        check_res(
+            vkCreateFence(handles->device, &fenceInfo, NULL, &(slot->fence)),
+            "vkCreateFence readback");
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = rb->commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = imageCount;
+
+        slot->cmdBufs.resize(imageCount);
+        check_res(
+            vkAllocateCommandBuffers(handles->device, &allocInfo, slot->cmdBufs.data()),
+            "vkAllocateCommandBuffers readback");
+
+        for (uint32_t j = 0; j < imageCount; j++)
+        {
+            record_copy(handles, slot->cmdBufs[j], handles->swapChainImages[j], slot->buffer);
+        }
+    }
+
+    printf("readback ring of %u frames, %s memory\n",
+           slots, rb->coherent ? "coherent" : "non-coherent");
+
+    rb->start = std::chrono::high_resolution_clock::now();
+    rb->thread = std::thread(consumer_thread, handles);
+}
+
+bool
+readback_frame(handles_t *handles, uint32_t image, uint64_t frame)
+{
+    readback_s *rb = handles->readback;
+    readback_slot_t *slot = &(rb->slots[rb->head]);
+
+    {
+        std::lock_guard<std::mutex> guard(rb->lock);
+        if (slot->state != SLOT_FREE)
+        {
+            /* consumer is behind, don't stall rendering */
+            rb->dropped += 1;
+            return false;
+        }
+    }
+
+    slot->frame = frame;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &(slot->cmdBufs[image]);
+
+    {
+        std::lock_guard<std::mutex> guard(handles->queueLock);
+        check_res(
+            vkQueueSubmit(handles->gfxQueue, 1, &submitInfo, slot->fence),
+            "vkQueueSubmit readback");
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(rb->lock);
+        slot->state = SLOT_PENDING;
+    }
+    rb->cond.notify_one();
+
+    rb->head = (rb->head + 1) % rb->slots.size();
+
+    return true;
+}
+
+void
+readback_cleanup(handles_t *handles)
+{
+    readback_s *rb = handles->readback;
+
+    {
+        std::lock_guard<std::mutex> guard(rb->lock);
+        rb->stop = true;
+    }
+    rb->cond.notify_one();
+    rb->thread.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    float elapsed = std::chrono::duration<float>(end - rb->start).count();
+    printf("readback %llu frames, %llu dropped, %.1f MB/s\n",
+           (unsigned long long)rb->delivered,
+           (unsigned long long)rb->dropped,
+           rb->delivered * rb->frameSize / (1024.0f * 1024.0f) / elapsed);
+
+    for (size_t i = 0; i < rb->slots.size(); i++)
+    {
+        readback_slot_t *slot = &(rb->slots[i]);
+        vkDestroyFence(handles->device, slot->fence, NULL);
+        vkDestroyBuffer(handles->device, slot->buffer, NULL);
+        gpu_free(handles, &(slot->alloc));
+    }
+
+    vkDestroyCommandPool(handles->device, rb->commandPool, NULL);
+
+    delete rb;
+    handles->readback = NULL;
+}
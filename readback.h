@@ -0,0 +1,35 @@
+#pragma once
+
+#include "main.h"
+
+struct readback_s;
+
+/*
+ * Copies rendered offscreen frames into a ring of host visible, preferably
+ * host cached, buffers and hands them to a consumer thread.
+ *
+ * The render thread never waits on the GPU for readback. If all ring slots
+ * are still owned by the GPU or the consumer, the frame is dropped instead.
+ * Frames are delivered in the order they were rendered, at most ring size
+ * frames after they were submitted.
+ */
+
+/* called on the consumer thread, pixels are FRAME_BUF_FORMAT, tightly packed */
+typedef void (*readback_consumer_t)(const void *pixels,
+                                    uint32_t width, uint32_t height,
+                                    uint64_t frame, void *user);
+
+void
+readback_init(handles_t *handles, uint32_t slots,
+              readback_consumer_t consumer, void *user);
+
+/*
+ * Submit a copy of image after the work already submitted to the graphics
+ * queue. Returns false if the frame was dropped.
+ */
+bool
+readback_frame(handles_t *handles, uint32_t image, uint64_t frame);
+
+/* deliver all pending frames, stop the consumer thread and print stats */
+void
+readback_cleanup(handles_t *handles);
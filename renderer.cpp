@@ -0,0 +1,1233 @@
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <string.h>
+
+#include <iostream>
+#include <chrono>
+#include <limits>
+
+#include "renderer.h"
+#include "utils.h"
+#include "dump.h"
+#include "gfx_pipeline.h"
+#include "frame_buf.h"
+#include "cmd_buf.h"
+#include "gpu_buf.h"
+#include "upload.h"
+#include "pipeline_cache.h"
+#include "offscreen.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include "cull.h"
+#include "object_store.h"
+#include "descriptors.h"
+#include "vertex_pack.h"
+#include "mesh_lod.h"
+#include "swapchain.h"
+#include "shader_reload.h"
+#include "pipelines.h"
+#include "depth.h"
+
+#define PIPELINE_CACHE_FILE "pipeline_cache.bin"
+
+#define DEFAULT_WIDTH 800
+#define DEFAULT_HEIGHT 600
+#define DEFAULT_HEADLESS_FRAMES 1000
+
+void
+renderer_defaults(handles_t *handles)
+{
+    handles->framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    handles->headless = false;
+    handles->headlessFrames = DEFAULT_HEADLESS_FRAMES;
+    handles->readbackEnabled = false;
+    handles->dumpFramesPrefix = NULL;
+    handles->profileEnabled = false;
+    handles->tracePath = NULL;
+    handles->gpuDriven = false;
+    handles->vertexFormat = VERTEX_FORMAT_AUTO;
+    handles->lodPixelError = DEFAULT_LOD_PIXEL_ERROR;
+    handles->presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    handles->swapchainStale = false;
+    handles->swapchainState = NULL;
+    handles->cull = NULL;
+    handles->descriptors = NULL;
+    handles->hotReload = false;
+    handles->depthPrepass = false;
+    handles->shaderReload = NULL;
+    handles->pipelines = NULL;
+    handles->threadPool = NULL;
+    handles->profiler = NULL;
+    handles->readback = NULL;
+    handles->swapchainExtend.width = DEFAULT_WIDTH;
+    handles->swapchainExtend.height = DEFAULT_HEIGHT;
+}
+
+/*
+ * Get the vulkan extensions we need to enable.
+ */
+static std::vector<const char*>
+get_vulkan_extensions(bool headless)
+{
+	std::vector<const char*> exts;
+
+	/* surface extensions are only needed when rendering to a window */
+	if (!headless)
+	{
+		unsigned int glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+		for (unsigned int i = 0; i < glfwExtensionCount; i++)
+		{
+			exts.push_back(glfwExtensions[i]);
+		}
+	}
+
+	/* for consuming validation layers output */
+	exts.push_back("VK_EXT_debug_report");
+
+	return exts;
+}
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL
+debugCallback(
+	VkDebugReportFlagsEXT flags,
+	VkDebugReportObjectTypeEXT objType,
+	uint64_t obj,
+	size_t location,
+	int32_t code,
+	const char* layerPrefix,
+	const char* msg,
+	void* userData) {
+
+	std::cerr << "validation layer: " << msg << std::endl;
+
+	return VK_FALSE;
+}
+
+static const char * const*
+get_layers(uint32_t *count)
+{
+	static const char *layers[1] = { "VK_LAYER_LUNARG_standard_validation" };
+
+	/*
+	 * only enable validation if it is installed, drivers like lavapipe
+	 * are often used on machines without the SDK
+	 */
+	uint32_t layerCount;
+	vkEnumerateInstanceLayerProperties(&layerCount, NULL);
+	std::vector<VkLayerProperties> available(layerCount);
+	vkEnumerateInstanceLayerProperties(&layerCount, available.data());
+
+	*count = 0;
+	for (auto layer = available.begin(); layer != available.end(); ++layer)
+	{
+		if (strcmp(layers[0], layer->layerName) == 0)
+		{
+			*count = 1;
+			break;
+		}
+	}
+
+	return layers;
+}
+
+static const char * const*
+get_device_extensions(handles_t *handles, uint32_t *count)
+{
+	static std::vector<const char *> extensions;
+
+	extensions.clear();
+	if (!handles->headless)
+	{
+		extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
+	if (handles->drawIndirectCount)
+	{
+		extensions.push_back(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+	if (handles->displayTiming)
+	{
+		extensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+	}
+
+	*count = static_cast<uint32_t>(extensions.size());
+	return extensions.data();
+}
+
+/*
+ * probe the optional capabilities used for GPU driven draws
+ */
+static void
+get_indirect_caps(handles_t *handles, VkPhysicalDeviceFeatures *enabled)
+{
+	handles->drawIndirectCount = false;
+	handles->multiDrawIndirect = false;
+
+	if (!handles->gpuDriven)
+	{
+		return;
+	}
+
+	uint32_t count;
+	vkEnumerateDeviceExtensionProperties(handles->phyDevice, NULL, &count, NULL);
+	std::vector<VkExtensionProperties> extensions(count);
+	vkEnumerateDeviceExtensionProperties(handles->phyDevice, NULL, &count, extensions.data());
+
+	for (auto ext = extensions.begin(); ext != extensions.end(); ++ext)
+	{
+		if (strcmp(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME, ext->extensionName) == 0)
+		{
+			handles->drawIndirectCount = true;
+		}
+	}
+
+	VkPhysicalDeviceFeatures supported;
+	vkGetPhysicalDeviceFeatures(handles->phyDevice, &supported);
+	enabled->multiDrawIndirect = supported.multiDrawIndirect;
+	enabled->drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+	handles->multiDrawIndirect = supported.multiDrawIndirect == VK_TRUE;
+
+	printf("draw indirect count %s, multi draw indirect %s\n",
+	       yes_no(handles->drawIndirectCount), yes_no(supported.multiDrawIndirect));
+}
+
+/* present timing for measured latency, only with a window */
+static void
+get_present_caps(handles_t *handles)
+{
+	handles->displayTiming = false;
+
+	if (handles->headless)
+	{
+		return;
+	}
+
+	uint32_t count;
+	vkEnumerateDeviceExtensionProperties(handles->phyDevice, NULL, &count, NULL);
+	std::vector<VkExtensionProperties> extensions(count);
+	vkEnumerateDeviceExtensionProperties(handles->phyDevice, NULL, &count, extensions.data());
+
+	for (auto ext = extensions.begin(); ext != extensions.end(); ++ext)
+	{
+		if (strcmp(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME, ext->extensionName) == 0)
+		{
+			handles->displayTiming = true;
+		}
+	}
+}
+
+static bool
+is_device_suitable(handles_t *handles, VkPhysicalDevice device)
+{
+	uint32_t count;
+
+	/* any device can render to offscreen images */
+	if (handles->headless)
+	{
+		return true;
+	}
+
+	/*
+	 * must support VK_KHR_swapchain extension
+	 */
+	bool supportSwapchain = false;
+	vkEnumerateDeviceExtensionProperties(device, NULL, &count, NULL);
+	std::vector<VkExtensionProperties> extensions(count);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &count, extensions.data());
+
+	for (auto ext = extensions.begin(); ext != extensions.end(); ++ext)
+	{
+		if (strncmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, ext->extensionName, strlen(VK_KHR_SWAPCHAIN_EXTENSION_NAME)) == 0)
+		{
+			supportSwapchain = true;
+			break;
+		}
+	}
+
+	if (!supportSwapchain)
+	{
+		return false;
+	}
+
+	/*
+     * check that VK_FORMAT_B8G8R8A8_UNORM surface format is
+     * supported
+	 */
+	vkGetPhysicalDeviceSurfaceFormatsKHR(device, handles->surface, &count, NULL);
+	if (count < 1)
+	{
+		printf("no surface formats supported\n");
+		return false;
+	}
+    std::vector<VkSurfaceFormatKHR> formats(count);
+
+    bool VK_FORMAT_B8G8R8A8_UNORM_supported = false;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, handles->surface, &count, formats.data());
+    for (auto format = formats.begin(); format != formats.end(); ++format)
+	{
+        if (VK_FORMAT_B8G8R8A8_UNORM == format->format)
+        {
+            VK_FORMAT_B8G8R8A8_UNORM_supported = true;
+            break;
+        }
+    }
+
+    if (!VK_FORMAT_B8G8R8A8_UNORM_supported)
+    {
+        printf("VK_FORMAT_B8G8R8A8_UNORM format not supported\n");
+        return false;
+    }
+
+	/*
+	 * presentation modes, swapchain_init() picks one
+	 */
+	vkGetPhysicalDeviceSurfacePresentModesKHR(device, handles->surface, &count, NULL);
+	if (count < 1)
+	{
+		printf("no presentation modes supported\n");
+		return false;
+	}
+
+	return true;
+
+}
+
+/*
+ * rank device types, prefer real GPUs but fall back on software
+ * rasterizers like lavapipe
+ */
+static int
+device_type_score(VkPhysicalDeviceType type)
+{
+	switch (type)
+	{
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+			return 4;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+			return 3;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+			return 2;
+		case VK_PHYSICAL_DEVICE_TYPE_CPU:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static void
+get_phy_device(handles_t *handles, VkPhysicalDevice *device)
+{
+	uint32_t deviceCount = 0;
+	int bestScore = -1;
+
+	vkEnumeratePhysicalDevices(handles->instance, &deviceCount, NULL);
+	std::vector<VkPhysicalDevice> devices(deviceCount);
+	vkEnumeratePhysicalDevices(handles->instance, &deviceCount, devices.data());
+
+	for (auto dev = devices.begin(); dev != devices.end(); ++dev)
+	{
+		if (!is_device_suitable(handles, *dev))
+		{
+			continue;
+		}
+
+		VkPhysicalDeviceProperties props;
+		vkGetPhysicalDeviceProperties(*dev, &props);
+
+		int score = device_type_score(props.deviceType);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			*device = *dev;
+		}
+	}
+
+	if (bestScore < 0)
+	{
+		bail_out("No suitable GPU found");
+	}
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(*device, &props);
+	printf("Using %s for rendering\n", props.deviceName);
+}
+
+static void
+get_queue_families(handles_t *handles,
+	               uint32_t *gfxFamilyIndex,
+	               uint32_t *presentationFamilyIndex,
+	               uint32_t *transferFamilyIndex)
+{
+	uint32_t count;
+	int32_t gfxIdx = -1;
+	int32_t presIdx = -1;
+	int32_t transferIdx = -1;
+	int32_t transferScore = 0;
+
+	vkGetPhysicalDeviceQueueFamilyProperties(handles->phyDevice, &count, NULL);
+	std::vector<VkQueueFamilyProperties> qFamilies(count);
+	vkGetPhysicalDeviceQueueFamilyProperties(handles->phyDevice, &count, qFamilies.data());
+
+	for (uint32_t i = 0; i < qFamilies.size(); i += 1)
+	{
+		auto props = qFamilies[i];
+
+		if (gfxIdx == -1 && props.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
+			gfxIdx = i;
+		}
+
+		/*
+		 * look for a transfer queue family without graphics,
+		 * preferably without compute as well (a pure DMA engine)
+		 */
+		if ((props.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+			!(props.queueFlags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			int32_t score = props.queueFlags & VK_QUEUE_COMPUTE_BIT ? 1 : 2;
+			if (score > transferScore)
+			{
+				transferIdx = i;
+				transferScore = score;
+			}
+		}
+
+		if (presIdx == -1 && !handles->headless)
+		{
+			VkBool32 pSupported;
+			check_res(vkGetPhysicalDeviceSurfaceSupportKHR(
+				handles->phyDevice,
+				i,
+				handles->surface,
+				&pSupported),
+				"vkGetPhysicalDeviceSurfaceSupportKHR error");
+			if (pSupported)
+			{
+				presIdx = i;
+			}
+		}
+	}
+
+	if (gfxIdx == -1)
+	{
+		bail_out("no graphics queue familty found");
+	}
+
+	/* nothing is presented in headless mode */
+	if (handles->headless)
+	{
+		presIdx = gfxIdx;
+	}
+
+	if (presIdx == -1)
+	{
+		bail_out("no presentation queue familty found");
+	}
+
+	*gfxFamilyIndex = gfxIdx;
+	*presentationFamilyIndex = presIdx;
+	/* graphics queues can always do transfers */
+	*transferFamilyIndex = transferIdx == -1 ? gfxIdx : transferIdx;
+}
+
+static void
+init_device(handles_t *handles)
+{
+	get_phy_device(handles, &(handles->phyDevice));
+
+	/*
+	 * allocate one graphics and presentation capable queue
+	 */
+
+    get_queue_families(handles,
+                       &(handles->gfxFamilyIndex),
+                       &(handles->presentationFamilyIndex),
+                       &(handles->transferFamilyIndex));
+    printf("gfx queue %d, pres queue %d, transfer queue %d\n",
+           handles->gfxFamilyIndex,
+            handles->presentationFamilyIndex,
+            handles->transferFamilyIndex);
+
+	if (handles->gfxFamilyIndex != handles->presentationFamilyIndex)
+	{
+		/*
+		 * to lazy to impement this now, as nvidia GTX 1060 have same queue
+		 * family for both graphics and presentation
+		 */
+		bail_out("different queue familties for graphics and presentation not supported");
+	}
+
+	float queuePriority = 1.0f;
+	VkDeviceQueueCreateInfo queueCreateInfos[2] = {};
+	uint32_t queueCreateInfoCount = 1;
+
+	queueCreateInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueCreateInfos[0].queueFamilyIndex = handles->gfxFamilyIndex;
+	queueCreateInfos[0].queueCount = 1;
+	queueCreateInfos[0].pQueuePriorities = &queuePriority;
+
+	/* plus one queue from the dedicated transfer family, if any */
+	if (handles->transferFamilyIndex != handles->gfxFamilyIndex)
+	{
+		queueCreateInfos[1] = queueCreateInfos[0];
+		queueCreateInfos[1].queueFamilyIndex = handles->transferFamilyIndex;
+		queueCreateInfoCount = 2;
+	}
+
+	/*
+	 * no special features, except for GPU driven draws
+	 */
+	VkPhysicalDeviceFeatures deviceFeatures = {};
+	get_indirect_caps(handles, &deviceFeatures);
+	get_present_caps(handles);
+
+	VkDeviceCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.queueCreateInfoCount = queueCreateInfoCount;
+	createInfo.pQueueCreateInfos = queueCreateInfos;
+	createInfo.pEnabledFeatures = &deviceFeatures;
+	createInfo.ppEnabledExtensionNames = get_device_extensions(handles, &createInfo.enabledExtensionCount);
+	createInfo.ppEnabledLayerNames = get_layers(&createInfo.enabledLayerCount);
+
+	check_res(
+        vkCreateDevice(handles->phyDevice, &createInfo, NULL, &(handles->device)),
+        "vkCreateDevice error");
+
+	vkGetDeviceQueue(handles->device, handles->gfxFamilyIndex, 0, &(handles->gfxQueue));
+	/* we are cheating here as we know that gfx and presentation queue are the same */
+	handles->presentationQueue = handles->gfxQueue;
+	vkGetDeviceQueue(handles->device, handles->transferFamilyIndex, 0, &(handles->transferQueue));
+}
+
+/*
+ * create one semaphore pair and one fence for each frame in flight
+ */
+static void
+create_sync_objects(handles_t *handles)
+{
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    /* created signaled, so that first wait on each frame returns at once */
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    handles->imageAvailableSemaphores.resize(handles->framesInFlight);
+    handles->renderFinishedSemaphores.resize(handles->framesInFlight);
+    handles->inFlightFences.resize(handles->framesInFlight);
+    handles->currentFrame = 0;
+
+    for (uint32_t i = 0; i < handles->framesInFlight; i++)
+    {
+        check_res(
+            vkCreateSemaphore(handles->device, &semaphoreInfo,
+                              NULL, &(handles->imageAvailableSemaphores[i])),
+            "vkCreateSemaphore imageAvailableSemaphore");
+
+        check_res(
+            vkCreateSemaphore(handles->device, &semaphoreInfo,
+                              NULL, &(handles->renderFinishedSemaphores[i])),
+            "vkCreateSemaphore renderFinishedSemaphore");
+
+        check_res(
+            vkCreateFence(handles->device, &fenceInfo,
+                          NULL, &(handles->inFlightFences[i])),
+            "vkCreateFence inFlightFence");
+    }
+}
+
+static float
+ms_since(std::chrono::high_resolution_clock::time_point start)
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<float, std::milli>(now - start).count();
+}
+
+/* print how long the phase starting at *start took and start the next one */
+static void
+phase_done(const char *name, std::chrono::high_resolution_clock::time_point *start)
+{
+    printf("  %-24s %8.2f ms\n", name, ms_since(*start));
+    *start = std::chrono::high_resolution_clock::now();
+}
+
+/*
+ * Independent work runs on the thread pool while the main thread sets up
+ * the swapchain and per frame objects:
+ *
+ *   SPIR-V file reads   from the very start, they don't need a device
+ *   graphics pipeline   once the device, render pass and set layout exist
+ *   scene upload        once the device and allocator exist
+ *
+ * Command buffers are recorded when all of them have completed.
+ */
+void
+init_vulkan(handles_t *handles, const scene_t *scene)
+{
+	handles->initStart = std::chrono::high_resolution_clock::now();
+	handles->firstFrameSubmitted = false;
+	auto phase = handles->initStart;
+
+	printf("startup:\n");
+
+	/* indirect draws can't push a transform per draw, the culling shader only knows ubo.model */
+	if (handles->gpuDriven && !scene->objects.empty())
+	{
+		printf("GPU driven draws need draws in model space, drawing from the CPU\n");
+		handles->gpuDriven = false;
+	}
+
+	/* may already be up for loading the scene */
+	if (handles->threadPool == NULL)
+	{
+		thread_pool_init(handles, 0);
+	}
+
+	bool instanced = !scene->instances.empty();
+	handles->vertexFormat = vertex_format_select(handles->vertexFormat, scene);
+	printf("  %s vertices\n", vertex_format_name(handles->vertexFormat));
+
+	std::vector<char> cullCode;
+	auto cullRead = thread_pool_run(handles, [handles, &cullCode] {
+		if (handles->gpuDriven)
+		{
+			cullCode = read_file("cull.spv");
+		}
+	});
+
+	/*
+	 * create Vulkan Instance
+	 */
+	VkInstanceCreateInfo info = {};
+
+	info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	info.pNext = NULL;
+	info.flags = 0;
+	info.pApplicationInfo = NULL;
+
+	info.ppEnabledLayerNames = get_layers(&info.enabledLayerCount);
+
+	auto extensions = get_vulkan_extensions(handles->headless);
+	info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	info.ppEnabledExtensionNames = extensions.data();
+
+	VkResult res = vkCreateInstance(&info, NULL, &(handles->instance));
+	check_res(res, "vkCreateInstance error");
+
+	/*
+	 * create debug callback handle
+	 */
+	VkDebugReportCallbackCreateInfoEXT dbgCallbackInfo = {};
+	dbgCallbackInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
+	dbgCallbackInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
+	dbgCallbackInfo.pfnCallback = debugCallback;
+
+	auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(
+		   handles->instance,
+           "vkCreateDebugReportCallbackEXT");
+
+	func(handles->instance, &dbgCallbackInfo, NULL, &(handles->debug_cb));
+
+	/*
+	 * init window surface
+	 */
+	if (!handles->headless)
+	{
+		check_res(
+			glfwCreateWindowSurface(handles->instance,
+									handles->window,
+									NULL,
+									&(handles->surface)),
+			"error creating window surface");
+	}
+
+	//dump_gfx_cards(handles);
+	phase_done("instance", &phase);
+
+	/*
+	 * init device, swapchain, graphics pipeline
+	 */
+    init_device(handles);
+    gpu_alloc_init(handles);
+    phase_done("device", &phase);
+
+    create_descriptor_set_layout(handles);
+    create_pipeline_layout(handles);
+    select_depth_format(handles);
+    create_render_pass(handles);
+    if (handles->gpuDriven)
+    {
+        cull_init(handles);
+    }
+
+    /* packed and float vertices share the vertex shader */
+    pipelines_init(handles);
+    pipeline_key_init(&(handles->gfxPipelineKey), "vert.spv", "frag.spv");
+    handles->gfxPipelineKey.vertexFormat = handles->vertexFormat;
+    pipeline_key_init(&(handles->instancedPipelineKey), "inst_vert.spv", "frag.spv");
+    handles->instancedPipelineKey.instanced = true;
+    handles->depthPipeline = VK_NULL_HANDLE;
+    if (handles->depthPrepass)
+    {
+        /*
+         * the pre-pass writes the nearest depth without shading, then only
+         * fragments at exactly that depth are shaded, once per pixel
+         */
+        pipeline_key_t *colorKey = instanced ? &(handles->instancedPipelineKey) :
+                                               &(handles->gfxPipelineKey);
+        handles->depthPipelineKey = *colorKey;
+        handles->depthPipelineKey.frag = NULL;
+        handles->depthPipelineKey.colorWrite = false;
+        colorKey->depthWrite = false;
+        colorKey->depthCompare = VK_COMPARE_OP_EQUAL;
+    }
+
+    /* cache load and compute pipeline, the variants are timed by their builds */
+    float pipelineMs = 0.0f;
+    auto pipelineJob = thread_pool_run(handles, [&] {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        pipeline_cache_load(handles, PIPELINE_CACHE_FILE);
+
+        /* the variants are created by jobs of their own, in parallel */
+        pipeline_request(handles, &(handles->gfxPipelineKey));
+        if (instanced)
+        {
+            pipeline_request(handles, &(handles->instancedPipelineKey));
+        }
+        if (handles->depthPrepass)
+        {
+            pipeline_request(handles, &(handles->depthPipelineKey));
+        }
+
+        cullRead.get();
+        if (handles->gpuDriven)
+        {
+            cull_create_pipeline(handles, cullCode);
+        }
+
+        pipelineMs = ms_since(start);
+    });
+
+    /* scene data is needed by the first frame anyway, wait for it to time the upload */
+    float uploadMs = 0.0f;
+    auto uploadJob = thread_pool_run(handles, [&] {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        upload_init(handles);
+        size_t vertexCount, indexCount;
+        const Vertex *vertices = scene_vertices(scene, &vertexCount);
+        VkIndexType indexType;
+        const void *indices = scene_indices(scene, &indexCount, &indexType);
+        create_vertex_buffer(handles, vertices, vertexCount);
+        create_index_buffer(handles, indices, indexCount, indexType);
+        handles->uploadBytes = vertexCount * vertex_format_size(handles->vertexFormat) +
+                               indexCount * index_size(indexType);
+        if (handles->gpuDriven)
+        {
+            cull_create_buffers(handles, scene);
+        }
+        upload_wait(handles, upload_flush(handles));
+
+        uploadMs = ms_since(start);
+    });
+
+    if (handles->headless)
+    {
+        /* one image per frame in flight, free once the frame's fence signals */
+        create_offscreen_images(handles, handles->framesInFlight);
+    }
+    else
+    {
+        swapchain_init(handles);
+    }
+    create_depth_buffers(handles);
+    create_framebuffers(handles);
+    phase_done("swapchain", &phase);
+
+    create_uniform_buffer(handles);
+    handles->objects = NULL;
+    handles->instanceCount = (uint32_t)scene->instances.size();
+    if (instanced)
+    {
+        handles->objects = new object_store_t();
+        object_store_init(handles->objects);
+        for (auto inst = scene->instances.begin(); inst != scene->instances.end(); ++inst)
+        {
+            object_store_add(handles->objects, inst->pos, inst->angle, inst->spin,
+                             inst->scale, inst->radius, inst->color);
+        }
+        printf("%u instances, %s object store kernels\n", handles->instanceCount,
+               store_simd_name(handles->objects->simd));
+        create_instance_buffer(handles);
+    }
+    descriptors_init(handles);
+    create_descriptor_set(handles);
+    create_sync_objects(handles);
+    create_command_buffers(handles);
+    if (handles->profileEnabled)
+    {
+        profiler_init(handles, handles->tracePath);
+    }
+    handles->draws = scene->draws;
+    handles->objectModels = scene->objects;
+    if (handles->objectModels.empty())
+    {
+        handles->objectModels.push_back(glm::mat4(1.0f));
+    }
+    for (auto draw = handles->draws.begin(); draw != handles->draws.end(); ++draw)
+    {
+        if (draw->object >= handles->objectModels.size())
+        {
+            throw std::runtime_error("draw of a missing object!");
+        }
+    }
+    handles->objectPush.resize(handles->objectModels.size());
+    handles->trianglesDrawn = 0;
+    /* GPU driven draws are culled in a compute pass, always full detail */
+    handles->drawLods.clear();
+    handles->drawSpheres.clear();
+    if (!handles->gpuDriven && handles->lodPixelError > 0.0f && !scene->lods.empty())
+    {
+        handles->drawLods = scene->lods;
+        for (size_t i = 0; i < scene->draws.size(); i++)
+        {
+            handles->drawSpheres.push_back(scene->lods[i].empty() ? glm::vec4(0.0f) :
+                                                                    scene_draw_sphere(scene, i));
+        }
+        printf("  levels of detail up to %.1f pixels of error\n", handles->lodPixelError);
+    }
+    phase_done("frame resources", &phase);
+
+    /* rethrows anything thrown by the jobs, like missing shader files */
+    pipelineJob.get();
+    uploadJob.get();
+    handles->gfxPipeline = pipeline_wait(handles, &(handles->gfxPipelineKey));
+    handles->instancedPipeline = instanced ?
+        pipeline_wait(handles, &(handles->instancedPipelineKey)) : VK_NULL_HANDLE;
+    if (handles->depthPrepass)
+    {
+        handles->depthPipeline = pipeline_wait(handles, &(handles->depthPipelineKey));
+    }
+    if (handles->gpuDriven)
+    {
+        cull_create_descriptor_set(handles);
+    }
+    descriptors_flush(handles);
+    phase_done("wait for jobs", &phase);
+    printf("  %-24s %8.2f ms\n", "[pipeline job]", pipelineMs);
+    /* all variants were waited for, to see the effect of the cache */
+    printf("  %-24s %8.2f ms (%s pipeline cache)\n", "[pipeline builds]",
+           pipelines_build_ms(handles), handles->pipelineCacheWarm ? "warm" : "cold");
+    printf("  %-24s %8.2f ms\n", "[upload job]", uploadMs);
+
+    handles->uploadSeconds = uploadMs / 1000.0f;
+
+    handles->startupSeconds = ms_since(handles->initStart) / 1000.0f;
+    printf("  %-24s %8.2f ms\n", "total", handles->startupSeconds * 1000.0f);
+
+    if (handles->hotReload)
+    {
+        shader_reload_init(handles);
+    }
+
+    gpu_alloc_dump_stats(handles);
+}
+
+/* report time from the start of init_vulkan() to the first frame submission */
+static void
+first_frame_submitted(handles_t *handles)
+{
+    if (handles->firstFrameSubmitted)
+    {
+        return;
+    }
+
+    handles->firstFrameSubmitted = true;
+    printf("time to first frame %.2f ms\n", ms_since(handles->initStart));
+}
+
+void
+cleanup_vulkan(handles_t *handles)
+{
+    printf("cleanup...\n");
+
+    /* destroy semaphores and fences */
+    for (uint32_t i = 0; i < handles->framesInFlight; i++)
+    {
+        vkDestroySemaphore(handles->device, handles->imageAvailableSemaphores[i], NULL);
+        vkDestroySemaphore(handles->device, handles->renderFinishedSemaphores[i], NULL);
+        vkDestroyFence(handles->device, handles->inFlightFences[i], NULL);
+    }
+
+    /* print final timings and destroy query pool */
+    profiler_cleanup(handles);
+
+    /* destroy command pools */
+    cleanup_command_buffers(handles);
+
+    /* destroy frame buffers and their depth buffers */
+    cleanup_framebuffers(handles);
+    destroy_depth_buffers(handles, &(handles->depthBuffers));
+
+    /* stop watching shaders */
+    shader_reload_cleanup(handles);
+
+    /* wait for pipeline builds and destroy the pipelines */
+    pipelines_cleanup(handles);
+
+    /* destroy render pass */
+    vkDestroyRenderPass(handles->device, handles->renderPass, NULL);
+
+    /* write back and destroy pipeline cache */
+    pipeline_cache_save(handles);
+
+    cull_cleanup(handles);
+
+    vkDestroyPipelineLayout(handles->device, handles->pipelineLayout, NULL);
+
+    /* destroy descriptor set layout */
+    vkDestroyDescriptorSetLayout(handles->device, handles->descriptorSetLayout, NULL);
+
+    /* destroy swapchain or offscreen images */
+    if (handles->headless)
+    {
+        cleanup_offscreen_images(handles);
+    }
+    else
+    {
+        swapchain_cleanup(handles);
+    }
+
+    /* destroy descriptor pools */
+    descriptors_cleanup(handles);
+
+    /* destroy index buffer */
+    vkDestroyBuffer(handles->device, handles->indexBuffer, NULL);
+    gpu_free(handles, &(handles->indexBufferAlloc));
+
+    /* destroy vertix buffer */
+    vkDestroyBuffer(handles->device, handles->vertexBuffer, NULL);
+    gpu_free(handles, &(handles->vertexBufferAlloc));
+
+    /* destroy instance buffer */
+    if (handles->instanceCount > 0)
+    {
+        vkDestroyBuffer(handles->device, handles->instanceBuffer, NULL);
+        gpu_free(handles, &(handles->instanceBufferAlloc));
+        delete handles->objects;
+        handles->objects = NULL;
+    }
+
+    /* destroy uniform buffer */
+    vkDestroyBuffer(handles->device, handles->uniformBuffer, NULL);
+    gpu_free(handles, &(handles->uniformBufferAlloc));
+
+    /* destroy staging ring */
+    upload_cleanup(handles);
+
+    /* stop workers */
+    thread_pool_cleanup(handles);
+
+    /* release device memory blocks */
+    gpu_alloc_cleanup(handles);
+
+	/* destroy device */
+	vkDestroyDevice(handles->device, NULL);
+
+	/* destroy debug callback handle */
+	auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
+		handles->instance,
+		"vkDestroyDebugReportCallbackEXT");
+	func(handles->instance, handles->debug_cb, NULL);
+
+	/* destroy window surface */
+	if (!handles->headless)
+	{
+		vkDestroySurfaceKHR(handles->instance, handles->surface, NULL);
+	}
+
+	/* destroy vulkan instance */
+	vkDestroyInstance(handles->instance, NULL);
+}
+
+/*
+ * write this frame's UBO straight into its persistently mapped ring slot,
+ * the slot is not read by the GPU since the frame's fence has signaled,
+ * out gets a copy for culling and level of detail selection, the
+ * objects' transforms go to handles->objectPush
+ */
+static void
+update_uniform_buffer(handles_t *handles, uint32_t frame, UniformBufferObject *out)
+{
+    static auto startTime = std::chrono::high_resolution_clock::now();
+
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
+
+    UniformBufferObject ubo = {};
+    ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    ubo.proj = glm::perspective(
+        glm::radians(45.0f),
+        handles->swapchainExtend.width / (float) handles->swapchainExtend.height,
+        0.1f, 10.0f);
+    ubo.proj[1][1] *= -1;
+
+    char *slot = (char *)handles->uniformBufferMapped + frame * handles->uniformBufferStride;
+    memcpy(slot, &ubo, sizeof(ubo));
+
+    /* once per object here instead of for every vertex */
+    glm::mat4 viewProj = ubo.proj * ubo.view;
+    if (handles->instanceCount > 0)
+    {
+        handles->objectPush[0].transform = viewProj;
+    }
+    else
+    {
+        glm::mat4 dequant = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(handles->posOffset)),
+                                       glm::vec3(handles->posScale));
+        glm::mat4 spun = viewProj * ubo.model;
+        for (size_t i = 0; i < handles->objectModels.size(); i++)
+        {
+            handles->objectPush[i].transform = spun * handles->objectModels[i] * dequant;
+        }
+    }
+
+    *out = ubo;
+}
+
+/*
+ * spin every instance around its center and write the visible ones to the
+ * frame's slot of the instance ring, the instanced draws are recorded
+ * with the number of visible instances
+ */
+static void
+update_instances(handles_t *handles, uint32_t frame, const glm::mat4& viewProj)
+{
+    static auto lastTime = std::chrono::high_resolution_clock::now();
+
+    if (handles->instanceCount == 0)
+    {
+        return;
+    }
+
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    float dt = std::chrono::duration<float>(currentTime - lastTime).count();
+    lastTime = currentTime;
+
+    object_store_t *store = handles->objects;
+    object_store_update(handles, store, dt);
+
+    /* the GPU driven draw has a fixed instance count, write all of them */
+    Instance *dst = instance_buffer_slot(handles, frame);
+    uint32_t count = 0;
+    if (handles->gpuDriven)
+    {
+        for (uint32_t i = 0; i < handles->instanceCount; i++)
+        {
+            dst[i].model = store->model[i];
+            dst[i].color = store->color[i];
+        }
+        return;
+    }
+
+    object_store_cull(handles, store, viewProj);
+    for (uint32_t i = 0; i < handles->instanceCount; i++)
+    {
+        if (store->visible[i])
+        {
+            dst[count].model = store->model[i];
+            dst[count].color = store->color[i];
+            count++;
+        }
+    }
+
+    for (auto draw = handles->draws.begin(); draw != handles->draws.end(); ++draw)
+    {
+        draw->instanceCount = count;
+    }
+}
+
+void
+draw_frame(handles_t *handles)
+{
+    uint32_t frame = handles->currentFrame;
+    VkFence inFlightFence = handles->inFlightFences[frame];
+
+    /* resized since the last frame */
+    if (handles->swapchainStale && !swapchain_recreate(handles))
+    {
+        return;
+    }
+
+    /*
+     * wait until the GPU is done with the frame that used this slot
+     * framesInFlight frames ago, newer frames keep running meanwhile
+     */
+    uint64_t t = profiler_begin(handles);
+    check_res(
+        vkWaitForFences(handles->device, 1, &inFlightFence, VK_TRUE,
+                        std::numeric_limits<uint64_t>::max()),
+        "vkWaitForFences");
+    profiler_end(handles, PROF_FENCE_WAIT, t);
+    profiler_frame(handles, frame);
+    swapchain_frame(handles);
+    descriptors_frame(handles, frame);
+    pipelines_frame(handles);
+
+    /* input, here just the animation time, is sampled with the UBO */
+    t = profiler_begin(handles);
+    uint64_t input = t;
+    UniformBufferObject ubo;
+    update_uniform_buffer(handles, frame, &ubo);
+    update_instances(handles, frame, ubo.proj * ubo.view);
+    handles->trianglesDrawn += lod_select(handles, &ubo);
+    profiler_end(handles, PROF_UPDATE_UBO, t);
+
+    uint32_t imageIndex;
+
+    /* acquire image, suboptimal images can still be presented */
+    t = profiler_begin(handles);
+    VkResult res = vkAcquireNextImageKHR(handles->device,
+                                         handles->swapchain,
+                                         std::numeric_limits<uint64_t>::max(),
+                                         handles->imageAvailableSemaphores[frame], VK_NULL_HANDLE,
+                                         &imageIndex);
+    profiler_end(handles, PROF_ACQUIRE, t);
+    if (res == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        /* nothing was submitted, the slot's fence is still signaled */
+        swapchain_recreate(handles);
+        return;
+    }
+    if (res != VK_SUBOPTIMAL_KHR)
+    {
+        check_res(res, "vkAcquireNextImageKHR");
+    }
+    swapchain_acquired(handles, imageIndex);
+
+    t = profiler_begin(handles);
+    VkCommandBuffer cmdBuf = record_frame(handles, frame, imageIndex);
+    profiler_end(handles, PROF_RECORD, t);
+
+    check_res(
+        vkResetFences(handles->device, 1, &inFlightFence),
+        "vkResetFences");
+
+    /* sumbit command buffer */
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+    VkSemaphore waitSemaphores[] = {handles->imageAvailableSemaphores[frame]};
+    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = waitSemaphores;
+    submitInfo.pWaitDstStageMask = waitStages;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuf;
+    VkSemaphore signalSemaphores[] = {handles->renderFinishedSemaphores[frame]};
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = signalSemaphores;
+
+    std::lock_guard<std::mutex> guard(handles->queueLock);
+
+    t = profiler_begin(handles);
+    check_res(
+        vkQueueSubmit(handles->gfxQueue, 1, &submitInfo, inFlightFence),
+        "vkQueueSubmit");
+    profiler_end(handles, PROF_SUBMIT, t);
+    first_frame_submitted(handles);
+
+
+    /* present */
+
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = signalSemaphores;
+
+    VkSwapchainKHR swapChains[] = {handles->swapchain};
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = swapChains;
+    presentInfo.pImageIndices = &imageIndex;
+    presentInfo.pNext = swapchain_presenting(handles, imageIndex, input);
+
+    t = profiler_begin(handles);
+    res = vkQueuePresentKHR(handles->presentationQueue, &presentInfo);
+    profiler_end(handles, PROF_PRESENT, t);
+
+    /* the window changed, recreate before the next frame */
+    if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR)
+    {
+        handles->swapchainStale = true;
+    }
+    else
+    {
+        check_res(res, "vkQueuePresentKHR");
+    }
+
+    handles->currentFrame = (frame + 1) % handles->framesInFlight;
+}
+
+/*
+ * render a frame into the offscreen image of the frame slot, nothing
+ * to acquire or present so the fence is the only synchronization needed,
+ * returns the image rendered to
+ */
+uint32_t
+draw_frame_headless(handles_t *handles)
+{
+    uint32_t frame = handles->currentFrame;
+    VkFence inFlightFence = handles->inFlightFences[frame];
+
+    uint64_t t = profiler_begin(handles);
+    check_res(
+        vkWaitForFences(handles->device, 1, &inFlightFence, VK_TRUE,
+                        std::numeric_limits<uint64_t>::max()),
+        "vkWaitForFences");
+    profiler_end(handles, PROF_FENCE_WAIT, t);
+    profiler_frame(handles, frame);
+    descriptors_frame(handles, frame);
+    pipelines_frame(handles);
+
+    t = profiler_begin(handles);
+    UniformBufferObject ubo;
+    update_uniform_buffer(handles, frame, &ubo);
+    update_instances(handles, frame, ubo.proj * ubo.view);
+    handles->trianglesDrawn += lod_select(handles, &ubo);
+    profiler_end(handles, PROF_UPDATE_UBO, t);
+
+    /* offscreen image of the frame slot is free too */
+    t = profiler_begin(handles);
+    VkCommandBuffer cmdBuf = record_frame(handles, frame, frame);
+    profiler_end(handles, PROF_RECORD, t);
+
+    check_res(
+        vkResetFences(handles->device, 1, &inFlightFence),
+        "vkResetFences");
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuf;
+
+    std::lock_guard<std::mutex> guard(handles->queueLock);
+
+    t = profiler_begin(handles);
+    check_res(
+        vkQueueSubmit(handles->gfxQueue, 1, &submitInfo, inFlightFence),
+        "vkQueueSubmit");
+    profiler_end(handles, PROF_SUBMIT, t);
+    first_frame_submitted(handles);
+
+    handles->currentFrame = (frame + 1) % handles->framesInFlight;
+
+    return frame;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "main.h"
+#include "scene.h"
+
+/*
+ * Vulkan set-up, per frame rendering and tear-down, shared by the
+ * interactive program and the benchmark.
+ */
+
+/* set option fields of handles to their defaults */
+void
+renderer_defaults(handles_t *handles);
+
+/* create everything needed to render scene, window must exist unless headless */
+void
+init_vulkan(handles_t *handles, const scene_t *scene);
+
+void
+cleanup_vulkan(handles_t *handles);
+
+/* render and present one frame to the window */
+void
+draw_frame(handles_t *handles);
+
+/* render one offscreen frame, returns the image rendered to */
+uint32_t
+draw_frame_headless(handles_t *handles);
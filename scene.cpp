@@ -0,0 +1,242 @@
+#include <math.h>
+
+#include "scene.h"
+#include "mesh_cache.h"
+
+/* largest square grid tile addressable with 16 bit indices */
+#define TILE_CELLS 128
+
+scene_t
+scene_quad()
+{
+    scene_t scene;
+
+    scene.name = "quad";
+    scene.vertices =
+    {
+        {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}},
+        {{0.5f, -0.5f, 0.0f},  {0.0f, 1.0f, 0.0f}},
+        {{0.5f, 0.5f, 0.0f},   {0.0f, 0.0f, 1.0f}},
+        {{-0.5f, 0.5f, 0.0f},  {1.0f, 1.0f, 1.0f}},
+    };
+    scene.indices =
+    {
+        0, 1, 2, 2, 3, 0
+    };
+    scene.draws.push_back({6, 0, 0, 1, 0, 0});
+
+    return scene;
+}
+
+/* indices of a cells x cells grid of (cells + 1)^2 vertices */
+static void
+grid_indices(uint32_t cells, std::vector<uint16_t>& indices)
+{
+    uint32_t row = cells + 1;
+
+    for (uint32_t y = 0; y < cells; y++)
+    {
+        for (uint32_t x = 0; x < cells; x++)
+        {
+            uint16_t v = (uint16_t)(y * row + x);
+
+            indices.push_back(v);
+            indices.push_back(v + 1);
+            indices.push_back(v + row + 1);
+            indices.push_back(v + row + 1);
+            indices.push_back(v + row);
+            indices.push_back(v);
+        }
+    }
+}
+
+scene_t
+scene_mesh(uint32_t triangles)
+{
+    scene_t scene;
+    uint32_t cells;
+    uint32_t tiles;
+
+    scene.name = "mesh-" + std::to_string(triangles);
+
+    if (triangles <= 2 * TILE_CELLS * TILE_CELLS)
+    {
+        cells = (uint32_t)ceil(sqrt(triangles / 2.0));
+        tiles = 1;
+    }
+    else
+    {
+        cells = TILE_CELLS;
+        tiles = (triangles + 2 * TILE_CELLS * TILE_CELLS - 1) / (2 * TILE_CELLS * TILE_CELLS);
+    }
+
+    /* all tiles share the same indices, each is drawn at its own vertex offset */
+    grid_indices(cells, scene.indices);
+
+    uint32_t tilesPerRow = (uint32_t)ceil(sqrt((double)tiles));
+    float tileSize = 2.0f / tilesPerRow;
+    uint32_t row = cells + 1;
+
+    for (uint32_t t = 0; t < tiles; t++)
+    {
+        float x0 = -1.0f + (t % tilesPerRow) * tileSize;
+        float y0 = -1.0f + (t / tilesPerRow) * tileSize;
+
+        scene.draws.push_back({(uint32_t)scene.indices.size(), 0,
+                               (int32_t)scene.vertices.size(), 1, 0, 0});
+
+        for (uint32_t y = 0; y < row; y++)
+        {
+            for (uint32_t x = 0; x < row; x++)
+            {
+                float u = x / (float)cells;
+                float v = y / (float)cells;
+                scene.vertices.push_back({{x0 + u * tileSize, y0 + v * tileSize, 0.0f},
+                                          {u, v, 1.0f - u}});
+            }
+        }
+    }
+
+    return scene;
+}
+
+scene_t
+scene_quads(uint32_t draw_count)
+{
+    scene_t scene;
+
+    scene.name = "draws-" + std::to_string(draw_count);
+    scene.indices = {0, 1, 2, 2, 3, 0};
+
+    uint32_t perRow = (uint32_t)ceil(sqrt((double)draw_count));
+    float cell = 2.0f / perRow;
+    /* leave a gap between the quads */
+    float size = cell * 0.8f;
+
+    for (uint32_t i = 0; i < draw_count; i++)
+    {
+        float x0 = -1.0f + (i % perRow) * cell;
+        float y0 = -1.0f + (i / perRow) * cell;
+        float c = i / (float)draw_count;
+
+        scene.draws.push_back({6, 0, (int32_t)scene.vertices.size(), 1, 0, 0});
+
+        scene.vertices.push_back({{x0, y0, 0.0f},               {c, 0.0f, 1.0f - c}});
+        scene.vertices.push_back({{x0 + size, y0, 0.0f},        {c, 1.0f, 1.0f - c}});
+        scene.vertices.push_back({{x0 + size, y0 + size, 0.0f}, {1.0f, c, 0.0f}});
+        scene.vertices.push_back({{x0, y0 + size, 0.0f},        {0.0f, c, 1.0f}});
+    }
+
+    return scene;
+}
+
+scene_t
+scene_instanced(uint32_t instance_count)
+{
+    scene_t scene = scene_quad();
+
+    scene.name = "instances-" + std::to_string(instance_count);
+    scene.draws[0].instanceCount = instance_count;
+
+    uint32_t perRow = (uint32_t)ceil(sqrt((double)instance_count));
+    float cell = 2.0f / perRow;
+
+    for (uint32_t i = 0; i < instance_count; i++)
+    {
+        float c = i / (float)instance_count;
+        scene_instance_t instance;
+
+        /* the base quad is one unit wide, center it in its cell */
+        instance.pos = glm::vec3(-1.0f + (i % perRow + 0.5f) * cell,
+                                 -1.0f + (i / perRow + 0.5f) * cell,
+                                 0.0f);
+        instance.angle = c * 6.28f;
+        instance.spin = glm::radians(90.0f);
+        instance.scale = cell * 0.8f;
+        instance.radius = 0.7072f;
+        instance.color = glm::vec3(1.0f - c, 1.0f, c);
+
+        scene.instances.push_back(instance);
+    }
+
+    return scene;
+}
+
+uint32_t
+scene_triangles(const scene_t *scene)
+{
+    uint32_t triangles = 0;
+
+    for (auto draw = scene->draws.begin(); draw != scene->draws.end(); ++draw)
+    {
+        triangles += draw->indexCount / 3 * draw->instanceCount;
+    }
+
+    return triangles;
+}
+
+const Vertex *
+scene_vertices(const scene_t *scene, size_t *count)
+{
+    if (scene->cache)
+    {
+        return mesh_cache_vertices(scene->cache.get(), count);
+    }
+
+    *count = scene->vertices.size();
+    return scene->vertices.data();
+}
+
+const void *
+scene_indices(const scene_t *scene, size_t *count, VkIndexType *type)
+{
+    if (scene->cache)
+    {
+        return mesh_cache_indices(scene->cache.get(), count, type);
+    }
+
+    if (!scene->indices32.empty())
+    {
+        *count = scene->indices32.size();
+        *type = VK_INDEX_TYPE_UINT32;
+        return scene->indices32.data();
+    }
+
+    *count = scene->indices.size();
+    *type = VK_INDEX_TYPE_UINT16;
+    return scene->indices.data();
+}
+
+glm::vec4
+scene_draw_sphere(const scene_t *scene, size_t i)
+{
+    if (i < scene->spheres.size())
+    {
+        return scene->spheres[i];
+    }
+
+    const draw_t *draw = &(scene->draws[i]);
+    size_t vertexCount, indexCount;
+    const Vertex *vertices = scene_vertices(scene, &vertexCount);
+    VkIndexType indexType;
+    const void *indices = scene_indices(scene, &indexCount, &indexType);
+
+    glm::vec3 lo(0.0f);
+    glm::vec3 hi(0.0f);
+
+    for (uint32_t j = 0; j < draw->indexCount; j++)
+    {
+        uint32_t index = read_index(indices, indexType, draw->firstIndex + j) + draw->vertexOffset;
+        glm::vec3 pos = vertices[index].pos;
+
+        if (j == 0)
+        {
+            lo = hi = pos;
+        }
+        lo = glm::min(lo, pos);
+        hi = glm::max(hi, pos);
+    }
+
+    glm::vec3 center = (lo + hi) * 0.5f;
+    return glm::vec4(center, glm::length(hi - center));
+}
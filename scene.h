@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "main.h"
+
+/* placement of one instance, see object_store.h */
+typedef struct scene_instance_s
+{
+    glm::vec3 pos;
+    /* rotation around z in radians and its speed in radians per second */
+    float angle;
+    float spin;
+    float scale;
+    /* bounding sphere radius of the mesh at scale 1 */
+    float radius;
+    glm::vec3 color;
+} scene_instance_t;
+
+/*
+ * Geometry to render, uploaded to the vertex and index buffers at
+ * init_vulkan() and drawn with the listed draws every frame.
+ */
+typedef struct scene_s
+{
+    std::string name;
+    std::vector<Vertex> vertices;
+    std::vector<uint16_t> indices;
+    /* used instead of indices if a draw addresses more than 65536 vertices */
+    std::vector<uint32_t> indices32;
+    std::vector<draw_t> draws;
+    /*
+     * model transforms of the objects the draws place, see draw_t::object,
+     * empty if every draw is in model space, not stored in mesh caches
+     */
+    std::vector<glm::mat4> objects;
+    /* per instance data, empty for non-instanced scenes */
+    std::vector<scene_instance_t> instances;
+    /* bounding spheres of the draws if known, see scene_draw_sphere() */
+    std::vector<glm::vec4> spheres;
+    /*
+     * levels of detail of draws[i], finest first starting with the draw
+     * itself, empty if none were built, see mesh_lod.h
+     */
+    std::vector<std::vector<draw_lod_t> > lods;
+    /*
+     * set if vertices and indices are empty because the data lives in a
+     * mapped mesh cache, use scene_vertices() and scene_indices()
+     */
+    std::shared_ptr<const mesh_cache_s> cache;
+} scene_t;
+
+/* the classic colored quad */
+scene_t
+scene_quad();
+
+/*
+ * a grid mesh of at least triangles triangles, split into tiles small
+ * enough for 16 bit indices, drawn with one draw per tile
+ */
+scene_t
+scene_mesh(uint32_t triangles);
+
+/* draw_count separate small quads, one draw call each */
+scene_t
+scene_quads(uint32_t draw_count);
+
+/* instance_count small quads in a single instanced draw */
+scene_t
+scene_instanced(uint32_t instance_count);
+
+uint32_t
+scene_triangles(const scene_t *scene);
+
+const Vertex *
+scene_vertices(const scene_t *scene, size_t *count);
+
+/* 16 or 32 bit indices as given by type */
+const void *
+scene_indices(const scene_t *scene, size_t *count, VkIndexType *type);
+
+static inline size_t
+index_size(VkIndexType type)
+{
+    return type == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+static inline uint32_t
+read_index(const void *indices, VkIndexType type, size_t i)
+{
+    return type == VK_INDEX_TYPE_UINT32 ? ((const uint32_t *)indices)[i] :
+                                          ((const uint16_t *)indices)[i];
+}
+
+/* xyz center and radius of the vertices referenced by draw i */
+glm::vec4
+scene_draw_sphere(const scene_t *scene, size_t i);
@@ -1,14 +1,14 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 0) uniform UniformBufferObject
+/* DrawPushConstants in main.h, the draw's object to clip space transform */
+layout(push_constant) uniform DrawPushConstants
 {
-    mat4 model;
-    mat4 view;
-    mat4 proj;
-} ubo;
+    mat4 transform;
+} draw;
 
-layout(location = 0) in vec2 inPosition;
+/* floats, or R16G16B16A16_UNORM and R8G8B8A8_UNORM for packed vertices */
+layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
@@ -17,9 +17,11 @@ out gl_PerVertex
 {
     vec4 gl_Position;
 };
+/* bit exact across pipelines, the depth pre-pass is tested with EQUAL */
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
+    gl_Position = draw.transform * vec4(inPosition, 1.0);
     fragColor = inColor;
 }
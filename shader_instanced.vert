@@ -0,0 +1,31 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/* DrawPushConstants in main.h, instance models are applied before it */
+layout(push_constant) uniform DrawPushConstants
+{
+    mat4 transform;
+} draw;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+
+/* per instance, the model matrix takes locations 2 to 5 */
+layout(location = 2) in mat4 inModel;
+layout(location = 6) in vec3 inInstanceColor;
+
+layout(location = 0) out vec3 fragColor;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+/* bit exact across pipelines, the depth pre-pass is tested with EQUAL */
+invariant gl_Position;
+
+void main()
+{
+    /* instances are placed in the world by their own model matrix */
+    gl_Position = draw.transform * (inModel * vec4(inPosition, 1.0));
+    fragColor = inColor * inInstanceColor;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "shader_reload.h"
+#include "pipelines.h"
+#include "utils.h"
+
+/* how often the watcher checks if it should stop */
+#define RELOAD_POLL_MS 200
+/* editors save in several writes, wait for this long a quiet period */
+#define RELOAD_SETTLE_MS 50
+
+/* a source and the SPIR-V file the Makefile compiles it to */
+typedef struct shader_source_s
+{
+    const char *source;
+    const char *spirv;
+} shader_source_t;
+
+static const shader_source_t shader_sources[] =
+{
+    {"shader.vert",           "vert.spv"},
+    {"shader_instanced.vert", "inst_vert.spv"},
+    {"shader.frag",           "frag.spv"},
+};
+
+struct shader_reload_s
+{
+    int fd;
+    std::atomic<bool> stop;
+    std::thread thread;
+};
+
+static std::string
+compiler_path()
+{
+    const char *sdk = getenv("VULKAN_SDK");
+    if (sdk == NULL)
+    {
+        return "glslangValidator";
+    }
+
+    return std::string(sdk) + "/bin/glslangValidator";
+}
+
+/*
+ * compile to a temporary file renamed over the old SPIR-V, so a failed
+ * compile leaves the old one for the next start
+ */
+static bool
+compile(const shader_source_t *shader)
+{
+    std::string tmpPath = std::string(shader->spirv) + ".tmp";
+    std::string cmd = compiler_path() + " -V " + shader->source + " -o " + tmpPath + " 2>&1";
+
+    FILE *p = popen(cmd.c_str(), "r");
+    if (p == NULL)
+    {
+        printf("can't run %s\n", cmd.c_str());
+        return false;
+    }
+
+    std::string output;
+    char line[256];
+    while (fgets(line, sizeof(line), p) != NULL)
+    {
+        output += line;
+    }
+
+    if (pclose(p) != 0)
+    {
+        printf("%s failed to compile, keeping the old pipeline\n%s", shader->source, output.c_str());
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    if (rename(tmpPath.c_str(), shader->spirv) != 0)
+    {
+        printf("can't replace %s\n", shader->spirv);
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static void
+rebuild(handles_t *handles, const std::set<std::string>& changed)
+{
+    for (size_t i = 0; i < sizeof(shader_sources) / sizeof(shader_sources[0]); i++)
+    {
+        const shader_source_t *shader = &(shader_sources[i]);
+        if (changed.count(shader->source) > 0 && compile(shader))
+        {
+            pipelines_rebuild(handles, shader->spirv);
+        }
+    }
+}
+
+#ifdef __linux__
+static void
+watcher_thread(handles_t *handles)
+{
+    shader_reload_s *sr = handles->shaderReload;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    struct pollfd pfd = {};
+    pfd.fd = sr->fd;
+    pfd.events = POLLIN;
+
+    while (!sr->stop)
+    {
+        if (poll(&pfd, 1, RELOAD_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        std::set<std::string> changed;
+        do
+        {
+            ssize_t len = read(sr->fd, buf, sizeof(buf));
+            for (char *p = buf; len > 0 && p < buf + len;)
+            {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                if (event->len > 0)
+                {
+                    changed.insert(event->name);
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        } while (poll(&pfd, 1, RELOAD_SETTLE_MS) > 0);
+
+        rebuild(handles, changed);
+    }
+}
+#endif
+
+void
+shader_reload_init(handles_t *handles)
+{
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    /* written in place or saved to a temporary file renamed over it */
+    if (fd < 0 || inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        printf("can't watch shader sources, hot reload disabled\n");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+
+    shader_reload_s *sr = new shader_reload_s();
+    sr->fd = fd;
+    sr->stop = false;
+    handles->shaderReload = sr;
+
+    printf("watching shader sources, compiling with %s\n", compiler_path().c_str());
+
+    sr->thread = std::thread(watcher_thread, handles);
+#else
+    printf("shader hot reload needs inotify, disabled\n");
+#endif
+}
+
+void
+shader_reload_cleanup(handles_t *handles)
+{
+    shader_reload_s *sr = handles->shaderReload;
+    if (sr == NULL)
+    {
+        return;
+    }
+
+    sr->stop = true;
+    sr->thread.join();
+#ifdef __linux__
+    close(sr->fd);
+#endif
+
+    delete sr;
+    handles->shaderReload = NULL;
+}
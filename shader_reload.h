@@ -0,0 +1,23 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Shader hot reload, Linux only.
+ *
+ * A watcher thread gets inotify events for the shader sources in the
+ * working directory and recompiles a changed source to its .spv file
+ * with glslangValidator, from $VULKAN_SDK/bin if that is set, else from
+ * the PATH. The pipeline variants using it are then created again on
+ * the watcher thread and swapped in between frames, see pipelines.h. If a
+ * shader fails to compile, the compiler output is printed and the old
+ * pipelines are kept.
+ */
+
+/* start watching, needs the pipeline variants */
+void
+shader_reload_init(handles_t *handles);
+
+/* stop watching, before pipelines_cleanup() */
+void
+shader_reload_cleanup(handles_t *handles);
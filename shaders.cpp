@@ -5,8 +5,12 @@
 VkShaderModule
 load_shader(handles_t *handles, const std::string& filename)
 {
-    auto shaderCode = read_file(filename);
+    return create_shader_module(handles, read_file(filename));
+}
 
+VkShaderModule
+create_shader_module(handles_t *handles, const std::vector<char>& shaderCode)
+{
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.codeSize = shaderCode.size();
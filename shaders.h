@@ -6,4 +6,8 @@
 #include "main.h"
 
 VkShaderModule
-load_shader(handles_t *handles, const std::string& filename);
\ No newline at end of file
+load_shader(handles_t *handles, const std::string& filename);
+
+/* create module from SPIR-V already read into memory */
+VkShaderModule
+create_shader_module(handles_t *handles, const std::vector<char>& shaderCode);
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <chrono>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "main.h"
+#include "object_store.h"
+#include "thread_pool.h"
+
+/*
+ * Microbenchmark of the object store kernels, reports objects per second
+ * for the transform update and frustum culling with each kernel the CPU
+ * supports, on one thread and on the thread pool, relative to the scalar
+ * glm path on one thread.
+ */
+
+#define DEFAULT_OBJECTS 1000000
+#define DEFAULT_ITERATIONS 50
+
+static void
+usage(const char *prog)
+{
+    printf("usage: %s [--objects N] [--iterations N] [--threads N]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+/* objects scattered around the origin, about half of them in view */
+static void
+fill_store(object_store_t *store, uint32_t count)
+{
+    srand(1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        glm::vec3 pos(rand() / (float)RAND_MAX * 8.0f - 4.0f,
+                      rand() / (float)RAND_MAX * 8.0f - 4.0f,
+                      rand() / (float)RAND_MAX * 2.0f - 1.0f);
+        float angle = rand() / (float)RAND_MAX * 6.28f;
+        float spin = rand() / (float)RAND_MAX * 4.0f - 2.0f;
+
+        object_store_add(store, pos, angle, spin, 0.05f, 0.71f, glm::vec3(1.0f));
+    }
+}
+
+/* returns millions of objects per second for update and cull */
+static void
+run(handles_t *handles, object_store_t *store, uint32_t iterations,
+    float *updateRate, float *cullRate, uint32_t *visible)
+{
+    glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f),
+                                 glm::vec3(0.0f, 0.0f, 0.0f),
+                                 glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), 800 / 600.0f, 0.1f, 10.0f);
+    proj[1][1] *= -1;
+    glm::mat4 viewProj = proj * view;
+
+    float objects = (float)object_store_size(store) * iterations / 1.0e6f;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        object_store_update(handles, store, 1.0f / 60.0f);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    *updateRate = objects / std::chrono::duration<float>(end - start).count();
+
+    *visible = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        *visible = object_store_cull(handles, store, viewProj);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    *cullRate = objects / std::chrono::duration<float>(end - start).count();
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t objects = DEFAULT_OBJECTS;
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    uint32_t threads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--objects") == 0 && i + 1 < argc)
+        {
+            int n = atoi(argv[++i]);
+            if (n < 1)
+            {
+                usage(argv[0]);
+            }
+            objects = n;
+        }
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+        {
+            int n = atoi(argv[++i]);
+            if (n < 1)
+            {
+                usage(argv[0]);
+            }
+            iterations = n;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    handles_t *handles = new handles_t();
+    thread_pool_init(handles, threads);
+
+    object_store_t store;
+    object_store_init(&store);
+    store_simd_t best = store.simd;
+    fill_store(&store, objects);
+
+    printf("%u objects, %u iterations, %u threads\n",
+           objects, iterations, thread_pool_size(handles));
+
+    float baseUpdate = 0.0f;
+    float baseCull = 0.0f;
+
+    printf("%-8s %-8s %14s %8s %14s %8s %10s\n",
+           "kernel", "threads", "update Mobj/s", "speedup", "cull Mobj/s", "speedup", "visible");
+    for (int simd = STORE_SCALAR; simd <= best; simd++)
+    {
+        for (int pooled = 0; pooled < 2; pooled++)
+        {
+            float updateRate, cullRate;
+            uint32_t visible;
+
+            store.simd = (store_simd_t)simd;
+            run(pooled ? handles : NULL, &store, iterations, &updateRate, &cullRate, &visible);
+
+            if (simd == STORE_SCALAR && !pooled)
+            {
+                baseUpdate = updateRate;
+                baseCull = cullRate;
+            }
+
+            printf("%-8s %-8u %14.1f %7.1fx %14.1f %7.1fx %10u\n",
+                   store_simd_name(store.simd), pooled ? thread_pool_size(handles) : 1,
+                   updateRate, updateRate / baseUpdate, cullRate, cullRate / baseCull,
+                   visible);
+        }
+    }
+
+    thread_pool_cleanup(handles);
+    delete handles;
+
+    return 0;
+}
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+
+#include "swapchain.h"
+#include "frame_buf.h"
+#include "depth.h"
+#include "profiler.h"
+#include "utils.h"
+
+/* presented frames remembered for latency, more means images never came back */
+#define PRESENT_HISTORY 64
+
+/* a replaced swapchain and what was created for its images */
+typedef struct retired_swapchain_s
+{
+    VkSwapchainKHR swapchain;
+    std::vector<VkImageView> imageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    std::vector<depth_buffer_t> depthBuffers;
+    /* the frame counter when it was replaced */
+    uint64_t frame;
+} retired_swapchain_t;
+
+typedef struct presented_s
+{
+    uint32_t image;
+    uint64_t input;
+    /* VkPresentTimeGOOGLE::presentID */
+    uint32_t presentId;
+} presented_t;
+
+struct swapchain_s
+{
+    /* frames started, counted in swapchain_frame() */
+    uint64_t frame;
+    std::vector<retired_swapchain_t> retired;
+    /* presented frames of the current swapchain, oldest first */
+    std::deque<presented_t> presented;
+
+    /* NULL without VK_GOOGLE_display_timing, latency is estimated then */
+    PFN_vkGetPastPresentationTimingGOOGLE getPastPresentationTiming;
+    uint32_t nextPresentId;
+    /* chained to the next present */
+    VkPresentTimeGOOGLE presentTime;
+    VkPresentTimesInfoGOOGLE presentTimes;
+    std::vector<VkPastPresentationTimingGOOGLE> timings;
+};
+
+static const VkPresentModeKHR present_modes[] =
+{
+    VK_PRESENT_MODE_FIFO_KHR,
+    VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+    VK_PRESENT_MODE_MAILBOX_KHR,
+    VK_PRESENT_MODE_IMMEDIATE_KHR,
+};
+
+const char *
+present_mode_name(VkPresentModeKHR mode)
+{
+    switch (mode)
+    {
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+            return "fifo-relaxed";
+        case VK_PRESENT_MODE_MAILBOX_KHR:
+            return "mailbox";
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:
+            return "immediate";
+        default:
+            return "fifo";
+    }
+}
+
+bool
+present_mode_parse(const char *name, VkPresentModeKHR *mode)
+{
+    for (size_t i = 0; i < sizeof(present_modes) / sizeof(present_modes[0]); i++)
+    {
+        if (strcmp(name, present_mode_name(present_modes[i])) == 0)
+        {
+            *mode = present_modes[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* the requested mode if the surface has it, FIFO is always there */
+static VkPresentModeKHR
+select_present_mode(handles_t *handles, VkPresentModeKHR requested)
+{
+    uint32_t count;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(handles->phyDevice, handles->surface, &count, NULL);
+    std::vector<VkPresentModeKHR> modes(count);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(handles->phyDevice, handles->surface,
+                                              &count, modes.data());
+
+    if (std::find(modes.begin(), modes.end(), requested) != modes.end())
+    {
+        return requested;
+    }
+
+    printf("present mode %s not supported, using fifo\n", present_mode_name(requested));
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+/* surfaces without a fixed size take the window's framebuffer size */
+static VkExtent2D
+select_extent(handles_t *handles, const VkSurfaceCapabilitiesKHR *caps)
+{
+    if (caps->currentExtent.width != 0xffffffffu)
+    {
+        return caps->currentExtent;
+    }
+
+    int width, height;
+    glfwGetFramebufferSize(handles->window, &width, &height);
+
+    VkExtent2D extent;
+    extent.width = std::min(std::max((uint32_t)width, caps->minImageExtent.width),
+                            caps->maxImageExtent.width);
+    extent.height = std::min(std::max((uint32_t)height, caps->minImageExtent.height),
+                             caps->maxImageExtent.height);
+    return extent;
+}
+
+static void
+create_image_views(handles_t *handles)
+{
+    uint32_t count;
+
+    vkGetSwapchainImagesKHR(handles->device, handles->swapchain, &count, nullptr);
+    handles->swapChainImages.resize(count);
+    vkGetSwapchainImagesKHR(handles->device, handles->swapchain,
+                            &count, handles->swapChainImages.data());
+
+    handles->swapChainImageViews.resize(count);
+    for (size_t i = 0; i < handles->swapChainImages.size(); i++)
+    {
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = handles->swapChainImages[i];
+
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = FRAME_BUF_FORMAT;
+        viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        check_res(
+            vkCreateImageView(handles->device,
+                              &viewInfo,
+                              NULL,
+                              &(handles->swapChainImageViews[i])),
+            "vkCreateImageView error");
+    }
+}
+
+/* create handles->swapchain, replacing old unless it is VK_NULL_HANDLE */
+static void
+create_swapchain(handles_t *handles, VkSwapchainKHR old)
+{
+    VkSurfaceCapabilitiesKHR caps;
+    check_res(
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(handles->phyDevice,
+                                                  handles->surface,
+                                                  &caps),
+        "vkGetPhysicalDeviceSurfaceCapabilitiesKHR error");
+
+    /* one spare image, so the next one can be rendered while two are queued or shown */
+    uint32_t imageCount = caps.minImageCount + 1;
+    if (caps.maxImageCount > 0)
+    {
+        imageCount = std::min(imageCount, caps.maxImageCount);
+    }
+
+    VkCompositeAlphaFlagBitsKHR compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!(caps.supportedCompositeAlpha & compositeAlpha))
+    {
+        compositeAlpha = VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR;
+    }
+
+    VkSwapchainCreateInfoKHR createInfo = {};
+
+    createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    createInfo.surface = handles->surface;
+    createInfo.minImageCount = imageCount;
+    createInfo.imageFormat = FRAME_BUF_FORMAT;
+    createInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    createInfo.imageExtent = select_extent(handles, &caps);
+    createInfo.imageArrayLayers = 1;
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    /* we don't support the case when graphics and presentation queues are different */
+    assert(handles->gfxQueue == handles->presentationQueue);
+    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.queueFamilyIndexCount = 0;
+    createInfo.pQueueFamilyIndices = nullptr;
+    createInfo.preTransform = caps.currentTransform;
+    createInfo.compositeAlpha = compositeAlpha;
+    createInfo.presentMode = handles->presentMode;
+    createInfo.clipped = VK_TRUE;
+    /* lets the driver reuse resources and keep presenting meanwhile */
+    createInfo.oldSwapchain = old;
+
+    check_res(
+        vkCreateSwapchainKHR(handles->device,
+                             &createInfo,
+                             NULL,
+                             &(handles->swapchain)),
+        "vkCreateSwapchainKHR error");
+
+    handles->swapchainExtend = createInfo.imageExtent;
+    create_image_views(handles);
+}
+
+static void
+framebuffer_resized(GLFWwindow *window, int width, int height)
+{
+    handles_t *handles = (handles_t *)glfwGetWindowUserPointer(window);
+    handles->swapchainStale = true;
+}
+
+void
+swapchain_init(handles_t *handles)
+{
+    handles->swapchainState = new swapchain_s();
+    swapchain_s *state = handles->swapchainState;
+
+    state->getPastPresentationTiming = NULL;
+    state->nextPresentId = 1;
+    if (handles->displayTiming)
+    {
+        state->getPastPresentationTiming = (PFN_vkGetPastPresentationTimingGOOGLE)
+            vkGetDeviceProcAddr(handles->device, "vkGetPastPresentationTimingGOOGLE");
+    }
+    handles->swapchainState->frame = 0;
+    handles->swapchainStale = false;
+
+    handles->presentMode = select_present_mode(handles, handles->presentMode);
+    create_swapchain(handles, VK_NULL_HANDLE);
+
+    printf("  %s present mode, %zu swapchain images, %s latency\n",
+           present_mode_name(handles->presentMode), handles->swapChainImages.size(),
+           state->getPastPresentationTiming != NULL ? "measured" : "estimated");
+
+    glfwSetWindowUserPointer(handles->window, handles);
+    glfwSetFramebufferSizeCallback(handles->window, framebuffer_resized);
+}
+
+static void
+destroy_retired(handles_t *handles, retired_swapchain_t *retired)
+{
+    for (auto fb = retired->framebuffers.begin(); fb != retired->framebuffers.end(); ++fb)
+    {
+        vkDestroyFramebuffer(handles->device, *fb, NULL);
+    }
+    for (auto view = retired->imageViews.begin(); view != retired->imageViews.end(); ++view)
+    {
+        vkDestroyImageView(handles->device, *view, NULL);
+    }
+    destroy_depth_buffers(handles, &(retired->depthBuffers));
+    vkDestroySwapchainKHR(handles->device, retired->swapchain, NULL);
+}
+
+bool
+swapchain_recreate(handles_t *handles)
+{
+    swapchain_s *state = handles->swapchainState;
+
+    /* nothing to present to while minimized */
+    int width, height;
+    glfwGetFramebufferSize(handles->window, &width, &height);
+    while (width == 0 || height == 0)
+    {
+        if (glfwWindowShouldClose(handles->window))
+        {
+            return false;
+        }
+        glfwWaitEvents();
+        glfwGetFramebufferSize(handles->window, &width, &height);
+    }
+
+    /* frames in flight still render to and present the old images */
+    retired_swapchain_t retired;
+    retired.swapchain = handles->swapchain;
+    retired.imageViews.swap(handles->swapChainImageViews);
+    retired.framebuffers.swap(handles->swapChainFramebuffers);
+    retired.depthBuffers.swap(handles->depthBuffers);
+    retired.frame = state->frame;
+    state->retired.push_back(retired);
+    state->presented.clear();
+
+    create_swapchain(handles, retired.swapchain);
+    create_depth_buffers(handles);
+    create_framebuffers(handles);
+    handles->swapchainStale = false;
+
+    printf("swapchain recreated at %ux%u\n",
+           handles->swapchainExtend.width, handles->swapchainExtend.height);
+
+    return true;
+}
+
+void
+swapchain_frame(handles_t *handles)
+{
+    swapchain_s *state = handles->swapchainState;
+    if (state == NULL)
+    {
+        return;
+    }
+
+    /*
+     * every slot's fence has been waited on since a swapchain was retired
+     * once framesInFlight more frames started, so nothing uses it anymore
+     */
+    state->frame++;
+    for (auto retired = state->retired.begin(); retired != state->retired.end();)
+    {
+        if (state->frame > retired->frame + handles->framesInFlight)
+        {
+            destroy_retired(handles, &(*retired));
+            retired = state->retired.erase(retired);
+        }
+        else
+        {
+            ++retired;
+        }
+    }
+}
+
+/* latency up to the times the display engine reports for past presents */
+static void
+collect_present_times(handles_t *handles)
+{
+    swapchain_s *state = handles->swapchainState;
+    std::deque<presented_t>& presented = state->presented;
+
+    uint32_t count = 0;
+    if (state->getPastPresentationTiming(handles->device, handles->swapchain, &count, NULL) != VK_SUCCESS ||
+        count == 0)
+    {
+        return;
+    }
+    state->timings.resize(count);
+    VkResult res = state->getPastPresentationTiming(handles->device, handles->swapchain,
+                                                    &count, state->timings.data());
+    if (res != VK_SUCCESS && res != VK_INCOMPLETE)
+    {
+        return;
+    }
+
+    /* in present order, so the history is walked once */
+    for (uint32_t t = 0; t < count; t++)
+    {
+        const VkPastPresentationTimingGOOGLE *timing = &(state->timings[t]);
+        while (!presented.empty() && presented.front().presentId != timing->presentID)
+        {
+            presented.pop_front();
+        }
+        if (presented.empty())
+        {
+            break;
+        }
+
+        profiler_sample(handles, PROF_LATENCY, presented.front().input, timing->actualPresentTime);
+        presented.pop_front();
+    }
+}
+
+/*
+ * fallback estimate, the last frame shown from image was replaced by the
+ * one presented after it once image is acquired again
+ */
+static void
+estimate_latency(handles_t *handles, uint32_t image)
+{
+    std::deque<presented_t>& presented = handles->swapchainState->presented;
+
+    for (size_t i = presented.size(); i > 0; i--)
+    {
+        if (presented[i - 1].image != image)
+        {
+            continue;
+        }
+
+        if (i < presented.size())
+        {
+            profiler_end(handles, PROF_LATENCY, presented[i].input);
+        }
+        presented.erase(presented.begin(), presented.begin() + i);
+        break;
+    }
+}
+
+void
+swapchain_acquired(handles_t *handles, uint32_t image)
+{
+    if (handles->swapchainState->getPastPresentationTiming != NULL)
+    {
+        collect_present_times(handles);
+    }
+    else
+    {
+        estimate_latency(handles, image);
+    }
+}
+
+const void *
+swapchain_presenting(handles_t *handles, uint32_t image, uint64_t input)
+{
+    swapchain_s *state = handles->swapchainState;
+    presented_t p = {image, input, state->nextPresentId++};
+
+    state->presented.push_back(p);
+    if (state->presented.size() > PRESENT_HISTORY)
+    {
+        state->presented.pop_front();
+    }
+
+    if (state->getPastPresentationTiming == NULL)
+    {
+        return NULL;
+    }
+
+    /* as soon as possible, the ID is only there to match the reported time */
+    state->presentTime.presentID = p.presentId;
+    state->presentTime.desiredPresentTime = 0;
+
+    state->presentTimes = {};
+    state->presentTimes.sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE;
+    state->presentTimes.swapchainCount = 1;
+    state->presentTimes.pTimes = &(state->presentTime);
+
+    return &(state->presentTimes);
+}
+
+void
+swapchain_cleanup(handles_t *handles)
+{
+    swapchain_s *state = handles->swapchainState;
+
+    for (auto retired = state->retired.begin(); retired != state->retired.end(); ++retired)
+    {
+        destroy_retired(handles, &(*retired));
+    }
+    for (auto view = handles->swapChainImageViews.begin();
+         view != handles->swapChainImageViews.end(); ++view)
+    {
+        vkDestroyImageView(handles->device, *view, NULL);
+    }
+    vkDestroySwapchainKHR(handles->device, handles->swapchain, NULL);
+
+    delete state;
+    handles->swapchainState = NULL;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Window swapchain, created with the requested present mode if the
+ * surface has it and one image more than the surface's minimum, so
+ * acquiring never waits on the image the display is scanning out.
+ *
+ * On resize the swapchain is recreated with the old one handed over as
+ * oldSwapchain. Frames in flight keep rendering to the old images, which
+ * are destroyed once every frame slot has waited on its fence since,
+ * instead of idling the whole device.
+ *
+ * Latency from sampling input (the frame's UBO update) to the frame
+ * reaching the screen is measured with VK_GOOGLE_display_timing where the
+ * device has it: every present carries an ID and the actual present
+ * times reported for past IDs end the samples. Without it, latency is
+ * estimated from when the presentation engine gives images back: once
+ * the image of frame N is acquired again, the frame presented after N
+ * has replaced it on screen. Samples go to the profiler's PROF_LATENCY
+ * zone.
+ */
+
+/* "fifo", "fifo-relaxed", "mailbox" or "immediate", false for anything else */
+bool
+present_mode_parse(const char *name, VkPresentModeKHR *mode);
+
+const char *
+present_mode_name(VkPresentModeKHR mode);
+
+/* create the swapchain, its image views and framebuffers for handles->window */
+void
+swapchain_init(handles_t *handles);
+
+/*
+ * recreate the swapchain and framebuffers at the window's current size,
+ * waits while the window is minimized, returns false if it gets closed
+ */
+bool
+swapchain_recreate(handles_t *handles);
+
+/* call once per frame after its fence wait, frees retired swapchains */
+void
+swapchain_frame(handles_t *handles);
+
+/* latency bookkeeping, input is a profiler_begin() timestamp */
+void
+swapchain_acquired(handles_t *handles, uint32_t image);
+
+/* call right before presenting image, returns what to chain to the present info's pNext */
+const void *
+swapchain_presenting(handles_t *handles, uint32_t image, uint64_t input);
+
+/* destroys the swapchain, its image views and retired swapchains */
+void
+swapchain_cleanup(handles_t *handles);
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#include "thread_pool.h"
+
+struct thread_pool_s
+{
+    std::vector<std::thread> workers;
+    std::deque<std::packaged_task<void()> > jobs;
+    std::mutex lock;
+    std::condition_variable cond;
+    bool stop;
+};
+
+static void
+worker(thread_pool_s *pool)
+{
+    for (;;)
+    {
+        std::packaged_task<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock(pool->lock);
+            pool->cond.wait(lock, [pool] { return pool->stop || !pool->jobs.empty(); });
+
+            if (pool->jobs.empty())
+            {
+                return;
+            }
+
+            job = std::move(pool->jobs.front());
+            pool->jobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+void
+thread_pool_init(handles_t *handles, uint32_t threads)
+{
+    thread_pool_s *pool = new thread_pool_s();
+    handles->threadPool = pool;
+
+    if (threads == 0)
+    {
+        threads = std::max(2u, std::thread::hardware_concurrency());
+    }
+
+    pool->stop = false;
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        pool->workers.push_back(std::thread(worker, pool));
+    }
+}
+
+void
+thread_pool_cleanup(handles_t *handles)
+{
+    thread_pool_s *pool = handles->threadPool;
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stop = true;
+    }
+    pool->cond.notify_all();
+
+    /* workers finish queued jobs before exiting */
+    for (auto t = pool->workers.begin(); t != pool->workers.end(); ++t)
+    {
+        t->join();
+    }
+
+    delete pool;
+    handles->threadPool = NULL;
+}
+
+uint32_t
+thread_pool_size(handles_t *handles)
+{
+    return (uint32_t)handles->threadPool->workers.size();
+}
+
+std::future<void>
+thread_pool_run(handles_t *handles, std::function<void()> job)
+{
+    thread_pool_s *pool = handles->threadPool;
+    std::packaged_task<void()> task(job);
+    std::future<void> res = task.get_future();
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->jobs.push_back(std::move(task));
+    }
+    pool->cond.notify_one();
+
+    return res;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <functional>
+#include <future>
+
+#include "main.h"
+
+struct thread_pool_s;
+
+/*
+ * Fixed set of worker threads running jobs in submission order. Jobs
+ * submitted after the job they wait on can't deadlock the pool, as the
+ * earlier job has already been picked up by a worker.
+ */
+
+/* threads == 0 uses one worker per hardware thread */
+void
+thread_pool_init(handles_t *handles, uint32_t threads);
+
+void
+thread_pool_cleanup(handles_t *handles);
+
+uint32_t
+thread_pool_size(handles_t *handles);
+
+/* exceptions thrown by job are rethrown by get() on the returned future */
+std::future<void>
+thread_pool_run(handles_t *handles, std::function<void()> job);
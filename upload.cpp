@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+#include "upload.h"
+#include "gpu_buf.h"
+#include "utils.h"
+
+/* size of the staging ring */
+#define UPLOAD_RING_SIZE (16 * 1024 * 1024)
+
+/* larger uploads are split in pieces of this size */
+#define UPLOAD_CHUNK_SIZE (UPLOAD_RING_SIZE / 4)
+
+/* number of batches that can be in flight at once */
+#define UPLOAD_BATCHES 4
+
+typedef struct upload_batch_s
+{
+    VkCommandBuffer cmdBuf;
+    VkFence fence;
+    /* signaled by the transfer queue, waited on by the graphics queue */
+    VkSemaphore transferDone;
+    VkFence gfxWaitFence;
+    uint64_t ticket;
+    /* ring head after the last copy of the batch */
+    VkDeviceSize ringEnd;
+    bool inFlight;
+} upload_batch_t;
+
+struct upload_s
+{
+    std::mutex lock;
+    bool dedicatedQueue;
+    VkCommandPool commandPool;
+
+    VkBuffer ring;
+    gpu_allocation_t ringAlloc;
+    VkDeviceSize align;
+    VkDeviceSize head;
+    VkDeviceSize tail;
+
+    upload_batch_t batches[UPLOAD_BATCHES];
+    /* batch being recorded */
+    uint32_t current;
+    /* oldest batch in flight */
+    uint32_t oldest;
+    uint32_t inFlight;
+    /* copies recorded in current batch */
+    uint32_t copies;
+
+    uint64_t nextTicket;
+    uint64_t completedTicket;
+};
+
+static VkDeviceSize
+align_up(VkDeviceSize value, VkDeviceSize align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+static void
+retire_batch(upload_s *up)
+{
+    upload_batch_t *batch = &(up->batches[up->oldest]);
+
+    up->tail = batch->ringEnd;
+    up->completedTicket = batch->ticket;
+    batch->inFlight = false;
+
+    up->oldest = (up->oldest + 1) % UPLOAD_BATCHES;
+    up->inFlight -= 1;
+}
+
+static bool
+batch_finished(handles_t *handles, upload_batch_t *batch)
+{
+    if (vkGetFenceStatus(handles->device, batch->fence) != VK_SUCCESS)
+    {
+        return false;
+    }
+
+    return batch->gfxWaitFence == VK_NULL_HANDLE ||
+           vkGetFenceStatus(handles->device, batch->gfxWaitFence) == VK_SUCCESS;
+}
+
+/* retire all batches that have completed, without blocking */
+static void
+retire_completed(handles_t *handles, upload_s *up)
+{
+    while (up->inFlight > 0 && batch_finished(handles, &(up->batches[up->oldest])))
+    {
+        retire_batch(up);
+    }
+}
+
+/* block until oldest batch in flight completes */
+static void
+retire_oldest(handles_t *handles, upload_s *up)
+{
+    upload_batch_t *batch = &(up->batches[up->oldest]);
+
+    VkFence fences[2] = { batch->fence, batch->gfxWaitFence };
+    uint32_t count = batch->gfxWaitFence == VK_NULL_HANDLE ? 1 : 2;
+
+    check_res(
+        vkWaitForFences(handles->device, count, fences, VK_TRUE,
+                        std::numeric_limits<uint64_t>::max()),
+        "vkWaitForFences upload");
+
+    retire_batch(up);
+}
+
+static uint64_t
+flush_locked(handles_t *handles, upload_s *up)
+{
+    if (up->copies == 0)
+    {
+        return up->nextTicket - 1;
+    }
+
+    upload_batch_t *batch = &(up->batches[up->current]);
+
+    if (!up->dedicatedQueue)
+    {
+        /*
+         * make the copies visible to everything submitted later to the
+         * same queue, semaphores take care of this on a dedicated queue
+         */
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+        vkCmdPipelineBarrier(batch->cmdBuf,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+
+    check_res(
+        vkEndCommandBuffer(batch->cmdBuf),
+        "vkEndCommandBuffer upload");
+
+    check_res(
+        vkResetFences(handles->device, 1, &(batch->fence)),
+        "vkResetFences upload");
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &(batch->cmdBuf);
+
+    if (up->dedicatedQueue)
+    {
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &(batch->transferDone);
+
+        check_res(
+            vkQueueSubmit(handles->transferQueue, 1, &submitInfo, batch->fence),
+            "vkQueueSubmit upload");
+
+        /*
+         * order all later graphics work after the copies with an empty
+         * submission, so that drawing code does not need to know about uploads
+         */
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        waitInfo.waitSemaphoreCount = 1;
+        waitInfo.pWaitSemaphores = &(batch->transferDone);
+        waitInfo.pWaitDstStageMask = &waitStage;
+
+        check_res(
+            vkResetFences(handles->device, 1, &(batch->gfxWaitFence)),
+            "vkResetFences upload");
+
+        std::lock_guard<std::mutex> guard(handles->queueLock);
+        check_res(
+            vkQueueSubmit(handles->gfxQueue, 1, &waitInfo, batch->gfxWaitFence),
+            "vkQueueSubmit upload wait");
+    }
+    else
+    {
+        std::lock_guard<std::mutex> guard(handles->queueLock);
+        check_res(
+            vkQueueSubmit(handles->transferQueue, 1, &submitInfo, batch->fence),
+            "vkQueueSubmit upload");
+    }
+
+    batch->ticket = up->nextTicket++;
+    batch->ringEnd = up->head;
+    batch->inFlight = true;
+
+    up->inFlight += 1;
+    up->current = (up->current + 1) % UPLOAD_BATCHES;
+    up->copies = 0;
+
+    return batch->ticket;
+}
+
+/*
+ * reserve size bytes of the staging ring, flushing and waiting
+ * for old batches if the ring is full
+ */
+static VkDeviceSize
+ring_alloc(handles_t *handles, upload_s *up, VkDeviceSize size)
+{
+    for (;;)
+    {
+        retire_completed(handles, up);
+
+        bool empty = up->inFlight == 0 && up->copies == 0;
+        if (empty)
+        {
+            up->head = 0;
+            up->tail = 0;
+        }
+
+        VkDeviceSize off = align_up(up->head, up->align);
+
+        /* head never catches up with tail, head == tail means empty */
+        if (up->head > up->tail || empty)
+        {
+            if (off + size <= UPLOAD_RING_SIZE)
+            {
+                up->head = off + size;
+                return off;
+            }
+
+            /* wrap around */
+            if (size < up->tail)
+            {
+                up->head = size;
+                return 0;
+            }
+        }
+        else if (off + size < up->tail)
+        {
+            up->head = off + size;
+            return off;
+        }
+
+        flush_locked(handles, up);
+        retire_oldest(handles, up);
+    }
+}
+
+static VkCommandBuffer
+current_cmd_buf(handles_t *handles, upload_s *up)
+{
+    upload_batch_t *batch = &(up->batches[up->current]);
+
+    if (up->copies > 0)
+    {
+        return batch->cmdBuf;
+    }
+
+    while (batch->inFlight)
+    {
+        retire_oldest(handles, up);
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    check_res(
+        vkBeginCommandBuffer(batch->cmdBuf, &beginInfo),
+        "vkBeginCommandBuffer upload");
+
+    return batch->cmdBuf;
+}
+
+void
+upload_init(handles_t *handles)
+{
+    upload_s *up = new upload_s();
+
+    up->dedicatedQueue = handles->transferFamilyIndex != handles->gfxFamilyIndex;
+    up->head = 0;
+    up->tail = 0;
+    up->current = 0;
+    up->oldest = 0;
+    up->inFlight = 0;
+    up->copies = 0;
+    up->nextTicket = 1;
+    up->completedTicket = 0;
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(handles->phyDevice, &props);
+    up->align = std::max<VkDeviceSize>(props.limits.optimalBufferCopyOffsetAlignment, 16);
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                     VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = handles->transferFamilyIndex;
+
+    check_res(
+        vkCreateCommandPool(handles->device, &poolInfo, NULL, &(up->commandPool)),
+        "vkCreateCommandPool upload");
+
+    VkCommandBuffer cmdBufs[UPLOAD_BATCHES];
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = up->commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = UPLOAD_BATCHES;
+
+    check_res(
+        vkAllocateCommandBuffers(handles->device, &allocInfo, cmdBufs),
+        "vkAllocateCommandBuffers upload");
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < UPLOAD_BATCHES; i++)
+    {
+        upload_batch_t *batch = &(up->batches[i]);
+
+        batch->cmdBuf = cmdBufs[i];
+        batch->transferDone = VK_NULL_HANDLE;
+        batch->gfxWaitFence = VK_NULL_HANDLE;
+        batch->ticket = 0;
+        batch->ringEnd = 0;
+        batch->inFlight = false;
+
+        check_res(
+            vkCreateFence(handles->device, &fenceInfo, NULL, &(batch->fence)),
+            "vkCreateFence upload");
+
+        if (up->dedicatedQueue)
+        {
+            check_res(
+                vkCreateSemaphore(handles->device, &semaphoreInfo, NULL, &(batch->transferDone)),
+                "vkCreateSemaphore upload");
+
+            check_res(
+                vkCreateFence(handles->device, &fenceInfo, NULL, &(batch->gfxWaitFence)),
+                "vkCreateFence upload");
+        }
+    }
+
+    createBuffer(handles,
+                 UPLOAD_RING_SIZE,
+                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 up->ring, up->ringAlloc);
+
+    handles->upload = up;
+
+    printf("uploads on %s queue family %u\n",
+           up->dedicatedQueue ? "dedicated transfer" : "graphics",
+           handles->transferFamilyIndex);
+}
+
+void
+upload_cleanup(handles_t *handles)
+{
+    upload_s *up = handles->upload;
+
+    flush_locked(handles, up);
+    while (up->inFlight > 0)
+    {
+        retire_oldest(handles, up);
+    }
+
+    for (uint32_t i = 0; i < UPLOAD_BATCHES; i++)
+    {
+        upload_batch_t *batch = &(up->batches[i]);
+
+        vkDestroyFence(handles->device, batch->fence, NULL);
+        if (up->dedicatedQueue)
+        {
+            vkDestroySemaphore(handles->device, batch->transferDone, NULL);
+            vkDestroyFence(handles->device, batch->gfxWaitFence, NULL);
+        }
+    }
+
+    vkDestroyCommandPool(handles->device, up->commandPool, NULL);
+
+    vkDestroyBuffer(handles->device, up->ring, NULL);
+    gpu_free(handles, &(up->ringAlloc));
+
+    delete up;
+    handles->upload = NULL;
+}
+
+void
+upload_buffer(handles_t *handles,
+              VkBuffer dst, VkDeviceSize dstOffset,
+              const void *data, VkDeviceSize size)
+{
+    upload_s *up = handles->upload;
+    std::lock_guard<std::mutex> guard(up->lock);
+
+    const char *src = (const char *)data;
+
+    while (size > 0)
+    {
+        VkDeviceSize chunk = std::min<VkDeviceSize>(size, UPLOAD_CHUNK_SIZE);
+        VkDeviceSize ringOffset = ring_alloc(handles, up, chunk);
+
+        memcpy((char *)up->ringAlloc.mapped + ringOffset, src, (size_t)chunk);
+
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = ringOffset;
+        copyRegion.dstOffset = dstOffset;
+        copyRegion.size = chunk;
+        vkCmdCopyBuffer(current_cmd_buf(handles, up), up->ring, dst, 1, &copyRegion);
+        up->copies += 1;
+
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+}
+
+uint64_t
+upload_flush(handles_t *handles)
+{
+    upload_s *up = handles->upload;
+    std::lock_guard<std::mutex> guard(up->lock);
+
+    return flush_locked(handles, up);
+}
+
+bool
+upload_done(handles_t *handles, uint64_t ticket)
+{
+    upload_s *up = handles->upload;
+    std::lock_guard<std::mutex> guard(up->lock);
+
+    retire_completed(handles, up);
+
+    return up->completedTicket >= ticket;
+}
+
+void
+upload_wait(handles_t *handles, uint64_t ticket)
+{
+    upload_s *up = handles->upload;
+    std::lock_guard<std::mutex> guard(up->lock);
+
+    if (ticket >= up->nextTicket)
+    {
+        flush_locked(handles, up);
+    }
+
+    while (up->completedTicket < ticket && up->inFlight > 0)
+    {
+        retire_oldest(handles, up);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "main.h"
+
+/*
+ * Batched buffer uploads through a persistently mapped staging ring.
+ *
+ * Copies are recorded into the current batch command buffer and
+ * submitted together, on the dedicated transfer queue if the device
+ * has one. Every submitted batch gets a ticket, a monotonically
+ * increasing value that can be polled or waited on. Work submitted
+ * on the graphics queue after upload_flush() is ordered after the
+ * flushed copies, so no host side wait is needed before drawing.
+ */
+
+void
+upload_init(handles_t *handles);
+
+void
+upload_cleanup(handles_t *handles);
+
+/*
+ * Copy size bytes from data into dst at dstOffset. Data is copied to the
+ * staging ring before the call returns, the GPU copy happens on flush.
+ */
+void
+upload_buffer(handles_t *handles,
+              VkBuffer dst, VkDeviceSize dstOffset,
+              const void *data, VkDeviceSize size);
+
+/* submit all queued copies, returns the ticket of the submitted batch */
+uint64_t
+upload_flush(handles_t *handles);
+
+/* check if batch with ticket and all batches before it have completed */
+bool
+upload_done(handles_t *handles, uint64_t ticket);
+
+/* block until batch with ticket and all batches before it have completed */
+void
+upload_wait(handles_t *handles, uint64_t ticket);
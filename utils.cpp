@@ -4,13 +4,19 @@
 #include <iostream>
 #include <vulkan/vulkan.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "utils.h"
 
 void
 bail_out(const char *msg)
 {
 	printf("error: %s\n", msg);
-	fgetc(stdin);
 	exit(EXIT_FAILURE);
 }
 
@@ -50,3 +56,57 @@ read_file(const std::string& filename)
 
     return buffer;
 }
+
+void
+map_file(const std::string& filename, mapped_file_t *file)
+{
+    file->data = NULL;
+    file->size = 0;
+
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("failed to open " + filename);
+    }
+
+    struct stat st;
+    bool statted = fstat(fd, &st) == 0;
+    if (statted && st.st_size > 0)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            /* parsed in parallel from front to back, start reading ahead */
+            madvise(data, st.st_size, MADV_WILLNEED);
+            file->data = (const char *)data;
+            file->size = st.st_size;
+        }
+    }
+    close(fd);
+
+    /* nothing to map in an empty file */
+    if (file->data != NULL || (statted && st.st_size == 0))
+    {
+        return;
+    }
+#endif
+
+    file->copy = read_file(filename);
+    file->data = file->copy.data();
+    file->size = file->copy.size();
+}
+
+void
+unmap_file(mapped_file_t *file)
+{
+#ifndef _WIN32
+    if (file->copy.empty() && file->data != NULL)
+    {
+        munmap((void *)file->data, file->size);
+    }
+#endif
+    file->copy.clear();
+    file->data = NULL;
+    file->size = 0;
+}
@@ -12,5 +12,21 @@ check_res(VkResult res, const char *msg);
 std::vector<char>
 read_file(const std::string& filename);
 
+/* read only view of a whole file, memory mapped where possible */
+typedef struct mapped_file_s
+{
+    const char *data;
+    size_t size;
+    /* file contents if it could not be mapped */
+    std::vector<char> copy;
+} mapped_file_t;
+
+/* throws std::runtime_error like read_file() */
+void
+map_file(const std::string& filename, mapped_file_t *file);
+
+void
+unmap_file(mapped_file_t *file);
+
 const char *
 yes_no(VkBool32 b);
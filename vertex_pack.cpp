@@ -0,0 +1,211 @@
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "vertex_pack.h"
+
+/* SSE2 is part of x86-64 */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PACK_X86 1
+#include <immintrin.h>
+#else
+#define PACK_X86 0
+#endif
+
+vertex_format_t
+vertex_format_select(vertex_format_t requested, const scene_t *scene)
+{
+    if (!scene->instances.empty())
+    {
+        return VERTEX_FORMAT_FLOAT;
+    }
+    if (requested != VERTEX_FORMAT_AUTO)
+    {
+        return requested;
+    }
+
+    size_t count;
+    scene_vertices(scene, &count);
+    return count >= VERTEX_PACK_MIN_VERTICES ? VERTEX_FORMAT_PACKED : VERTEX_FORMAT_FLOAT;
+}
+
+const char *
+vertex_format_name(vertex_format_t format)
+{
+    switch (format)
+    {
+        case VERTEX_FORMAT_AUTO:
+            return "auto";
+        case VERTEX_FORMAT_PACKED:
+            return "packed";
+        default:
+            return "float";
+    }
+}
+
+bool
+vertex_format_parse(const char *name, vertex_format_t *format)
+{
+    const vertex_format_t formats[] = {VERTEX_FORMAT_AUTO, VERTEX_FORMAT_FLOAT, VERTEX_FORMAT_PACKED};
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if (strcmp(name, vertex_format_name(formats[i])) == 0)
+        {
+            *format = formats[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t
+vertex_format_size(vertex_format_t format)
+{
+    return format == VERTEX_FORMAT_PACKED ? sizeof(VertexPacked) : sizeof(Vertex);
+}
+
+static void
+bounds_scalar(const Vertex *vertices, size_t count, glm::vec3 *lo, glm::vec3 *hi)
+{
+    *lo = *hi = vertices[0].pos;
+    for (size_t i = 1; i < count; i++)
+    {
+        *lo = glm::min(*lo, vertices[i].pos);
+        *hi = glm::max(*hi, vertices[i].pos);
+    }
+}
+
+static inline void
+pack_scalar(const Vertex *v, glm::vec3 lo, glm::vec3 inv, VertexPacked *out)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        float p = std::min(std::max((v->pos[c] - lo[c]) * inv[c], 0.0f), 1.0f);
+        float col = std::min(std::max(v->color[c], 0.0f), 1.0f);
+        out->pos[c] = (uint16_t)(p * 65535.0f + 0.5f);
+        out->color[c] = (uint8_t)(col * 255.0f + 0.5f);
+    }
+    out->pos[3] = 0;
+    out->color[3] = 255;
+}
+
+#if PACK_X86
+static void
+bounds_sse2(const Vertex *vertices, size_t count, glm::vec3 *lo, glm::vec3 *hi)
+{
+    /* x y z r of every vertex, r is dropped at the end */
+    __m128 vlo = _mm_loadu_ps(&(vertices[0].pos.x));
+    __m128 vhi = vlo;
+    for (size_t i = 1; i < count; i++)
+    {
+        __m128 p = _mm_loadu_ps(&(vertices[i].pos.x));
+        vlo = _mm_min_ps(vlo, p);
+        vhi = _mm_max_ps(vhi, p);
+    }
+
+    float l[4], h[4];
+    _mm_storeu_ps(l, vlo);
+    _mm_storeu_ps(h, vhi);
+    *lo = glm::vec3(l[0], l[1], l[2]);
+    *hi = glm::vec3(h[0], h[1], h[2]);
+}
+
+static void
+pack_sse2(const Vertex *vertices, size_t count, glm::vec3 lo, glm::vec3 inv,
+          VertexPacked *out)
+{
+    const __m128 vlo = _mm_setr_ps(lo.x, lo.y, lo.z, 0.0f);
+    /* zero in the last lane clears the pad of pos */
+    const __m128 vinv = _mm_setr_ps(inv.x, inv.y, inv.z, 0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 posMax = _mm_set1_ps(65535.0f);
+    const __m128 colorMax = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    /* r g b and 1 for alpha */
+    const __m128 rgbMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    const __m128 alpha = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    /* SSE2 has no unsigned 32 to 16 bit pack, bias into the signed range */
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const float *v = &(vertices[i].pos.x);
+
+        /* x y z r and z r g b, both within the vertex */
+        __m128 p = _mm_loadu_ps(v);
+        __m128 c = _mm_loadu_ps(v + 2);
+
+        p = _mm_mul_ps(_mm_sub_ps(p, vlo), vinv);
+        p = _mm_min_ps(_mm_max_ps(p, zero), one);
+        __m128i pi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(p, posMax), half));
+        pi = _mm_packs_epi32(_mm_sub_epi32(pi, bias32), _mm_setzero_si128());
+        pi = _mm_xor_si128(pi, bias16);
+        _mm_storel_epi64((__m128i *)out[i].pos, pi);
+
+        c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 2, 1));
+        c = _mm_or_ps(_mm_and_ps(c, rgbMask), alpha);
+        c = _mm_min_ps(_mm_max_ps(c, zero), one);
+        __m128i ci = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, colorMax), half));
+        ci = _mm_packs_epi32(ci, ci);
+        ci = _mm_packus_epi16(ci, ci);
+        int32_t rgba = _mm_cvtsi128_si32(ci);
+        memcpy(out[i].color, &rgba, sizeof(rgba));
+    }
+}
+#endif
+
+/* flat axes quantize to 0 and decode to lo */
+static glm::vec3
+quantization(glm::vec3 lo, glm::vec3 hi, glm::vec4 *scale, glm::vec4 *offset)
+{
+    glm::vec3 extent = hi - lo;
+    glm::vec3 inv;
+    for (int c = 0; c < 3; c++)
+    {
+        inv[c] = extent[c] > 0.0f ? 1.0f / extent[c] : 0.0f;
+    }
+
+    *scale = glm::vec4(extent, 0.0f);
+    *offset = glm::vec4(lo, 0.0f);
+    return inv;
+}
+
+void
+vertex_pack_scalar(const Vertex *vertices, size_t count, VertexPacked *out,
+                   glm::vec4 *scale, glm::vec4 *offset)
+{
+    glm::vec3 lo(0.0f), hi(0.0f);
+    if (count > 0)
+    {
+        bounds_scalar(vertices, count, &lo, &hi);
+    }
+
+    glm::vec3 inv = quantization(lo, hi, scale, offset);
+    for (size_t i = 0; i < count; i++)
+    {
+        pack_scalar(&(vertices[i]), lo, inv, &(out[i]));
+    }
+}
+
+void
+vertex_pack(const Vertex *vertices, size_t count, VertexPacked *out,
+            glm::vec4 *scale, glm::vec4 *offset)
+{
+#if PACK_X86
+    glm::vec3 lo(0.0f), hi(0.0f);
+    if (count > 0)
+    {
+        bounds_sse2(vertices, count, &lo, &hi);
+    }
+
+    glm::vec3 inv = quantization(lo, hi, scale, offset);
+    pack_sse2(vertices, count, lo, inv, out);
+#else
+    vertex_pack_scalar(vertices, count, out, scale, offset);
+#endif
+}
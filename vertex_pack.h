@@ -0,0 +1,45 @@
+#pragma once
+
+#include "main.h"
+#include "scene.h"
+
+/*
+ * Vertex quantization into VertexPacked: positions to 16 bit UNORM over
+ * the mesh bounds, colors to 8 bit UNORM. Halves the vertex buffer and
+ * the vertex fetch bandwidth, at an error of about 1/131070 of the mesh
+ * extent per axis.
+ */
+
+/* VERTEX_FORMAT_AUTO packs scenes with at least this many vertices */
+#define VERTEX_PACK_MIN_VERTICES 65536
+
+/*
+ * resolve VERTEX_FORMAT_AUTO for scene, instanced scenes always use
+ * floats as the instanced vertex shader has no packed variant
+ */
+vertex_format_t
+vertex_format_select(vertex_format_t requested, const scene_t *scene);
+
+const char *
+vertex_format_name(vertex_format_t format);
+
+/* "auto", "float" or "packed", returns false for anything else */
+bool
+vertex_format_parse(const char *name, vertex_format_t *format);
+
+/* bytes per vertex in the vertex buffer */
+size_t
+vertex_format_size(vertex_format_t format);
+
+/*
+ * encode count vertices into out, writes the dequantization to scale and
+ * offset, SSE2 on x86-64 and vertex_pack_scalar() elsewhere
+ */
+void
+vertex_pack(const Vertex *vertices, size_t count, VertexPacked *out,
+            glm::vec4 *scale, glm::vec4 *offset);
+
+/* the same encoding without SIMD, built everywhere so bench can compare */
+void
+vertex_pack_scalar(const Vertex *vertices, size_t count, VertexPacked *out,
+                   glm::vec4 *scale, glm::vec4 *offset);